@@ -4,6 +4,8 @@
 #include <st-compiler.h>
 #include <st-machine.h>
 #include <st-array.h>
+#include <st-aot.h>
+#include <st-image.h>
 //#include <st-lexer.h>
 //#include <st-node.h>
 //#include <st-universe.h>
@@ -21,11 +23,23 @@
 static const char version[] = "PACKAGE_STRING\nCopyright (C) 2007-2008 Vincent Geddes";
 
 static bool verbose = false;
+static int jit = 1;
+static int cache = 1;
+static int lazy = 0;
+static struct opt_str aot = { NULL, 0 };
+static struct opt_str image = { NULL, 0 };
+static struct opt_str save_image = { NULL, 0 };
 
 struct opt_spec options[] = {
 		{opt_help,    "h", "--help",    NULL, "Show help information", NULL},
 		{opt_version, "V", "--version", NULL, "Show version information", (char *) version},
 		{opt_store_1, "v", "--verbose", NULL, "Show verbose messages",    &verbose},
+		{opt_store_0, "J", "--no-jit",  NULL, "Disable the native code compiler", &jit},
+		{opt_store_0, OPT_NO_SF, "--no-cache", NULL, "Compile the kernel without the bytecode cache", &cache},
+		{opt_store_1, OPT_NO_SF, "--lazy", NULL, "Compile kernel methods when they are first sent", &lazy},
+		{opt_store_str, OPT_NO_SF, "--aot", "FILE", "Write the kernel methods as C source to FILE", &aot},
+		{opt_store_str, OPT_NO_SF, "--image", "FILE", "Start from the objects in image FILE", &image},
+		{opt_store_str, OPT_NO_SF, "--save-image", "FILE", "Write the kernel as an image to FILE", &save_image},
 		{NULL}
 };
 
@@ -63,11 +77,31 @@ int main(int argc, char *argv[]) {
 	opt_parse("Usage: %s [options]", options, argv);
 
 	st_set_verbose_mode(verbose);
+	st_set_cache_mode(cache);
+	/* native code is only written for compiled methods */
+	st_set_lazy_mode(lazy && aot.s == NULL);
+
+	if (image.s != NULL) {
+		image.s[0] = image.s0;
+		if (!st_image_load(image.s))
+			return 1;
+	} else {
+		st_initialize();
+	}
+
+	if (save_image.s != NULL) {
+		save_image.s[0] = save_image.s0;
+		return st_image_save(save_image.s) ? 0 : 1;
+	}
 
-	st_initialize();
+	if (aot.s != NULL) {
+		aot.s[0] = aot.s0;
+		return st_aot_write_kernel(aot.s) ? 0 : 1;
+	}
 
 	read_compile_stdin();
 
+	__machine.jit = jit;
 	st_machine_initialize(&__machine);
 	st_machine_main(&__machine);
 
@@ -0,0 +1,451 @@
+/*
+ * st-aot.c
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+/*
+ * Compiles the methods of the kernel to C ahead of time, and installs
+ * the functions linked into the executable when methods are translated.
+ *
+ * The generated code follows the templates of the first tier in
+ * st-jit.c: pushes and stores, jumps, and SmallInteger arithmetic and
+ * comparisons run natively, and every other instruction exits to the
+ * interpreter.
+ */
+
+#include "st-aot.h"
+#include "st-compiler.h"
+#include "st-method.h"
+#include "st-array.h"
+#include "st-behavior.h"
+#include "st-utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* a native run shorter than this costs more to enter than it saves */
+#define MIN_RUN_LENGTH 3
+
+#ifdef ST_HAVE_NATIVE_KERNEL
+extern const st_aot_method st_aot_methods[];
+extern const st_uint st_aot_method_count;
+#else
+static const st_aot_method *st_aot_methods = NULL;
+static const st_uint st_aot_method_count = 0;
+#endif
+
+/* indices of st_aot_methods plus one, by hash of their bytecode */
+static st_uint *table = NULL;
+static st_uint table_mask;
+
+static bool is_native(st_uchar opcode) {
+	switch (opcode) {
+	case PUSH_TEMP:
+	case PUSH_INSTVAR:
+	case STORE_TEMP:
+	case STORE_POP_TEMP:
+	case STORE_INSTVAR:
+	case STORE_POP_INSTVAR:
+	case PUSH_SELF:
+	case PUSH_NIL:
+	case PUSH_TRUE:
+	case PUSH_FALSE:
+	case PUSH_INTEGER:
+	case PUSH_LITERAL_CONST:
+	case PUSH_LITERAL_VAR:
+	case STORE_LITERAL_VAR:
+	case STORE_POP_LITERAL_VAR:
+	case POP_STACK_TOP:
+	case DUPLICATE_STACK_TOP:
+	case JUMP:
+	case JUMP_TRUE:
+	case JUMP_FALSE:
+	case SEND_PLUS:
+	case SEND_MINUS:
+	case SEND_MUL:
+	case SEND_LT:
+	case SEND_GT:
+	case SEND_LE:
+	case SEND_GE:
+	case SEND_EQ:
+	case SEND_NE:
+	case SEND_BITAND:
+	case SEND_BITOR:
+	case SEND_BITXOR:
+	case SEND_IDENTITY_EQ:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* marks the instructions that start a long enough run of native ones */
+static bool find_entries(const st_uchar *bytecode, st_uint size, bool *entries) {
+	st_uint *starts;
+	st_uint count, run;
+	bool found;
+
+	starts = st_malloc(size * sizeof(st_uint));
+	count = 0;
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i]))
+		starts[count++] = i;
+
+	run = 0;
+	found = false;
+	memset(entries, 0, size * sizeof(bool));
+	while (count-- > 0) {
+		run = is_native(bytecode[starts[count]]) ? run + 1 : 0;
+		entries[starts[count]] = run >= MIN_RUN_LENGTH;
+		found |= entries[starts[count]];
+	}
+
+	st_free(starts);
+	return found;
+}
+
+static st_uint hash_bytecode(const st_uchar *bytecode, st_uint size) {
+	st_uint hash = 2166136261u;
+
+	for (st_uint i = 0; i < size; i++)
+		hash = (hash ^ bytecode[i]) * 16777619u;
+	return hash;
+}
+
+static st_jit_entry find_function(const st_uchar *bytecode, st_uint size) {
+	const st_aot_method *method;
+	st_uint i;
+
+	if (table == NULL) {
+		table_mask = 1;
+		while (table_mask < st_aot_method_count * 2)
+			table_mask <<= 1;
+		table = st_malloc0(table_mask * sizeof(st_uint));
+		table_mask--;
+
+		for (st_uint m = 0; m < st_aot_method_count; m++) {
+			i = hash_bytecode(st_aot_methods[m].bytecode, st_aot_methods[m].size) & table_mask;
+			while (table[i] != 0)
+				i = (i + 1) & table_mask;
+			table[i] = m + 1;
+		}
+	}
+
+	for (i = hash_bytecode(bytecode, size) & table_mask; table[i] != 0; i = (i + 1) & table_mask) {
+		method = st_aot_methods + table[i] - 1;
+		if (method->size == size && memcmp(method->bytecode, bytecode, size) == 0)
+			return method->function;
+	}
+	return NULL;
+}
+
+void st_aot_install(st_machine *machine, st_threaded_code *threaded) {
+	const st_uchar *bytecode;
+	st_jit_entry function;
+	st_jit_code *jit;
+	bool *entries;
+	st_uint size;
+
+	if (st_aot_method_count == 0 || machine->labels == NULL
+	    || ST_METHOD_BYTECODE (threaded->method) == ST_NIL)
+		return;
+
+	bytecode = st_method_bytecode_bytes(threaded->method);
+	size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (threaded->method)));
+
+	function = find_function(bytecode, size);
+	if (function == NULL)
+		return;
+
+	entries = st_malloc(size * sizeof(bool));
+	find_entries(bytecode, size, entries);
+
+	jit = st_new0(st_jit_code);
+	jit->entries = st_malloc0(size * sizeof(st_jit_entry));
+	for (st_uint i = 0; i < size; i++) {
+		if (entries[i])
+			jit->entries[i] = function;
+	}
+#ifndef ST_HAVE_JIT
+	/* without the optimizing tier, profiles are of no use */
+	jit->optimized = true;
+#endif
+	st_jit_install(machine, threaded, jit);
+
+	st_free(entries);
+}
+
+static st_uint jump_target(const st_uchar *bytecode, st_uint i) {
+	if (bytecode[i] == JUMP)
+		return i + 3 + *((short *) (bytecode + i + 1));
+	return i + 3 + *((unsigned short *) (bytecode + i + 1));
+}
+
+static void write_comparison(FILE *file, st_uint i, const char *operator) {
+	fprintf(file, "\tif (!st_aot_smis(sp[-2], sp[-1]))\n\t\tST_AOT_EXIT (%u);\n", i);
+	fprintf(file, "\tsp[-2] = st_smi_value(sp[-2]) %s st_smi_value(sp[-1]) ? ST_TRUE : ST_FALSE;\n", operator);
+	fprintf(file, "\tsp--;\n");
+}
+
+static void write_instruction(FILE *file, const st_uchar *bytecode, st_uint i) {
+	static const char *const globals[] = { "ST_NIL", "ST_TRUE", "ST_FALSE" };
+	static const char *const arithmetic[] = { "add", "sub", "mul" };
+
+	switch (bytecode[i]) {
+	case PUSH_TEMP:
+		fprintf(file, "\t*sp++ = temps[%u];\n", bytecode[i + 1]);
+		break;
+	case PUSH_INSTVAR:
+		fprintf(file, "\t*sp++ = ST_OBJECT_FIELDS (self)[%u];\n", bytecode[i + 1]);
+		break;
+	case STORE_TEMP:
+	case STORE_POP_TEMP:
+		fprintf(file, "\ttemps[%u] = %s;\n", bytecode[i + 1], bytecode[i] == STORE_TEMP ? "sp[-1]" : "*--sp");
+		break;
+	case STORE_INSTVAR:
+	case STORE_POP_INSTVAR:
+		fprintf(file, "\tST_OBJECT_FIELDS (self)[%u] = %s;\n", bytecode[i + 1],
+		        bytecode[i] == STORE_INSTVAR ? "sp[-1]" : "*--sp");
+		break;
+	case PUSH_SELF:
+		fprintf(file, "\t*sp++ = self;\n");
+		break;
+	case PUSH_NIL:
+	case PUSH_TRUE:
+	case PUSH_FALSE:
+		fprintf(file, "\t*sp++ = %s;\n", globals[bytecode[i] - PUSH_NIL]);
+		break;
+	case PUSH_INTEGER:
+	case PUSH_LITERAL_CONST:
+		fprintf(file, "\t*sp++ = code[%u];\n", i + 1);
+		break;
+	case PUSH_LITERAL_VAR:
+		fprintf(file, "\t*sp++ = ST_ASSOCIATION_VALUE (code[%u]);\n", i + 1);
+		break;
+	case STORE_LITERAL_VAR:
+	case STORE_POP_LITERAL_VAR:
+		fprintf(file, "\tST_ASSOCIATION_VALUE (code[%u]) = %s;\n", i + 1,
+		        bytecode[i] == STORE_LITERAL_VAR ? "sp[-1]" : "*--sp");
+		break;
+	case POP_STACK_TOP:
+		fprintf(file, "\tsp--;\n");
+		break;
+	case DUPLICATE_STACK_TOP:
+		fprintf(file, "\tsp[0] = sp[-1];\n\tsp++;\n");
+		break;
+	case JUMP:
+		fprintf(file, "\tgoto L%u;\n", jump_target(bytecode, i));
+		break;
+	case JUMP_TRUE:
+	case JUMP_FALSE:
+		fprintf(file, "\tif (sp[-1] == %s) {\n\t\tsp--;\n\t\tgoto L%u;\n\t}\n",
+		        bytecode[i] == JUMP_TRUE ? "ST_TRUE" : "ST_FALSE", jump_target(bytecode, i));
+		fprintf(file, "\tif (sp[-1] != %s)\n\t\tST_AOT_EXIT (%u);\n\tsp--;\n",
+		        bytecode[i] == JUMP_TRUE ? "ST_FALSE" : "ST_TRUE", i);
+		break;
+	case SEND_PLUS:
+	case SEND_MINUS:
+	case SEND_MUL:
+		fprintf(file, "\tif (!st_aot_%s(sp[-2], sp[-1], sp - 2))\n\t\tST_AOT_EXIT (%u);\n\tsp--;\n",
+		        arithmetic[bytecode[i] == SEND_PLUS ? 0 : bytecode[i] == SEND_MINUS ? 1 : 2], i);
+		break;
+	case SEND_LT:
+		write_comparison(file, i, "<");
+		break;
+	case SEND_GT:
+		write_comparison(file, i, ">");
+		break;
+	case SEND_LE:
+		write_comparison(file, i, "<=");
+		break;
+	case SEND_GE:
+		write_comparison(file, i, ">=");
+		break;
+	case SEND_EQ:
+		write_comparison(file, i, "==");
+		break;
+	case SEND_NE:
+		write_comparison(file, i, "!=");
+		break;
+	case SEND_BITAND:
+	case SEND_BITOR:
+	case SEND_BITXOR:
+		/* the tags of SmallIntegers are zero, and stay so */
+		fprintf(file, "\tif (!st_aot_smis(sp[-2], sp[-1]))\n\t\tST_AOT_EXIT (%u);\n", i);
+		fprintf(file, "\tsp[-2] = sp[-2] %s sp[-1];\n\tsp--;\n",
+		        bytecode[i] == SEND_BITAND ? "&" : bytecode[i] == SEND_BITOR ? "|" : "^");
+		break;
+	case SEND_IDENTITY_EQ:
+		fprintf(file, "\tsp[-2] = sp[-2] == sp[-1] ? ST_TRUE : ST_FALSE;\n\tsp--;\n");
+		break;
+	default:
+		fprintf(file, "\tST_AOT_EXIT (%u);\n", i);
+		break;
+	}
+}
+
+static void write_function(FILE *file, st_uint number, st_oop class, st_oop selector,
+                           const st_uchar *bytecode, st_uint size, const bool *entries) {
+	bool *labels;
+	bool uses_temps = false, uses_self = false, uses_code = false;
+	st_uchar opcode;
+
+	labels = st_malloc(size * sizeof(bool));
+	memcpy(labels, entries, size * sizeof(bool));
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		opcode = bytecode[i];
+		if (opcode == JUMP || opcode == JUMP_TRUE || opcode == JUMP_FALSE)
+			labels[jump_target(bytecode, i)] = true;
+		uses_temps |= opcode == PUSH_TEMP || opcode == STORE_TEMP || opcode == STORE_POP_TEMP;
+		uses_self |= opcode == PUSH_SELF || opcode == PUSH_INSTVAR || opcode == STORE_INSTVAR
+		             || opcode == STORE_POP_INSTVAR;
+		uses_code |= opcode == PUSH_INTEGER || opcode == PUSH_LITERAL_CONST || opcode == PUSH_LITERAL_VAR
+		             || opcode == STORE_LITERAL_VAR || opcode == STORE_POP_LITERAL_VAR;
+	}
+
+	if (st_object_class(class) == ST_METACLASS_CLASS)
+		fprintf(file, "/* %s class>>%s */\n",
+		        (char *) st_byte_array_bytes(ST_CLASS_NAME (ST_METACLASS_INSTANCE_CLASS (class))),
+		        (char *) st_byte_array_bytes(selector));
+	else
+		fprintf(file, "/* %s>>%s */\n", (char *) st_byte_array_bytes(ST_CLASS_NAME (class)),
+		        (char *) st_byte_array_bytes(selector));
+
+	fprintf(file, "static const st_uchar bytecode_%u[] = {", number);
+	for (st_uint i = 0; i < size; i++)
+		fprintf(file, "%s%u,", i % 16 == 0 ? "\n\t" : " ", bytecode[i]);
+	fprintf(file, "\n};\n\n");
+
+	fprintf(file, "static st_oop *method_%u(st_machine *machine, st_oop *sp) {\n", number);
+	if (uses_code)
+		fprintf(file, "\tconst st_oop *code = machine->code;\n");
+	if (uses_temps)
+		fprintf(file, "\tst_oop *temps = machine->temps;\n");
+	if (uses_self)
+		fprintf(file, "\tst_oop self = machine->receiver;\n");
+	if (uses_code || uses_temps || uses_self)
+		fprintf(file, "\n");
+
+	fprintf(file, "\tswitch (machine->ip) {\n");
+	for (st_uint i = 0; i < size; i++) {
+		if (entries[i])
+			fprintf(file, "\tcase %u:\n\t\tgoto L%u;\n", i, i);
+	}
+	fprintf(file, "\tdefault:\n\t\tST_AOT_EXIT (machine->ip);\n\t}\n\n");
+
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		if (labels[i])
+			fprintf(file, "L%u:\n", i);
+		write_instruction(file, bytecode, i);
+	}
+	fprintf(file, "}\n\n");
+
+	st_free(labels);
+}
+
+/*
+ * Writes C functions for the methods of all classes in Smalltalk,
+ * and their metaclasses.
+ */
+bool st_aot_write_kernel(const char *filename) {
+	FILE *file;
+	st_oop globals, behavior, methods, method, element;
+	st_uint global_count, method_count, size, count = 0, capacity = 256;
+	const st_uchar **written;
+	st_uint *written_sizes;
+	const st_uchar *bytecode;
+	bool *entries;
+	bool found;
+
+	file = fopen(filename, "w");
+	if (file == NULL) {
+		fprintf(stderr, "panda: error: could not open `%s'\n", filename);
+		return false;
+	}
+
+	written = st_malloc(capacity * sizeof(const st_uchar *));
+	written_sizes = st_malloc(capacity * sizeof(st_uint));
+
+	fprintf(file, "/* Generated by \"panda --aot\" from the methods in st/. Do not edit. */\n\n");
+	fprintf(file, "#include \"st-aot.h\"\n\n");
+
+	globals = ST_OBJECT_FIELDS (ST_GLOBALS)[2];
+	global_count = st_smi_value(st_arrayed_object_size(globals));
+	for (st_uint g = 1; g <= global_count * 2; g++) {
+		/* each class, then its metaclass */
+		element = st_array_at(globals, (g + 1) / 2);
+		if (element == ST_NIL || element == globals)
+			continue;
+		behavior = ST_ASSOCIATION_VALUE (element);
+		if (!st_object_is_heap(behavior) || st_object_class(st_object_class(behavior)) != ST_METACLASS_CLASS)
+			continue;
+		if (g % 2 == 0)
+			behavior = st_object_class(behavior);
+
+		methods = ST_OBJECT_FIELDS (ST_BEHAVIOR_METHOD_DICTIONARY (behavior))[2];
+		method_count = st_smi_value(st_arrayed_object_size(methods));
+		for (st_uint m = 1; m <= method_count; m++) {
+			element = st_array_at(methods, m);
+			if (element == ST_NIL || element == methods)
+				continue;
+			method = ST_ASSOCIATION_VALUE (element);
+			if (st_method_get_flags(method) != ST_METHOD_NORMAL || ST_METHOD_BYTECODE (method) == ST_NIL)
+				continue;
+
+			bytecode = st_method_bytecode_bytes(method);
+			size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (method)));
+
+			found = false;
+			for (st_uint w = 0; w < count && !found; w++)
+				found = written_sizes[w] == size && memcmp(written[w], bytecode, size) == 0;
+			if (found)
+				continue;
+
+			entries = st_malloc(size * sizeof(bool));
+			if (find_entries(bytecode, size, entries)) {
+				if (count == capacity) {
+					capacity *= 2;
+					written = st_realloc(written, capacity * sizeof(const st_uchar *));
+					written_sizes = st_realloc(written_sizes, capacity * sizeof(st_uint));
+				}
+				write_function(file, count, behavior, ST_ASSOCIATION_KEY (element), bytecode, size, entries);
+				written[count] = bytecode;
+				written_sizes[count] = size;
+				count++;
+			}
+			st_free(entries);
+		}
+	}
+
+	fprintf(file, "const st_aot_method st_aot_methods[] = {\n");
+	for (st_uint w = 0; w < count; w++)
+		fprintf(file, "\t{ sizeof bytecode_%u, bytecode_%u, method_%u },\n", w, w, w);
+	fprintf(file, "};\n\nconst st_uint st_aot_method_count = %u;\n", count);
+
+	st_free(written);
+	st_free(written_sizes);
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "panda: error: could not write `%s'\n", filename);
+		return false;
+	}
+	return true;
+}
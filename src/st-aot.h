@@ -0,0 +1,92 @@
+/*
+ * st-aot.h
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_AOT_H__
+#define __ST_AOT_H__
+
+#include <st-types.h>
+#include <st-machine.h>
+#include <st-jit.h>
+#include <st-object.h>
+#include <st-association.h>
+#include <st-universe.h>
+
+/*
+ * Methods of the kernel compiled ahead of time to C, by
+ * "panda --aot FILE". A function is shared by all methods with the same
+ * bytecode, and takes its operands from the threaded code, so a method
+ * redefined with different bytecode simply runs in the interpreter.
+ *
+ * A function follows the calling convention of native code in
+ * st-jit.h, and is entered at the instruction in machine->ip.
+ */
+typedef struct st_aot_method {
+	st_uint size;
+	const st_uchar *bytecode;
+	st_jit_entry function;
+} st_aot_method;
+
+void st_aot_install(st_machine *machine, st_threaded_code *threaded);
+bool st_aot_write_kernel(const char *filename);
+
+/* helpers for the generated code */
+
+#define ST_AOT_EXIT(index) \
+	do { machine->ip = (index); return sp; } while (0)
+
+static inline bool st_aot_smis(st_oop a, st_oop b) {
+	return st_object_is_smi(a) && st_object_is_smi(b);
+}
+
+static inline bool st_aot_add(st_oop a, st_oop b, st_oop *result) {
+	st_smi value;
+
+	if (!st_aot_smis(a, b) || __builtin_add_overflow(st_smi_value(a), st_smi_value(b), &value)
+	    || !st_smi_in_range(value))
+		return false;
+	*result = st_smi_new(value);
+	return true;
+}
+
+static inline bool st_aot_sub(st_oop a, st_oop b, st_oop *result) {
+	st_smi value;
+
+	if (!st_aot_smis(a, b) || __builtin_sub_overflow(st_smi_value(a), st_smi_value(b), &value)
+	    || !st_smi_in_range(value))
+		return false;
+	*result = st_smi_new(value);
+	return true;
+}
+
+static inline bool st_aot_mul(st_oop a, st_oop b, st_oop *result) {
+	st_smi value;
+
+	if (!st_aot_smis(a, b) || __builtin_mul_overflow(st_smi_value(a), st_smi_value(b), &value)
+	    || !st_smi_in_range(value))
+		return false;
+	*result = st_smi_new(value);
+	return true;
+}
+
+#endif /* __ST_AOT_H__ */
@@ -151,3 +151,27 @@ st_oop st_float_array_allocate(st_oop class, int size) {
 
 	return object;
 }
+
+/* IntegerArray */
+st_oop st_integer_array_allocate(st_oop class, int size) {
+	st_oop object;
+	int size_oops;
+
+	st_assert (size >= 0);
+
+	size_oops = size * ST_SIZE_OOPS (int64_t);
+
+	object = st_memory_allocate(ST_SIZE_OOPS (struct st_integer_array) + size_oops);
+	if (object == 0) {
+		st_memory_perform_gc();
+		class = st_memory_remap_reference(class);
+		object = st_memory_allocate(ST_SIZE_OOPS (struct st_integer_array) + size_oops);
+		st_assert (object != 0);
+	}
+	st_object_initialize_header(object, class);
+
+	ST_ARRAYED_OBJECT (object)->size = st_smi_new(size);
+	memset(ST_INTEGER_ARRAY (object)->elements, 0, size * sizeof(int64_t));
+
+	return object;
+}
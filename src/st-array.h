@@ -31,6 +31,7 @@
 #define ST_ARRAYED_OBJECT(oop) ((struct st_arrayed_object *) st_detag_pointer (oop))
 #define ST_ARRAY(oop)          ((struct st_array *)          st_detag_pointer (oop))
 #define ST_FLOAT_ARRAY(oop)    ((struct st_float_array *)    st_detag_pointer (oop))
+#define ST_INTEGER_ARRAY(oop)  ((struct st_integer_array *)  st_detag_pointer (oop))
 #define ST_WORD_ARRAY(oop)     ((struct st_word_array *)     st_detag_pointer (oop))
 #define ST_BYTE_ARRAY(oop)     ((struct st_byte_array *)     st_detag_pointer (oop))
 
@@ -61,6 +62,13 @@ struct st_float_array
     double elements[];
 };
 
+struct st_integer_array
+{
+    struct st_arrayed_object __parent__;
+
+    int64_t elements[];
+};
+
 struct st_byte_array
 {
     struct st_arrayed_object __parent__;
@@ -72,6 +80,7 @@ bool    st_byte_array_equal     (st_oop object, st_oop other);
 st_uint st_byte_array_hash      (st_oop object);
 st_oop  st_array_allocate       (st_oop class, st_uint size);
 st_oop  st_float_array_allocate (st_oop class, int size);
+st_oop  st_integer_array_allocate (st_oop class, int size);
 st_oop  st_word_array_allocate  (st_oop class, int size);
 st_oop  st_byte_array_allocate  (st_oop class, int size);
 
@@ -154,4 +163,22 @@ st_float_array_at_put (st_oop array, int i, double value)
     ST_FLOAT_ARRAY (array)->elements[i - 1] = value;
 }
 
+static inline int64_t *
+st_integer_array_elements (st_oop array)
+{
+    return ST_INTEGER_ARRAY (array)->elements;
+}
+
+static inline int64_t
+st_integer_array_at (st_oop array, int i)
+{
+    return ST_INTEGER_ARRAY (array)->elements[i - 1];
+}
+
+static inline void
+st_integer_array_at_put (st_oop array, int i, int64_t value)
+{
+    ST_INTEGER_ARRAY (array)->elements[i - 1] = value;
+}
+
 #endif /* __ST_ARRAY_H__ */
@@ -47,6 +47,34 @@ st_list *st_behavior_all_instance_variables(st_oop class) {
 	                      st_list_reverse(list));
 }
 
+#ifdef ST_HAVE_COMPACT_HEADERS
+
+#define CLASS_TABLE_INITIAL_CAPACITY 256
+
+void st_behavior_initialize_class_table(void) {
+	__machine.class_capacity = CLASS_TABLE_INITIAL_CAPACITY;
+	__machine.classes = st_malloc(__machine.class_capacity * sizeof(st_oop));
+	__machine.classes[0] = ST_NIL;
+	__machine.class_count = 1;
+}
+
+st_uint st_behavior_register(st_oop class) {
+	st_uint index;
+
+	if (__machine.class_count == __machine.class_capacity) {
+		__machine.class_capacity *= 2;
+		__machine.classes = st_realloc(__machine.classes, __machine.class_capacity * sizeof(st_oop));
+	}
+
+	index = __machine.class_count++;
+	__machine.classes[index] = class;
+	ST_BEHAVIOR_CLASS_INDEX(class) = st_smi_new(index);
+
+	return index;
+}
+
+#endif
+
 st_oop st_object_new(st_oop class) {
 	switch (st_smi_value(ST_BEHAVIOR_FORMAT(class))) {
 		case ST_FORMAT_OBJECT:
@@ -78,9 +106,7 @@ st_oop st_object_new_arrayed(st_oop class, int size) {
 		case ST_FORMAT_FLOAT_ARRAY:
 			return st_float_array_allocate(class, size);
 		case ST_FORMAT_INTEGER_ARRAY:
-			/* not implemented */
-			abort();
-			break;
+			return st_integer_array_allocate(class, size);
 		default:
 			/* should not reach */
 			abort();
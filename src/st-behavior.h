@@ -44,6 +44,7 @@ struct st_behavior {
 	st_oop instance_size;
 	st_oop method_dictionary;
 	st_oop instance_variables;
+	st_oop class_index;
 };
 
 struct st_class {
@@ -63,6 +64,7 @@ struct st_metaclass {
 #define ST_BEHAVIOR_INSTANCE_SIZE(oop)      (ST_BEHAVIOR (oop)->instance_size)
 #define ST_BEHAVIOR_METHOD_DICTIONARY(oop)  (ST_BEHAVIOR (oop)->method_dictionary)
 #define ST_BEHAVIOR_INSTANCE_VARIABLES(oop) (ST_BEHAVIOR (oop)->instance_variables)
+#define ST_BEHAVIOR_CLASS_INDEX(oop)        (ST_BEHAVIOR (oop)->class_index)
 #define ST_CLASS_NAME(oop)                  (ST_CLASS (oop)->name)
 #define ST_METACLASS_INSTANCE_CLASS(oop)    (ST_METACLASS (oop)->instance_class)
 
@@ -70,4 +72,34 @@ st_oop st_object_new(st_oop class);
 st_oop st_object_new_arrayed(st_oop class, int size);
 st_list *st_behavior_all_instance_variables(st_oop class);
 
+#ifdef ST_HAVE_COMPACT_HEADERS
+
+void st_behavior_initialize_class_table(void);
+st_uint st_behavior_register(st_oop class);
+
+/* index of a class in the class table, where it is entered the first
+   time its index is asked for */
+static inline st_uint st_behavior_index(st_oop class) {
+	st_oop index;
+
+	if (class == ST_NIL)
+		return 0;
+
+	index = ST_BEHAVIOR_CLASS_INDEX(class);
+	if (ST_LIKELY(index != ST_NIL && __machine.classes[st_smi_value(index)] == class))
+		return st_smi_value(index);
+
+	return st_behavior_register(class);
+}
+
+#endif
+
+static inline void st_object_set_class(st_oop object, st_oop class) {
+#ifdef ST_HAVE_COMPACT_HEADERS
+	st_object_set_class_index(object, st_behavior_index(class));
+#else
+	ST_HEADER (object)->class = class;
+#endif
+}
+
 #endif /* __ST_BEHAVIOR_H__ */
@@ -0,0 +1,603 @@
+/*
+ * st-bytecode-cache.c
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+/*
+ * The files are kept next to the sources they were compiled from, so that
+ * they do not depend on the directory panda runs from. Each executable
+ * keeps its files in a directory of its own, named after it, as panda and
+ * panda-boot file in the same sources.
+ *
+ * A cache file starts with a header, which identifies the executable and
+ * the source the methods were compiled from. A record follows for each
+ * method, in the order the methods were compiled: the class of the method,
+ * a hash of the names of the instance variables of that class, the method
+ * header, selector, bytecode and literals.
+ *
+ * Each literal is written as a tag followed by its value. Globals and
+ * classes are written by name and looked up again when the file is read,
+ * and clean blocks by the operands they are created from.
+ */
+
+#include "st-bytecode-cache.h"
+#include "st-compiler.h"
+#include "st-method.h"
+#include "st-context.h"
+#include "st-behavior.h"
+#include "st-dictionary.h"
+#include "st-association.h"
+#include "st-symbol.h"
+#include "st-character.h"
+#include "st-float.h"
+#include "st-large-integer.h"
+#include "st-universe.h"
+#include "st-utils.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CACHE_DIRECTORY "st-cache"
+#define EXECUTABLE      "/proc/self/exe"
+#define CACHE_MAGIC     "PANDABC"
+#define CACHE_VERSION   1
+
+#define HASH_SEED  0xcbf29ce484222325ULL
+#define HASH_PRIME 0x100000001b3ULL
+
+enum {
+	LITERAL_NIL,
+	LITERAL_TRUE,
+	LITERAL_FALSE,
+	LITERAL_SMI,
+	LITERAL_CHARACTER,
+	LITERAL_FLOAT,
+	LITERAL_LARGE_INTEGER,
+	LITERAL_STRING,
+	LITERAL_SYMBOL,
+	LITERAL_ARRAY,
+	LITERAL_GLOBAL,
+	LITERAL_CLASS,
+	LITERAL_METACLASS,
+	LITERAL_BLOCK,
+};
+
+struct cache_header {
+	char magic[8];
+	st_uint version;
+	st_uint method_count;
+	/* size and modification time of the executable, since bytecode and
+	   primitive indices may differ between builds */
+	uint64_t executable_size;
+	uint64_t executable_time;
+	uint64_t source_hash;
+};
+
+struct st_bytecode_cache {
+	char *path;
+	struct cache_header header;
+	st_uchar *bytes;
+	st_ulong size;
+	st_ulong alloc;
+	/* a literal could not be written */
+	bool failed;
+};
+
+typedef struct {
+	const st_uchar *p;
+	const st_uchar *end;
+	bool failed;
+} cache_reader;
+
+static uint64_t hash_bytes(uint64_t hash, const void *bytes, st_ulong size) {
+	const st_uchar *p = bytes;
+
+	for (st_ulong i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= HASH_PRIME;
+	}
+	return hash;
+}
+
+/* instance variables are compiled to indices, which change with them */
+static uint64_t layout_hash(st_oop class) {
+	uint64_t hash = HASH_SEED;
+	st_oop names, name;
+	int size;
+
+	for (; class != ST_NIL; class = ST_BEHAVIOR_SUPERCLASS(class)) {
+		names = ST_BEHAVIOR_INSTANCE_VARIABLES(class);
+		if (names == ST_NIL)
+			continue;
+		size = st_smi_value(st_arrayed_object_size(names));
+		for (int i = 1; i <= size; i++) {
+			name = st_array_at(names, i);
+			hash = hash_bytes(hash, st_byte_array_bytes(name), st_smi_value(st_arrayed_object_size(name)));
+			hash = hash_bytes(hash, " ", 1);
+		}
+	}
+	return hash;
+}
+
+static bool init_header(struct cache_header *header, const char *source) {
+	struct stat info;
+
+	if (stat(EXECUTABLE, &info) != 0)
+		return false;
+
+	memset(header, 0, sizeof(struct cache_header));
+	memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->version = CACHE_VERSION;
+	header->executable_size = info.st_size;
+	header->executable_time = info.st_mtim.tv_sec * 1000000000ULL + info.st_mtim.tv_nsec;
+	header->source_hash = hash_bytes(HASH_SEED, source, strlen(source));
+	return true;
+}
+
+/* answers the directory of filename, including the separator */
+static char *directory_of(const char *filename) {
+	const char *name;
+
+	name = strrchr(filename, ST_DIR_SEPARATOR);
+	return st_strndup(filename, name ? name + 1 - filename : 0);
+}
+
+/* <directory of filename>/st-cache/<executable>/<name of filename>.cache */
+static char *cache_path(const char *filename) {
+	char executable[PATH_MAX];
+	const char *name, *program;
+	char *directory, *path;
+	ssize_t size;
+
+	size = readlink(EXECUTABLE, executable, sizeof(executable) - 1);
+	executable[MAX (size, 0)] = 0;
+	program = strrchr(executable, ST_DIR_SEPARATOR);
+	program = program ? program + 1 : executable;
+
+	name = strrchr(filename, ST_DIR_SEPARATOR);
+	name = name ? name + 1 : filename;
+	directory = directory_of(filename);
+	path = st_strconcat(directory, CACHE_DIRECTORY, ST_DIR_SEPARATOR_S,
+	                    program, ST_DIR_SEPARATOR_S, name, ".cache", NULL);
+	st_free(directory);
+	return path;
+}
+
+static bool is_metaclass(st_oop object) {
+	return st_object_is_heap(object) && st_object_class(object) == ST_METACLASS_CLASS;
+}
+
+static bool is_class(st_oop object) {
+	return st_object_is_heap(object) && is_metaclass(st_object_class(object));
+}
+
+/* writing */
+
+static void put_bytes(st_bytecode_cache *cache, const void *bytes, st_ulong size) {
+	if (cache->size + size > cache->alloc) {
+		cache->alloc = MAX (cache->alloc * 2, cache->size + size);
+		cache->bytes = st_realloc(cache->bytes, cache->alloc);
+	}
+	memcpy(cache->bytes + cache->size, bytes, size);
+	cache->size += size;
+}
+
+static void put_byte(st_bytecode_cache *cache, st_uchar value) {
+	put_bytes(cache, &value, sizeof(value));
+}
+
+static void put_uint(st_bytecode_cache *cache, st_uint value) {
+	put_bytes(cache, &value, sizeof(value));
+}
+
+/* strings are followed by a nul, so that they can be read in place */
+static void put_string(st_bytecode_cache *cache, const void *bytes, st_uint size) {
+	put_uint(cache, size);
+	put_bytes(cache, bytes, size);
+	put_byte(cache, 0);
+}
+
+static void put_byte_array(st_bytecode_cache *cache, st_oop array) {
+	put_string(cache, st_byte_array_bytes(array), st_smi_value(st_arrayed_object_size(array)));
+}
+
+static void put_literal(st_bytecode_cache *cache, st_oop method, st_oop literal) {
+	st_oop class;
+	int64_t integer;
+	double value;
+	char *string;
+	int size;
+
+	if (literal == ST_NIL) {
+		put_byte(cache, LITERAL_NIL);
+	} else if (literal == ST_TRUE) {
+		put_byte(cache, LITERAL_TRUE);
+	} else if (literal == ST_FALSE) {
+		put_byte(cache, LITERAL_FALSE);
+	} else if (st_object_is_smi(literal)) {
+		integer = st_smi_value(literal);
+		put_byte(cache, LITERAL_SMI);
+		put_bytes(cache, &integer, sizeof(integer));
+	} else if (st_object_is_character(literal)) {
+		put_byte(cache, LITERAL_CHARACTER);
+		put_uint(cache, st_character_value(literal));
+	} else if (st_object_is_float(literal)) {
+		value = st_float_value(literal);
+		put_byte(cache, LITERAL_FLOAT);
+		put_bytes(cache, &value, sizeof(value));
+	} else {
+		class = st_object_class(literal);
+		if (class == ST_LARGE_INTEGER_CLASS) {
+			string = st_large_integer_to_string(literal, 16);
+			if (string == NULL) {
+				cache->failed = true;
+				return;
+			}
+			put_byte(cache, LITERAL_LARGE_INTEGER);
+			put_string(cache, string, strlen(string));
+			st_free(string);
+		} else if (class == ST_STRING_CLASS) {
+			put_byte(cache, LITERAL_STRING);
+			put_byte_array(cache, literal);
+		} else if (class == ST_SYMBOL_CLASS) {
+			put_byte(cache, LITERAL_SYMBOL);
+			put_byte_array(cache, literal);
+		} else if (class == ST_ARRAY_CLASS) {
+			size = st_smi_value(st_arrayed_object_size(literal));
+			put_byte(cache, LITERAL_ARRAY);
+			put_uint(cache, size);
+			for (int i = 1; i <= size; i++)
+				put_literal(cache, method, st_array_at(literal, i));
+		} else if (class == ST_ASSOCIATION_CLASS
+		           && st_dictionary_association_at(ST_GLOBALS, ST_ASSOCIATION_KEY(literal)) == literal) {
+			put_byte(cache, LITERAL_GLOBAL);
+			put_byte_array(cache, ST_ASSOCIATION_KEY(literal));
+		} else if (is_metaclass(literal)) {
+			put_byte(cache, LITERAL_METACLASS);
+			put_byte_array(cache, ST_CLASS_NAME(ST_METACLASS_INSTANCE_CLASS(literal)));
+		} else if (is_class(literal)) {
+			put_byte(cache, LITERAL_CLASS);
+			put_byte_array(cache, ST_CLASS_NAME(literal));
+		} else if (class == ST_BLOCK_CONTEXT_CLASS && ST_BLOCK_CONTEXT_METHOD(literal) == method) {
+			put_byte(cache, LITERAL_BLOCK);
+			put_uint(cache, st_smi_value(ST_BLOCK_CONTEXT_ARGCOUNT(literal)));
+			put_uint(cache, st_smi_value(ST_BLOCK_CONTEXT_INITIALIP(literal)));
+			put_uint(cache, st_object_stack_size(literal));
+		} else {
+			cache->failed = true;
+		}
+	}
+}
+
+st_bytecode_cache *st_bytecode_cache_new(const char *filename, const char *source) {
+	st_bytecode_cache *cache;
+
+	cache = st_new0(st_bytecode_cache);
+	if (!init_header(&cache->header, source))
+		cache->failed = true;
+	cache->path = cache_path(filename);
+
+	return cache;
+}
+
+void st_bytecode_cache_add(st_bytecode_cache *cache, st_oop class, st_oop method) {
+	st_oop literals;
+	uint64_t layout;
+	int size;
+
+	if (cache->failed)
+		return;
+
+	if (is_metaclass(class)) {
+		put_byte(cache, LITERAL_METACLASS);
+		put_byte_array(cache, ST_CLASS_NAME(ST_METACLASS_INSTANCE_CLASS(class)));
+	} else {
+		put_byte(cache, LITERAL_CLASS);
+		put_byte_array(cache, ST_CLASS_NAME(class));
+	}
+	layout = layout_hash(class);
+	put_bytes(cache, &layout, sizeof(layout));
+
+	put_bytes(cache, &ST_METHOD_HEADER(method), sizeof(st_oop));
+	put_byte_array(cache, ST_METHOD_SELECTOR(method));
+	if (ST_METHOD_BYTECODE(method) == ST_NIL)
+		put_string(cache, "", 0);
+	else
+		put_byte_array(cache, ST_METHOD_BYTECODE(method));
+
+	literals = ST_METHOD_LITERALS(method);
+	size = st_smi_value(st_arrayed_object_size(literals));
+	put_uint(cache, size);
+	for (int i = 1; i <= size; i++)
+		put_literal(cache, method, st_array_at(literals, i));
+
+	cache->header.method_count++;
+}
+
+void st_bytecode_cache_save(st_bytecode_cache *cache) {
+	char *directory, *parent, *temp;
+	FILE *file;
+	bool written;
+	int fd;
+
+	if (!cache->failed) {
+		/* st-cache/ and the directory of the executable in it */
+		directory = directory_of(cache->path);
+		directory[strlen(directory) - 1] = 0;
+		parent = directory_of(directory);
+		mkdir(parent, 0777);
+		mkdir(directory, 0777);
+		st_free(parent);
+		st_free(directory);
+
+		/* other processes only ever see a whole file */
+		temp = st_strconcat(cache->path, ".XXXXXX", NULL);
+		fd = mkstemp(temp);
+		if (fd >= 0) {
+			file = fdopen(fd, "wb");
+			fwrite(&cache->header, sizeof(cache->header), 1, file);
+			fwrite(cache->bytes, 1, cache->size, file);
+			written = !ferror(file);
+			if (fclose(file) != 0)
+				written = false;
+			if (!written || rename(temp, cache->path) != 0)
+				unlink(temp);
+		}
+		st_free(temp);
+	}
+
+	st_free(cache->path);
+	st_free(cache->bytes);
+	st_free(cache);
+}
+
+/* reading */
+
+static void get_bytes(cache_reader *in, void *bytes, st_ulong size) {
+	if (in->failed || (st_ulong) (in->end - in->p) < size) {
+		in->failed = true;
+		memset(bytes, 0, size);
+		return;
+	}
+	memcpy(bytes, in->p, size);
+	in->p += size;
+}
+
+static st_uchar get_byte(cache_reader *in) {
+	st_uchar value;
+
+	get_bytes(in, &value, sizeof(value));
+	return value;
+}
+
+static st_uint get_uint(cache_reader *in) {
+	st_uint value;
+
+	get_bytes(in, &value, sizeof(value));
+	return value;
+}
+
+static const char *get_string(cache_reader *in, st_uint *size) {
+	const char *string;
+
+	*size = get_uint(in);
+	if (in->failed || (st_ulong) (in->end - in->p) <= *size || in->p[*size] != 0) {
+		in->failed = true;
+		*size = 0;
+		return "";
+	}
+	string = (const char *) in->p;
+	in->p += *size + 1;
+	return string;
+}
+
+static st_oop get_class(cache_reader *in, st_uchar tag) {
+	const char *name;
+	st_uint size;
+	st_oop class;
+
+	name = get_string(in, &size);
+	if (in->failed)
+		return ST_NIL;
+
+	class = st_global_get(name);
+	if (!is_class(class)) {
+		in->failed = true;
+		return ST_NIL;
+	}
+	return tag == LITERAL_METACLASS ? st_object_class(class) : class;
+}
+
+static st_oop get_literal(cache_reader *in, st_oop method) {
+	st_oop literal;
+	const char *string;
+	int64_t integer;
+	double value;
+	st_uint size, argcount, initial_ip, stack_size;
+	st_uchar tag;
+
+	tag = get_byte(in);
+	if (in->failed)
+		return ST_NIL;
+
+	switch (tag) {
+		case LITERAL_NIL:
+			return ST_NIL;
+		case LITERAL_TRUE:
+			return ST_TRUE;
+		case LITERAL_FALSE:
+			return ST_FALSE;
+		case LITERAL_SMI:
+			get_bytes(in, &integer, sizeof(integer));
+			return st_smi_new(integer);
+		case LITERAL_CHARACTER:
+			return st_character_new(get_uint(in));
+		case LITERAL_FLOAT:
+			get_bytes(in, &value, sizeof(value));
+			return st_float_new(value);
+		case LITERAL_LARGE_INTEGER:
+			string = get_string(in, &size);
+			if (in->failed)
+				return ST_NIL;
+			return st_large_integer_new_from_string(string, 16);
+		case LITERAL_STRING:
+			string = get_string(in, &size);
+			literal = st_object_new_arrayed(ST_STRING_CLASS, size);
+			memcpy(st_byte_array_bytes(literal), string, size);
+			return literal;
+		case LITERAL_SYMBOL:
+			string = get_string(in, &size);
+			if (in->failed)
+				return ST_NIL;
+			return st_symbol_new(string);
+		case LITERAL_ARRAY:
+			size = get_uint(in);
+			if (in->failed || size > (st_ulong) (in->end - in->p)) {
+				in->failed = true;
+				return ST_NIL;
+			}
+			literal = st_object_new_arrayed(ST_ARRAY_CLASS, size);
+			for (st_uint i = 1; i <= size; i++)
+				st_array_at_put(literal, i, get_literal(in, method));
+			return literal;
+		case LITERAL_GLOBAL:
+			string = get_string(in, &size);
+			if (in->failed)
+				return ST_NIL;
+			literal = st_dictionary_association_at(ST_GLOBALS, st_symbol_new(string));
+			if (literal == ST_NIL)
+				in->failed = true;
+			return literal;
+		case LITERAL_CLASS:
+		case LITERAL_METACLASS:
+			return get_class(in, tag);
+		case LITERAL_BLOCK:
+			argcount = get_uint(in);
+			initial_ip = get_uint(in);
+			stack_size = get_uint(in);
+			if (in->failed)
+				return ST_NIL;
+			literal = st_clean_block_new(method, argcount, initial_ip, stack_size);
+			if (literal == 0) {
+				in->failed = true;
+				return ST_NIL;
+			}
+			return literal;
+		default:
+			in->failed = true;
+			return ST_NIL;
+	}
+}
+
+static bool get_method(cache_reader *in) {
+	st_oop class, method, literals;
+	const char *string;
+	uint64_t layout;
+	st_oop header;
+	st_uint size;
+
+	class = get_class(in, get_byte(in));
+	get_bytes(in, &layout, sizeof(layout));
+	if (in->failed || layout != layout_hash(class))
+		return false;
+
+	get_bytes(in, &header, sizeof(header));
+	method = st_object_new(ST_COMPILED_METHOD_CLASS);
+	ST_METHOD_HEADER(method) = header;
+
+	string = get_string(in, &size);
+	ST_METHOD_SELECTOR(method) = st_symbol_new(string);
+
+	string = get_string(in, &size);
+	if (size > 0) {
+		ST_METHOD_BYTECODE(method) = st_object_new_arrayed(ST_BYTE_ARRAY_CLASS, size);
+		memcpy(st_byte_array_bytes(ST_METHOD_BYTECODE(method)), string, size);
+	}
+
+	size = get_uint(in);
+	if (in->failed || size > (st_ulong) (in->end - in->p))
+		return false;
+	literals = st_object_new_arrayed(ST_ARRAY_CLASS, size);
+	ST_METHOD_LITERALS(method) = literals;
+	for (st_uint i = 1; i <= size; i++)
+		st_array_at_put(literals, i, get_literal(in, method));
+	if (in->failed)
+		return false;
+
+	st_dictionary_at_put(ST_BEHAVIOR(class)->method_dictionary, ST_METHOD_SELECTOR(method), method);
+	return true;
+}
+
+bool st_bytecode_cache_load(const char *filename, const char *source) {
+	struct cache_header header, expected;
+	cache_reader in;
+	st_uchar *bytes = NULL;
+	struct stat info;
+	char *path;
+	FILE *file;
+	bool loaded = false;
+
+	if (!init_header(&expected, source))
+		return false;
+
+	path = cache_path(filename);
+	file = fopen(path, "rb");
+	st_free(path);
+	if (file == NULL)
+		return false;
+
+	if (fread(&header, sizeof(header), 1, file) != 1
+	    || memcmp(&header.magic, &expected.magic, sizeof(header.magic)) != 0
+	    || header.version != expected.version
+	    || header.executable_size != expected.executable_size
+	    || header.executable_time != expected.executable_time
+	    || header.source_hash != expected.source_hash
+	    || fstat(fileno(file), &info) != 0
+	    || info.st_size < sizeof(header))
+		goto out;
+
+	bytes = st_malloc(info.st_size - sizeof(header) + 1);
+	if (fread(bytes, 1, info.st_size - sizeof(header), file) != info.st_size - sizeof(header))
+		goto out;
+
+	in.p = bytes;
+	in.end = bytes + info.st_size - sizeof(header);
+	in.failed = false;
+
+	/* if a method cannot be read, those read so far are replaced when
+	   the file is compiled */
+	for (st_uint i = 0; i < header.method_count; i++) {
+		if (!get_method(&in))
+			goto out;
+	}
+	loaded = in.p == in.end;
+
+out:
+	st_free(bytes);
+	fclose(file);
+
+	return loaded;
+}
@@ -0,0 +1,47 @@
+/*
+ * st-bytecode-cache.h
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_BYTECODE_CACHE_H__
+#define __ST_BYTECODE_CACHE_H__
+
+#include <st-types.h>
+
+/*
+ * The bytecode cache keeps the methods compiled from each file of the
+ * class library in st-cache/, next to the file, so that the file need
+ * not be parsed again at the next start. A cached file is only used
+ * if it was written by the same executable from the same source.
+ */
+typedef struct st_bytecode_cache st_bytecode_cache;
+
+/* installs the methods cached for filename, if they were compiled from
+   source. Answers false if the file must be compiled */
+bool st_bytecode_cache_load(const char *filename, const char *source);
+
+st_bytecode_cache *st_bytecode_cache_new(const char *filename, const char *source);
+void st_bytecode_cache_add(st_bytecode_cache *cache, st_oop class, st_oop method);
+/* writes the methods added to the cache, and destroys it */
+void st_bytecode_cache_save(st_bytecode_cache *cache);
+
+#endif /* __ST_BYTECODE_CACHE_H__ */
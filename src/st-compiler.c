@@ -5,6 +5,8 @@
 #include "st-dictionary.h"
 #include "st-behavior.h"
 #include "st-input.h"
+#include "st-bytecode-cache.h"
+#include "st-method.h"
 #include "st-node.h"
 
 #include "st-lexer.h"
@@ -21,6 +23,13 @@ typedef struct {
 
 	int line;
 
+	/* methods compiled from the file, or NULL */
+	st_bytecode_cache *cache;
+
+	/* in lazy mode, the file and its name as Strings, and 0 otherwise */
+	st_oop source;
+	st_oop name;
+
 } FileInParser;
 
 /*
@@ -33,6 +42,16 @@ typedef struct {
  * and place the method in the methodDictionary of the given class.
  */
 bool st_compile_string(st_oop class, const char *string, st_compiler_error *error) {
+	return st_compile_method(class, string, error) != ST_NIL;
+}
+
+/*
+ * st_compile_method:
+ *
+ * Like st_compile_string(), but answers the new CompiledMethod,
+ * or nil if the source could not be compiled.
+ */
+st_oop st_compile_method(st_oop class, const char *string, st_compiler_error *error) {
 	st_node *node;
 	st_oop method;
 	st_lexer *lexer;
@@ -41,18 +60,18 @@ bool st_compile_string(st_oop class, const char *string, st_compiler_error *erro
 
 	lexer = st_lexer_new(string);
 	if (!lexer)
-		return false;
+		return ST_NIL;
 
 	node = st_parser_parse(lexer, error);
 	st_lexer_destroy(lexer);
 
 	if (!node)
-		return false;
+		return ST_NIL;
 
 	method = st_generate_method(class, node, error);
 	if (method == ST_NIL) {
 		st_node_destroy(node);
-		return false;
+		return ST_NIL;
 	}
 
 	st_dictionary_at_put(ST_BEHAVIOR (class)->method_dictionary,
@@ -61,7 +80,7 @@ bool st_compile_string(st_oop class, const char *string, st_compiler_error *erro
 
 	st_node_destroy(node);
 
-	return true;
+	return method;
 }
 
 static void
@@ -100,10 +119,47 @@ static st_lexer *next_chunk(FileInParser *parser) {
 	return lexer;
 }
 
+/* literals of a method which is not compiled yet */
+enum {
+	LAZY_FILENAME = 1,
+	LAZY_SOURCE,
+	LAZY_START,     /* range of the method chunk in the source */
+	LAZY_END,
+	LAZY_LINE,      /* line on which the chunk starts */
+	LAZY_CLASS,     /* last, as in compiled methods */
+	LAZY_LITERAL_COUNT = LAZY_CLASS
+};
+
+/*
+ * Answers a method which only records where its source lies. It is
+ * compiled by st_compile_lazy_method() when a send first finds it.
+ */
+static st_oop lazy_method_new(FileInParser *parser, st_oop class, st_node *node, st_uint start) {
+	st_oop method, literals;
+
+	literals = st_object_new_arrayed(ST_ARRAY_CLASS, LAZY_LITERAL_COUNT);
+	st_array_at_put(literals, LAZY_FILENAME, parser->name);
+	st_array_at_put(literals, LAZY_SOURCE, parser->source);
+	st_array_at_put(literals, LAZY_START, st_smi_new(start));
+	st_array_at_put(literals, LAZY_END, st_smi_new(st_input_index(parser->input)));
+	st_array_at_put(literals, LAZY_LINE, st_smi_new(parser->line));
+	st_array_at_put(literals, LAZY_CLASS, class);
+
+	method = st_object_new(ST_COMPILED_METHOD_CLASS);
+	ST_METHOD_HEADER (method) = st_smi_new(0);
+	st_method_set_flags(method, ST_METHOD_LAZY);
+	st_method_set_arg_count(method, st_node_list_length(node->method.arguments));
+	ST_METHOD_LITERALS (method) = literals;
+	ST_METHOD_SELECTOR (method) = node->method.selector;
+
+	return method;
+}
+
 static void parse_method(FileInParser *parser, st_lexer *lexer, char *class_name, bool class_method) {
 	st_token *token = NULL;
 	st_oop class;
 	st_compiler_error error;
+	st_uint start;
 
 	st_lexer_destroy(lexer);
 
@@ -116,6 +172,7 @@ static void parse_method(FileInParser *parser, st_lexer *lexer, char *class_name
 		class = st_object_class(class);
 
 	/* parse method chunk */
+	start = st_input_index(parser->input);
 	lexer = next_chunk(parser);
 	if (!lexer)
 		filein_error(parser, token, "expected method definition");
@@ -123,17 +180,27 @@ static void parse_method(FileInParser *parser, st_lexer *lexer, char *class_name
 	st_node *node;
 	st_oop method;
 
-	node = st_parser_parse(lexer, &error);
-	if (node == NULL)
-		goto error;
-	if (node->type != ST_METHOD_NODE)
-		printf("%i\n", node->type);
+	if (parser->source) {
+		node = st_parser_parse_pattern(lexer, &error);
+		if (node == NULL)
+			goto error;
 
-	method = st_generate_method(class, node, &error);
-	if (method == ST_NIL)
-		goto error;
+		method = lazy_method_new(parser, class, node, start);
+	} else {
+		node = st_parser_parse(lexer, &error);
+		if (node == NULL)
+			goto error;
+		if (node->type != ST_METHOD_NODE)
+			printf("%i\n", node->type);
+
+		method = st_generate_method(class, node, &error);
+		if (method == ST_NIL)
+			goto error;
+	}
 
 	st_dictionary_at_put(ST_BEHAVIOR (class)->method_dictionary, node->method.selector, method);
+	if (parser->cache)
+		st_bytecode_cache_add(parser->cache, class, method);
 	st_node_destroy(node);
 	st_lexer_destroy(lexer);
 	st_free(class_name);
@@ -202,6 +269,12 @@ void st_compile_file_in(const char *filename) {
 	if (!st_file_get_contents(filename, &buffer))
 		return;
 
+	/* compiled methods are used in lazy mode too, being cheaper to read */
+	if (st_get_cache_mode() && st_bytecode_cache_load(filename, buffer)) {
+		st_free(buffer);
+		return;
+	}
+
 	parser = st_new0 (FileInParser);
 	parser->input = st_input_new(buffer);
 
@@ -212,9 +285,65 @@ void st_compile_file_in(const char *filename) {
 
 	parser->filename = basename(filename);
 	parser->line = 1;
+	if (st_get_lazy_mode()) {
+		parser->source = st_string_new(buffer);
+		parser->name = st_string_new(parser->filename);
+	} else if (st_get_cache_mode()) {
+		parser->cache = st_bytecode_cache_new(filename, buffer);
+	}
 
 	parse_chunks(parser);
+	if (parser->cache)
+		st_bytecode_cache_save(parser->cache);
 	st_free(buffer);
 	st_input_destroy(parser->input);
 	st_free(parser);
-}
\ No newline at end of file
+}
+
+/*
+ * st_compile_lazy_method:
+ * @method: a method filed in lazily, whose flags are ST_METHOD_LAZY
+ *
+ * Compiles @method from its source and answers the compiled method,
+ * which the caller installs in place of @method. A method which does
+ * not compile is reported as st_compile_file_in() would have done.
+ */
+st_oop st_compile_lazy_method(st_oop method) {
+	st_compiler_error error;
+	st_oop literals, class, compiled;
+	st_uint start, end, line;
+	st_input *input;
+	st_lexer *lexer;
+	st_node *node;
+	char *chunk, *filename;
+
+	literals = ST_METHOD_LITERALS (method);
+	start = st_smi_value(st_array_at(literals, LAZY_START));
+	end = st_smi_value(st_array_at(literals, LAZY_END));
+	line = st_smi_value(st_array_at(literals, LAZY_LINE));
+	class = st_array_at(literals, LAZY_CLASS);
+	filename = st_strdup((char *) st_byte_array_bytes(st_array_at(literals, LAZY_FILENAME)));
+
+	/* the range ends with the bang after the chunk */
+	chunk = st_strndup((char *) st_byte_array_bytes(st_array_at(literals, LAZY_SOURCE)) + start, end - start);
+	input = st_input_new(chunk);
+	st_free(chunk);
+	chunk = st_input_next_chunk(input);
+	st_input_destroy(input);
+
+	lexer = st_lexer_new(chunk);
+	st_free(chunk);
+
+	node = st_parser_parse(lexer, &error);
+	compiled = node != NULL ? st_generate_method(class, node, &error) : ST_NIL;
+	if (compiled == ST_NIL) {
+		fprintf(stderr, "%s:%i: %s\n", filename, line + error.line - 1, error.message);
+		exit(1);
+	}
+
+	st_node_destroy(node);
+	st_lexer_destroy(lexer);
+	st_free(filename);
+
+	return compiled;
+}
@@ -21,17 +21,33 @@ bool    st_compile_string   (st_oop      class,
 			     const char *string,
 			     st_compiler_error  *error);
 
+st_oop  st_compile_method   (st_oop      class,
+			     const char *string,
+			     st_compiler_error  *error);
+
 void    st_compile_file_in  (const char *filename);
 
+st_oop  st_compile_lazy_method (st_oop method);
+
 st_node *st_parser_parse     (st_lexer *lexer,
 			     st_compiler_error *error);
 
+st_node *st_parser_parse_pattern (st_lexer *lexer,
+				  st_compiler_error *error);
+
 st_oop  st_generate_method  (st_oop    class,
 			     st_node   *node,
 			     st_compiler_error *error);
 
+st_oop  st_clean_block_new  (st_oop    method,
+			     st_uint   argcount,
+			     st_uint   initial_ip,
+			     st_uint   stack_size);
+
 void    st_print_method     (st_oop method);
 
+st_uint st_instruction_size (st_uchar code);
+
 /* bytecodes */ 
 typedef enum
 {
@@ -62,7 +78,12 @@ typedef enum
 
     PUSH_ACTIVE_CONTEXT,
 
-    BLOCK_COPY,
+    BLOCK_COPY,      /* B, B (arg count), B (copied values), B (stack depth) */
+
+    PUSH_REMOTE_TEMP,       /* B, B (index), B (temp vector) */
+    STORE_REMOTE_TEMP,
+    STORE_POP_REMOTE_TEMP,
+    PUSH_NEW_ARRAY,         /* B, B (size) */
 
     JUMP_TRUE,
     JUMP_FALSE,
@@ -96,7 +117,13 @@ typedef enum
     SEND_CLASS,
     SEND_NEW,
     SEND_NEW_ARG,
+    SEND_VALUE_ARG2,
+    SEND_VALUE_ARG3,
 
 } Code;
 
+/* set in the copied values operand of BLOCK_COPY
+   when the block needs its home context */
+#define ST_BLOCK_COPY_HOME 0x80
+
 #endif /* __ST_COMPILER_H__ */
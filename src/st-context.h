@@ -53,6 +53,8 @@ struct st_block_context
     st_oop initial_ip;
     st_oop argcount;
     st_oop home;
+    st_oop method;
+    st_oop receiver;
 
     st_oop stack[];
 };
@@ -73,6 +75,8 @@ struct st_block_context
 #define ST_BLOCK_CONTEXT_INITIALIP(oop) (ST_BLOCK_CONTEXT (oop)->initial_ip)
 #define ST_BLOCK_CONTEXT_ARGCOUNT(oop)  (ST_BLOCK_CONTEXT (oop)->argcount)
 #define ST_BLOCK_CONTEXT_HOME(oop)      (ST_BLOCK_CONTEXT (oop)->home)
+#define ST_BLOCK_CONTEXT_METHOD(oop)    (ST_BLOCK_CONTEXT (oop)->method)
+#define ST_BLOCK_CONTEXT_RECEIVER(oop)  (ST_BLOCK_CONTEXT (oop)->receiver)
 #define ST_BLOCK_CONTEXT_STACK(oop)     (ST_BLOCK_CONTEXT (oop)->stack)
 
 #endif /* __ST_CONTEXT_H__ */
@@ -48,7 +48,7 @@ st_float_allocate (st_oop class)
 }
 
 st_oop
-st_float_new (double value)
+st_float_box (double value)
 {
     st_oop object;
 
@@ -37,15 +37,77 @@ struct st_float
     double value;
 };
 
-st_oop st_float_new       (double value);
+st_oop st_float_box       (double value);
 st_oop st_float_allocate  (st_oop class);
 
+#ifdef ST_HAVE_IMMEDIATE_FLOATS
+
+/* An immediate Float holds the bits of a double rotated left by one, so
+ * that the sign is the lowest bit, with the exponent rebased to fit the
+ * 8 bits left above the tag. That covers magnitudes from about 1e-38 to
+ * 3e38, and zeros, which are kept as they are.
+ */
+#define ST_FLOAT_EXPONENT_OFFSET ((uint64_t) 896 << 53)
+
+static inline bool
+st_float_encode (double value, st_oop *object)
+{
+    uint64_t bits;
+
+    memcpy (&bits, &value, sizeof (bits));
+    bits = (bits << 1) | (bits >> 63);
+
+    if (bits > 1) {
+	bits -= ST_FLOAT_EXPONENT_OFFSET;
+	if (bits < ((uint64_t) 1 << 53) || bits >= ((uint64_t) 1 << 61))
+	    return false;
+    }
+
+    *object = (st_oop) ((bits << ST_FLOAT_TAG_SIZE) + ST_FLOAT_TAG);
+    return true;
+}
+
+static inline double
+st_float_decode (st_oop object)
+{
+    uint64_t bits;
+    double value;
+
+    bits = object >> ST_FLOAT_TAG_SIZE;
+    if (bits > 1)
+	bits += ST_FLOAT_EXPONENT_OFFSET;
+    bits = (bits >> 1) | (bits << 63);
+
+    memcpy (&value, &bits, sizeof (value));
+    return value;
+}
+
+#endif
+
+/* answers an immediate Float if value allows, and a boxed one otherwise */
+static inline st_oop
+st_float_new (double value)
+{
+#ifdef ST_HAVE_IMMEDIATE_FLOATS
+    st_oop object;
+
+    if (ST_LIKELY (st_float_encode (value, &object)))
+	return object;
+#endif
+    return st_float_box (value);
+}
+
 static inline double
 st_float_value (st_oop object)
 {
+#ifdef ST_HAVE_IMMEDIATE_FLOATS
+    if (ST_LIKELY (st_object_is_immediate_float (object)))
+	return st_float_decode (object);
+#endif
     return ST_FLOAT (object)->value;
 }
 
+/* only for boxed Floats */
 static inline void
 st_float_set_value (st_oop object, double value)
 {
@@ -35,6 +35,8 @@
 #include "st-behavior.h"
 #include "st-character.h"
 #include "st-unicode.h"
+#include "st-context.h"
+#include "st-memory.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -44,6 +46,65 @@
 
 #define CSTRING(string) ((char *) st_byte_array_bytes (string))
 
+typedef struct Scope Scope;
+
+typedef struct
+{
+    char     *name;
+    /* scope which declares the variable */
+    Scope    *scope;
+    /* referenced from a nested block */
+    bool      captured;
+    bool      assigned;
+    /* lives in the temp vector of its scope */
+    bool      remote;
+    /* index in the frame, or in the temp vector if remote */
+    int       index;
+} Variable;
+
+/* A method, or a block which is not inlined */
+struct Scope
+{
+    st_node  *node;
+    Scope    *outer;
+
+    /* arguments first, then temporaries */
+    st_list  *variables;
+    /* variables of outer scopes which are copied into the block */
+    st_list  *copied;
+    /* the temp vector, if any variables are remote */
+    Variable *vector;
+    /* loops which are inlined into the scope */
+    st_list  *loops;
+
+    st_uint   argcount;
+    st_uint   remote_count;
+    st_uint   local_count;
+
+    /* the block refers to its receiver */
+    bool      uses_self;
+    /* the block, or a block nested in it, returns from its home context */
+    bool      uses_home;
+};
+
+typedef struct
+{
+    Scope    *scope;
+    Variable *variable;
+} Reference;
+
+/* An inlined #to:do:, #to:by:do: or #timesRepeat: */
+typedef struct
+{
+    st_node  *node;
+    /* the block argument, if any */
+    Variable *variable;
+    /* holds the loop index, which may be the block argument */
+    Variable *counter;
+    /* holds the limit, unless it is a literal */
+    Variable *limit;
+} Loop;
+
 typedef struct 
 {
     st_oop   class;
@@ -52,15 +113,31 @@ typedef struct
 
     st_compiler_error *error;
  
-    /* names of temporaries, in order of appearance */
-    st_list   *temporaries;
+    /* scope for which code is being generated */
+    Scope     *scope;
+    /* all scopes of the method, outermost first */
+    st_list   *scopes;
+    /* references to variables of outer scopes */
+    st_list   *references;
     /* names of instvars, in order they were defined */
     st_list   *instvars;
     /* literal frame for the compiled code */
     st_list   *literals;
+    /* blocks which are created at compile time, see generate_block() */
+    st_list   *clean_blocks;
     
 } Generator;
 
+typedef struct
+{
+    st_node  *node;
+    /* index of the block in the literal frame */
+    int       index;
+    st_uint   argcount;
+    st_uint   initial_ip;
+    st_uint   stack_size;
+} CleanBlock;
+
 typedef struct
 {
     st_uchar  *buffer;
@@ -104,7 +181,11 @@ check_init (void)
     sizes[POP_STACK_TOP]         = 1;
     sizes[DUPLICATE_STACK_TOP]   = 1;
     sizes[PUSH_ACTIVE_CONTEXT]   = 1;
-    sizes[BLOCK_COPY]       = 2;
+    sizes[BLOCK_COPY]       = 4;
+    sizes[PUSH_REMOTE_TEMP]      = 3;
+    sizes[STORE_REMOTE_TEMP]     = 3;
+    sizes[STORE_POP_REMOTE_TEMP] = 3;
+    sizes[PUSH_NEW_ARRAY]        = 2;
     sizes[JUMP_TRUE]        = 3;
     sizes[JUMP_FALSE]       = 3;
     sizes[JUMP]             = 3;
@@ -134,6 +215,8 @@ check_init (void)
     sizes[SEND_CLASS]       = 1;
     sizes[SEND_NEW]         = 1;
     sizes[SEND_NEW_ARG]     = 1;
+    sizes[SEND_VALUE_ARG2]  = 1;
+    sizes[SEND_VALUE_ARG3]  = 1;
 }
 
 static int size_message    (Generator *gt, st_node *node);
@@ -144,6 +227,11 @@ static int size_statements (Generator *gt, st_node *node);
 static void generate_expression (Generator *gt, st_bytecode *code, st_node *node);
 static void generate_statements (Generator *gt, st_bytecode *code, st_node *statements);
 
+static bool is_inlined_message (Generator *gt, st_node *node, bool *inlines_receiver);
+static bool match_toDo         (Generator *gt, st_node *node);
+static bool match_toByDo       (Generator *gt, st_node *node);
+static bool match_timesRepeat  (Generator *gt, st_node *node);
+
 static void
 generation_error (Generator *gt, const char *message, st_node *node)
 {
@@ -172,33 +260,6 @@ bytecode_destroy (st_bytecode *code)
 }
 
 
-static st_list *
-get_temporaries (Generator *gt,
-		 st_list  *instvars,
-		 st_node *arguments,
-		 st_node *temporaries)
-{
-    st_list *temps = NULL; 
-        
-    for (st_node *n = arguments; n; n = n->next) {
-	for (st_list *l = instvars; l; l = l->next) {
-	    if (streq (n->variable.name, (char *) l->data))
-		generation_error (gt, "name is already defined", arguments);
-	}	
-	temps = st_list_prepend (temps, (st_pointer) n->variable.name);
-    }
-
-    for (st_node *n = temporaries; n; n = n->next) {	
-	for (st_list *l = instvars; l; l = l->next) {
-	    if (streq (n->variable.name, (char *) l->data))
-		generation_error (gt, "name is already defined", temporaries);
-	}
-	temps = st_list_prepend (temps, (st_pointer) n->variable.name);
-    }
-
-    return st_list_reverse (temps);
-}
-
 static Generator *
 generator_new (void)
 {
@@ -209,18 +270,28 @@ generator_new (void)
     gt->class       = 0;
     gt->instvars    = NULL;
     gt->literals    = NULL;
-    gt->temporaries = NULL;
+    gt->scope       = NULL;
+    gt->scopes      = NULL;
+    gt->references  = NULL;
+    gt->clean_blocks = NULL;
    
     return gt;
 }
 
+static void scope_destroy (Scope *scope);
+
 static void
 generator_destroy (Generator *gt)
 {
     st_list_foreach (gt->instvars, st_free);
     st_list_destroy (gt->instvars);
-    st_list_destroy (gt->temporaries);
+    st_list_foreach (gt->scopes, (st_list_foreach_func) scope_destroy);
+    st_list_destroy (gt->scopes);
+    st_list_foreach (gt->references, st_free);
+    st_list_destroy (gt->references);
     st_list_destroy (gt->literals);
+    st_list_foreach (gt->clean_blocks, st_free);
+    st_list_destroy (gt->clean_blocks);
 
     st_free (gt);
 }
@@ -281,20 +352,6 @@ find_instvar (Generator *gt, char *name)
     return -1;
 }
 
-static int
-find_temporary (Generator *gt, char *name)
-{   
-    int i = 0;
-    
-    for (st_list *l = gt->temporaries; l; l = l->next) {
-
-	if (streq (name, (char *) l->data))
-	    return i;
-	i++;
-    }
-    return -1;
-}
-
 static int
 find_literal_const (Generator *gt, st_oop literal)
 {   
@@ -341,6 +398,388 @@ jump_offset (Generator *gt, st_bytecode *code, int offset)
     emit (code, (offset >> 8) & 0xFF);
 }
 
+/* Scopes
+ *
+ * The method and every block which is not inlined has a scope of its
+ * own. Inlined blocks declare their arguments and temporaries in the
+ * enclosing scope.
+ *
+ * A variable which is referenced from a nested block is captured.
+ * If it is never assigned, its value is copied into the block when the
+ * block is created. Otherwise it is remote, it lives in the temp vector
+ * of its scope, an Array shared with nested blocks, and the vector is
+ * copied instead.
+ *
+ * The frame of a block holds its arguments, the copied values and then
+ * its temporaries. Only blocks which return from their home context
+ * keep a reference to it.
+ */
+
+static int
+list_index (st_list *list, st_pointer data)
+{
+    int i = 0;
+    for (st_list *l = list; l; l = l->next) {
+	if (l->data == data)
+	    return i;
+	i++;
+    }
+    return -1;
+}
+
+static Scope *
+scope_new (Generator *gt, Scope *outer, st_node *node)
+{
+    Scope *scope;
+
+    scope = st_new0 (Scope);
+    scope->node  = node;
+    scope->outer = outer;
+
+    gt->scopes = st_list_append (gt->scopes, scope);
+
+    return scope;
+}
+
+static void
+scope_destroy (Scope *scope)
+{
+    st_list_foreach (scope->variables, st_free);
+    st_list_destroy (scope->variables);
+    st_list_destroy (scope->copied);
+    st_list_foreach (scope->loops, st_free);
+    st_list_destroy (scope->loops);
+    st_free (scope->vector);
+    st_free (scope);
+}
+
+static Scope *
+find_scope (Generator *gt, st_node *node)
+{
+    for (st_list *l = gt->scopes; l; l = l->next) {
+	if (((Scope *) l->data)->node == node)
+	    return (Scope *) l->data;
+    }
+    st_assert_not_reached ();
+    return NULL;
+}
+
+static Variable *
+lookup_variable (Scope *scope, const char *name)
+{
+    for (; scope; scope = scope->outer) {
+	for (st_list *l = scope->variables; l; l = l->next) {
+	    if (streq (name, ((Variable *) l->data)->name))
+		return (Variable *) l->data;
+	}
+    }
+    return NULL;
+}
+
+static void
+declare_variables (Generator *gt, Scope *scope, st_node *names, bool arguments)
+{
+    Scope    *method;
+    Variable *var;
+
+    for (method = scope; method->outer; method = method->outer)
+	;
+
+    for (st_node *node = names; node; node = node->next) {
+
+	if (find_instvar (gt, node->variable.name) >= 0)
+	    generation_error (gt, "name is already defined", node);
+
+	if (scope != method && lookup_variable (method, node->variable.name))
+	    generation_error (gt, "name already used in method", node);
+
+	/* sibling inlined blocks may declare the same temporary */
+	var = lookup_variable (scope, node->variable.name);
+	if (!arguments && var != NULL && var->scope == scope)
+	    continue;
+
+	var = st_new0 (Variable);
+	var->name  = node->variable.name;
+	var->scope = scope;
+	scope->variables = st_list_append (scope->variables, var);
+	if (arguments)
+	    scope->argcount++;
+    }
+}
+
+/* A variable which only the generated code refers to */
+static Variable *
+declare_hidden_variable (Scope *scope)
+{
+    Variable *var;
+
+    var = st_new0 (Variable);
+    var->name  = "";
+    var->scope = scope;
+    scope->variables = st_list_append (scope->variables, var);
+
+    return var;
+}
+
+static Loop *
+find_loop (Generator *gt, st_node *node)
+{
+    for (st_list *l = gt->scope->loops; l; l = l->next) {
+	if (((Loop *) l->data)->node == node)
+	    return (Loop *) l->data;
+    }
+    st_assert_not_reached ();
+    return NULL;
+}
+
+static void
+declare_loop (Generator *gt, Scope *scope, st_node *node)
+{
+    Loop    *loop;
+    st_node *stop, *block;
+
+    if (match_timesRepeat (gt, node)) {
+	stop  = node->message.receiver;
+	block = node->message.arguments;
+    } else if (match_toDo (gt, node) || match_toByDo (gt, node)) {
+	stop  = node->message.arguments;
+	for (block = stop; block->next; block = block->next)
+	    ;
+    } else {
+	return;
+    }
+
+    loop = st_new0 (Loop);
+    loop->node = node;
+    if (block->block.arguments)
+	loop->variable = lookup_variable (scope, block->block.arguments->variable.name);
+    if (stop->type != ST_LITERAL_NODE || !st_object_is_smi (stop->literal.value))
+	loop->limit = declare_hidden_variable (scope);
+
+    scope->loops = st_list_append (scope->loops, loop);
+}
+
+static void
+mark_self (Scope *scope)
+{
+    for (; scope->outer; scope = scope->outer)
+	scope->uses_self = true;
+}
+
+static void
+mark_home (Scope *scope)
+{
+    for (; scope->outer; scope = scope->outer)
+	scope->uses_home = true;
+}
+
+static void
+reference_variable (Generator *gt, Scope *scope, char *name, bool assign)
+{
+    Variable  *var;
+    Reference *ref;
+
+    if (streq (name, "self") || streq (name, "super")) {
+	mark_self (scope);
+	return;
+    }
+    if (streq (name, "thisContext")) {
+	mark_self (scope);
+	mark_home (scope);
+	return;
+    }
+
+    var = lookup_variable (scope, name);
+    if (var == NULL) {
+	if (find_instvar (gt, name) >= 0)
+	    mark_self (scope);
+	return;
+    }
+
+    if (assign)
+	var->assigned = true;
+
+    if (var->scope != scope) {
+	var->captured = true;
+	ref = st_new0 (Reference);
+	ref->scope = scope;
+	ref->variable = var;
+	gt->references = st_list_append (gt->references, ref);
+    }
+}
+
+static void analyse_statements (Generator *gt, Scope *scope, st_node *statements);
+
+static void
+analyse_block (Generator *gt, Scope *outer, st_node *node)
+{
+    Scope *scope;
+
+    scope = scope_new (gt, outer, node);
+    declare_variables (gt, scope, node->block.arguments, true);
+    declare_variables (gt, scope, node->block.temporaries, false);
+    analyse_statements (gt, scope, node->block.statements);
+}
+
+static void
+analyse_inlined_block (Generator *gt, Scope *scope, st_node *node)
+{
+    declare_variables (gt, scope, node->block.arguments, false);
+    declare_variables (gt, scope, node->block.temporaries, false);
+    analyse_statements (gt, scope, node->block.statements);
+}
+
+static void
+analyse_expression (Generator *gt, Scope *scope, st_node *node)
+{
+    bool inlined, inlines_receiver;
+
+    switch (node->type) {
+    case ST_VARIABLE_NODE:
+	reference_variable (gt, scope, node->variable.name, false);
+	break;
+
+    case ST_ASSIGN_NODE:
+	analyse_expression (gt, scope, node->assign.expression);
+	reference_variable (gt, scope, node->assign.assignee->variable.name, true);
+	break;
+
+    case ST_RETURN_NODE:
+	mark_home (scope);
+	analyse_expression (gt, scope, node->retrn.expression);
+	break;
+
+    case ST_BLOCK_NODE:
+	analyse_block (gt, scope, node);
+	break;
+
+    case ST_MESSAGE_NODE:
+	inlined = is_inlined_message (gt, node, &inlines_receiver);
+
+	if (inlined && inlines_receiver)
+	    analyse_inlined_block (gt, scope, node->message.receiver);
+	else
+	    analyse_expression (gt, scope, node->message.receiver);
+
+	for (st_node *arg = node->message.arguments; arg; arg = arg->next) {
+	    if (inlined && arg->type == ST_BLOCK_NODE)
+		analyse_inlined_block (gt, scope, arg);
+	    else
+		analyse_expression (gt, scope, arg);
+	}
+
+	if (inlined)
+	    declare_loop (gt, scope, node);
+	break;
+
+    case ST_CASCADE_NODE:
+	analyse_expression (gt, scope, node->cascade.receiver);
+	for (st_list *l = node->cascade.messages; l; l = l->next) {
+	    for (st_node *arg = ((st_node *) l->data)->message.arguments; arg; arg = arg->next)
+		analyse_expression (gt, scope, arg);
+	}
+	break;
+
+    default:
+	break;
+    }
+}
+
+static void
+analyse_statements (Generator *gt, Scope *scope, st_node *statements)
+{
+    for (st_node *node = statements; node; node = node->next)
+	analyse_expression (gt, scope, node);
+}
+
+/* Decides where each variable lives, once all scopes are analysed */
+static void
+allocate_variables (Generator *gt)
+{
+    Scope     *scope;
+    Variable  *var, *target;
+    Reference *ref;
+    Loop      *loop;
+    st_uint    index, position;
+
+    for (st_list *l = gt->scopes; l; l = l->next) {
+	scope = (Scope *) l->data;
+
+	/* loops count in their block argument only if nothing else
+	   can observe it changing */
+	for (st_list *v = scope->loops; v; v = v->next) {
+	    loop = (Loop *) v->data;
+	    if (loop->variable && !loop->variable->captured && !loop->variable->assigned)
+		loop->counter = loop->variable;
+	    else
+		loop->counter = declare_hidden_variable (scope);
+	}
+
+	for (st_list *v = scope->variables; v; v = v->next) {
+	    var = (Variable *) v->data;
+	    var->remote = var->captured && var->assigned;
+	    if (var->remote)
+		var->index = scope->remote_count++;
+	}
+	if (scope->remote_count > 0) {
+	    scope->vector = st_new0 (Variable);
+	    scope->vector->name  = "";
+	    scope->vector->scope = scope;
+	}
+    }
+
+    /* every block between a reference and the declaring scope copies the variable */
+    for (st_list *l = gt->references; l; l = l->next) {
+	ref = (Reference *) l->data;
+	target = ref->variable->remote ? ref->variable->scope->vector : ref->variable;
+	for (scope = ref->scope; scope != ref->variable->scope; scope = scope->outer) {
+	    if (list_index (scope->copied, target) < 0)
+		scope->copied = st_list_append (scope->copied, target);
+	}
+    }
+
+    for (st_list *l = gt->scopes; l; l = l->next) {
+	scope = (Scope *) l->data;
+
+	if (st_list_length (scope->copied) > (ST_BLOCK_COPY_HOME - 1))
+	    generation_error (gt, "block is too complex", scope->node);
+
+	/* arguments keep their position, remote ones are copied
+	   into the vector on entry */
+	position = 0;
+	index = scope->argcount + st_list_length (scope->copied);
+	for (st_list *v = scope->variables; v; v = v->next, position++) {
+	    var = (Variable *) v->data;
+	    if (var->remote)
+		continue;
+	    if (position < scope->argcount) {
+		var->index = position;
+	    } else {
+		var->index = index++;
+		scope->local_count++;
+	    }
+	}
+	if (scope->vector)
+	    scope->vector->index = index;
+    }
+}
+
+/* Index of @var in the frame of the scope being generated */
+static int
+variable_slot (Generator *gt, Variable *var, st_node *node)
+{
+    int index;
+
+    if (var->scope == gt->scope)
+	return var->index;
+
+    index = list_index (gt->scope->copied, var);
+    if (index < 0)
+	generation_error (gt, "unknown variable", node);
+
+    return gt->scope->argcount + index;
+}
+
 
 static void
 assign_temp (Generator *gt, st_bytecode *code, int index, bool pop)
@@ -378,13 +817,35 @@ assign_literal_var (Generator *gt, st_bytecode *code, int index, bool pop)
     emit (code, (st_uchar) index); 
 }
 
+static void
+assign_variable (Generator *gt, st_bytecode *code, Variable *var, bool pop, st_node *node)
+{
+    if (var->remote) {
+	emit (code, pop ? STORE_POP_REMOTE_TEMP : STORE_REMOTE_TEMP);
+	emit (code, (st_uchar) var->index);
+	emit (code, (st_uchar) variable_slot (gt, var->scope->vector, node));
+    } else {
+	assign_temp (gt, code, variable_slot (gt, var, node), pop);
+    }
+}
+
 static void
 push (Generator *gt, st_bytecode *code, st_uchar value, st_uchar index)
 {
     emit (code, value);
     emit (code, index);
-    
-    code->max_stack_depth++;
+}
+
+static void
+push_variable (Generator *gt, st_bytecode *code, Variable *var, st_node *node)
+{
+    if (var->remote) {
+	emit (code, PUSH_REMOTE_TEMP);
+	emit (code, (st_uchar) var->index);
+	emit (code, (st_uchar) variable_slot (gt, var->scope->vector, node));
+    } else {
+	push (gt, code, PUSH_TEMP, variable_slot (gt, var, node));
+    }
 }
 
 
@@ -392,19 +853,19 @@ static void
 push_special (Generator *gt, st_bytecode *code, st_uchar value)
 {
     emit (code, value);
-    code->max_stack_depth++;
 }
 
 static void
 generate_assign (Generator *gt, st_bytecode *code, st_node *node, bool pop)
 {
-    int index;
+    Variable *var;
+    int       index;
     
     generate_expression (gt, code, node->assign.expression);
     
-    index = find_temporary (gt, node->assign.assignee->variable.name);
-    if (index >= 0) {
-	assign_temp (gt, code, index, pop); 
+    var = lookup_variable (gt->scope, node->assign.assignee->variable.name);
+    if (var != NULL) {
+	assign_variable (gt, code, var, pop, node);
 	return;
     }
 
@@ -456,59 +917,124 @@ size_return (Generator *gt, st_node *node)
     return code.size;
 }
 
-static st_list *
-get_block_temporaries (Generator *gt, st_node *temporaries)
+static CleanBlock *
+clean_block_at (Generator *gt, int index)
 {
-    st_list *temps = NULL;
-    
-    for (st_node *node = temporaries; node; node = node->next) {
-      
-	for (st_list *l = gt->instvars; l; l = l->next) {
-	  if (streq (node->variable.name, (char *) l->data))
-	      generation_error (gt, "name is already defined", node);
-	}
+    for (st_list *l = gt->clean_blocks; l; l = l->next) {
+	if (((CleanBlock *) l->data)->index == index)
+	    return (CleanBlock *) l->data;
+    }
+    return NULL;
+}
 
-	for (st_list *l = gt->temporaries; l; l = l->next) {
-	  if (streq (node->variable.name, (char *) l->data))
-	      generation_error (gt, "name already used in method", node);
-	}
+static CleanBlock *
+find_clean_block (Generator *gt, st_node *node)
+{
+    CleanBlock *block;
 
-	temps = st_list_prepend (temps, (st_pointer) node->variable.name);
-	
+    /* the same node is generated more than once while sizing code */
+    for (st_list *l = gt->clean_blocks; l; l = l->next) {
+	if (((CleanBlock *) l->data)->node == node)
+	    return (CleanBlock *) l->data;
     }
-    
-    return st_list_reverse (temps);
+
+    block = st_new0 (CleanBlock);
+    block->node = node;
+    block->argcount = st_node_list_length (node->block.arguments);
+    block->index = st_list_length (gt->literals);
+
+    /* reserve a slot in the literal frame, the block itself
+       is created once its stack depth is known */
+    gt->literals = st_list_append (gt->literals, (st_pointer) ST_NIL);
+    gt->clean_blocks = st_list_append (gt->clean_blocks, block);
+
+    return block;
 }
 
+/* Creates the temp vector of the current scope and moves remote
+ * arguments into it. In blocks, the vector is pushed right into its
+ * slot above the temporaries.
+ */
 static void
-generate_block (Generator *gt, st_bytecode *code, st_node *node)
+generate_temp_vector (Generator *gt, st_bytecode *code, st_node *node)
 {
-    int   index, size = 0;
-    st_uint  i, argcount;
-    st_node *l;
+    Variable *var;
+    st_uint   position = 0;
 
-    argcount = st_node_list_length (node->block.arguments);
-
-    emit (code, BLOCK_COPY);
-    emit (code, argcount);
+    if (gt->scope->vector == NULL)
+	return;
 
-    // get size of block code and then jump around that code
-    size = 2 * argcount + size_statements (gt, node->block.statements) + sizes[BLOCK_RETURN];
-    jump_offset (gt, code, size);
+    emit (code, PUSH_NEW_ARRAY);
+    emit (code, gt->scope->remote_count);
+    if (gt->scope->outer == NULL)
+	assign_temp (gt, code, gt->scope->vector->index, true);
 
-    /* Store all block arguments into the temporary frame.
-       Note that upon a block activation, the stack pointer sits
-       above the last argument to to the block */
-    i = st_node_list_length (node->block.arguments);
-    for (; i > 0; --i) {
-	l = st_node_list_at (node->block.arguments, i - 1);
-	index = find_temporary (gt, l->variable.name);
-	st_assert (index >= 0);
-	assign_temp (gt, code, index, true);
+    for (st_list *l = gt->scope->variables; l && position < gt->scope->argcount; l = l->next, position++) {
+	var = (Variable *) l->data;
+	if (var->remote) {
+	    push (gt, code, PUSH_TEMP, position);
+	    assign_variable (gt, code, var, true, node);
+	}
     }
+}
+
+static void
+generate_block_body (Generator *gt, st_bytecode *code, st_node *node)
+{
+    for (st_uint i = 0; i < gt->scope->local_count; i++)
+	push_special (gt, code, PUSH_NIL);
 
+    generate_temp_vector (gt, code, node);
     generate_statements (gt, code, node->block.statements);
     emit (code, BLOCK_RETURN);
+}
+
+static int
+size_block_body (Generator *gt, st_node *node)
+{
+    st_bytecode code;
+
+    bytecode_init (&code);
+    generate_block_body (gt, &code, node);
+    bytecode_destroy (&code);
+
+    return code.size;
+}
+
+/* Blocks which refer to neither their receiver, their home context nor
+ * any outer variables are clean. They are created once, when their
+ * method is compiled, and pushed as a literal.
+ *
+ * Other blocks are created by BLOCK_COPY, from the values pushed
+ * for their copied variables.
+ */
+static void
+generate_block (Generator *gt, st_bytecode *code, st_node *node)
+{
+    Scope   *scope, *outer;
+    st_uint  copied_count;
+
+    scope = find_scope (gt, node);
+    outer = gt->scope;
+    copied_count = st_list_length (scope->copied);
+
+    if (copied_count == 0 && !scope->uses_self && !scope->uses_home) {
+	push (gt, code, PUSH_LITERAL_CONST, find_clean_block (gt, node)->index);
+    } else {
+	for (st_list *l = scope->copied; l; l = l->next)
+	    push (gt, code, PUSH_TEMP, variable_slot (gt, (Variable *) l->data, node));
+
+	emit (code, BLOCK_COPY);
+	emit (code, scope->argcount);
+	emit (code, copied_count | (scope->uses_home ? ST_BLOCK_COPY_HOME : 0));
+	/* stack depth, filled in by compute_stack_depth() */
+	emit (code, 0);
+    }
+
+    gt->scope = scope;
+    jump_offset (gt, code, size_block_body (gt, node));
+    generate_block_body (gt, code, node);
+    gt->scope = outer;
 } 
 
 static int
@@ -963,9 +1489,371 @@ generate_or (Generator *gt, st_bytecode *code, st_node *node)
 	emit (code, POP_STACK_TOP);
 }
 
-typedef void (* CodeGenerationFunc)    (Generator *gt, st_bytecode *code, st_node *node);
-typedef bool (* OptimisationMatchFunc) (Generator *gt, st_node *node);
-
+static bool
+is_smi_literal (st_node *node)
+{
+    return node->type == ST_LITERAL_NODE && st_object_is_smi (node->literal.value);
+}
+
+/* a block with at most @argcount arguments */
+static bool
+is_inlinable_block (st_node *node, st_uint argcount)
+{
+    return node->type == ST_BLOCK_NODE && st_node_list_length (node->block.arguments) <= argcount;
+}
+
+/* #to:do:
+ */
+static bool
+match_toDo (Generator *gt, st_node *node)
+{
+    st_node *block;
+
+    if (strcmp (CSTRING (node->message.selector), "to:do:") != 0)
+	return false;
+
+    if (node->message.arguments->type == ST_BLOCK_NODE)
+	return false;
+
+    block = node->message.arguments->next;
+    if (block->type != ST_BLOCK_NODE || st_node_list_length (block->block.arguments) != 1)
+	return false;
+
+    return true;
+}
+
+/* #to:by:do:
+ */
+static bool
+match_toByDo (Generator *gt, st_node *node)
+{
+    st_node *step, *block;
+
+    if (strcmp (CSTRING (node->message.selector), "to:by:do:") != 0)
+	return false;
+
+    if (node->message.arguments->type == ST_BLOCK_NODE)
+	return false;
+
+    /* the direction of the loop must be known */
+    step = node->message.arguments->next;
+    if (!is_smi_literal (step) || st_smi_value (step->literal.value) == 0)
+	return false;
+
+    block = step->next;
+    if (block->type != ST_BLOCK_NODE || st_node_list_length (block->block.arguments) != 1)
+	return false;
+
+    return true;
+}
+
+/* #timesRepeat:
+ */
+static bool
+match_timesRepeat (Generator *gt, st_node *node)
+{
+    st_node *block;
+
+    if (strcmp (CSTRING (node->message.selector), "timesRepeat:") != 0)
+	return false;
+
+    block = node->message.arguments;
+    if (block->type != ST_BLOCK_NODE || block->block.arguments != NULL)
+	return false;
+
+    return true;
+}
+
+/*
+ * Inlined numeric loops count in a SmallInteger temporary:
+ *
+ *       counter := start. limit := stop.
+ * test: counter <= limit jumpFalse: exit.
+ *       arg := counter. statements. pop.
+ *       counter := counter + step. jump: test.
+ * exit:
+ *
+ * The block argument is the counter itself, unless nested blocks
+ * capture it, so that each of them sees the value of its own iteration.
+ * Like the methods in Number, the value of the loop is its receiver.
+ */
+static void
+generate_loop (Generator *gt, st_bytecode *code, st_node *node)
+{
+    Loop       *loop;
+    st_node    *block, *start, *stop, *step;
+    st_bytecode body;
+    st_uint     test;
+    int         size;
+
+    loop = find_loop (gt, node);
+
+    if (match_timesRepeat (gt, node)) {
+	start = NULL;
+	stop  = node->message.receiver;
+	step  = NULL;
+	block = node->message.arguments;
+    } else {
+	start = node->message.receiver;
+	stop  = node->message.arguments;
+	step  = match_toByDo (gt, node) ? stop->next : NULL;
+	block = step ? step->next : stop->next;
+    }
+
+    if (start) {
+	generate_expression (gt, code, start);
+	if (!node->message.is_statement)
+	    emit (code, DUPLICATE_STACK_TOP);
+    } else {
+	emit (code, PUSH_INTEGER);
+	emit (code, 1);
+    }
+    assign_variable (gt, code, loop->counter, true, node);
+
+    if (loop->limit) {
+	generate_expression (gt, code, stop);
+	if (!node->message.is_statement && start == NULL)
+	    emit (code, DUPLICATE_STACK_TOP);
+	assign_variable (gt, code, loop->limit, true, node);
+    }
+
+    test = code->size;
+    push_variable (gt, code, loop->counter, node);
+    if (loop->limit)
+	push_variable (gt, code, loop->limit, node);
+    else
+	generate_expression (gt, code, stop);
+    if (step && st_smi_value (step->literal.value) < 0)
+	emit (code, SEND_GE);
+    else
+	emit (code, SEND_LE);
+
+    bytecode_init (&body);
+    if (loop->variable && loop->variable != loop->counter) {
+	push_variable (gt, &body, loop->counter, node);
+	assign_variable (gt, &body, loop->variable, true, node);
+    }
+    generate_statements (gt, &body, block->block.statements);
+    emit (&body, POP_STACK_TOP);
+    push_variable (gt, &body, loop->counter, node);
+    if (step) {
+	generate_expression (gt, &body, step);
+    } else {
+	emit (&body, PUSH_INTEGER);
+	emit (&body, 1);
+    }
+    emit (&body, SEND_PLUS);
+    assign_variable (gt, &body, loop->counter, true, node);
+
+    size = body.size + sizes[JUMP];
+    emit (code, JUMP_FALSE);
+    emit (code, size & 0xFF);
+    emit (code, (size >> 8) & 0xFF);
+    for (st_uint i = 0; i < body.size; i++)
+	emit (code, body.buffer[i]);
+    bytecode_destroy (&body);
+
+    size = test - (code->size + sizes[JUMP]);
+    emit (code, JUMP);
+    emit (code, size & 0xFF);
+    emit (code, (size >> 8) & 0xFF);
+
+    /* the receiver of timesRepeat: when it is a literal */
+    if (!node->message.is_statement && start == NULL && loop->limit == NULL)
+	generate_expression (gt, code, stop);
+}
+
+/* Pushes whether the receiver of @node is nil, after storing it
+ * into the argument of @block, if it has one.
+ */
+static void
+generate_nil_test (Generator *gt, st_bytecode *code, st_node *node, st_node *block)
+{
+    Variable *var;
+
+    generate_expression (gt, code, node->message.receiver);
+
+    if (block && block->block.arguments) {
+	var = lookup_variable (gt->scope, block->block.arguments->variable.name);
+	st_assert (var != NULL);
+	assign_variable (gt, code, var, false, node);
+    }
+
+    emit (code, PUSH_NIL);
+    emit (code, SEND_IDENTITY_EQ);
+}
+
+/* Evaluates @block if the test on top of the stack doesn't make
+ * @jump jump, or else answers nil.
+ */
+static void
+generate_conditional (Generator *gt, st_bytecode *code, st_node *node, st_uchar jump, st_node *block)
+{
+    int size;
+
+    size = size_statements (gt, block->block.statements);
+    size += node->message.is_statement ? sizes[POP_STACK_TOP] : sizes[JUMP];
+    emit (code, jump);
+    emit (code, size & 0xFF);
+    emit (code, (size >> 8) & 0xFF);
+    generate_statements (gt, code, block->block.statements);
+
+    if (node->message.is_statement) {
+	emit (code, POP_STACK_TOP);
+    } else {
+	emit (code, JUMP);
+	emit (code, 1);
+	emit (code, 0);
+	emit (code, PUSH_NIL);
+    }
+}
+
+/* Evaluates @first if the test on top of the stack doesn't make
+ * @jump jump, or else @second.
+ */
+static void
+generate_branches (Generator *gt, st_bytecode *code, st_node *node, st_uchar jump,
+		   st_node *first, st_node *second)
+{
+    int size;
+
+    size = size_statements (gt, first->block.statements) + sizes[JUMP];
+    emit (code, jump);
+    emit (code, size & 0xFF);
+    emit (code, (size >> 8) & 0xFF);
+    generate_statements (gt, code, first->block.statements);
+    size = size_statements (gt, second->block.statements);
+    emit (code, JUMP);
+    emit (code, size & 0xFF);
+    emit (code, (size >> 8) & 0xFF);
+    generate_statements (gt, code, second->block.statements);
+
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
+}
+
+/* #ifNil:
+ */
+static bool
+match_ifNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNil:") != 0)
+	return false;
+
+    return is_inlinable_block (node->message.arguments, 0);
+}
+
+static void
+generate_ifNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    generate_nil_test (gt, code, node, NULL);
+    generate_conditional (gt, code, node, JUMP_FALSE, node->message.arguments);
+}
+
+/* #ifNotNil:
+ */
+static bool
+match_ifNotNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNotNil:") != 0)
+	return false;
+
+    return is_inlinable_block (node->message.arguments, 1);
+}
+
+static void
+generate_ifNotNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    generate_nil_test (gt, code, node, node->message.arguments);
+    generate_conditional (gt, code, node, JUMP_TRUE, node->message.arguments);
+}
+
+/* #ifNil:ifNotNil:
+ */
+static bool
+match_ifNilifNotNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNil:ifNotNil:") != 0)
+	return false;
+
+    return is_inlinable_block (node->message.arguments, 0)
+	&& is_inlinable_block (node->message.arguments->next, 1);
+}
+
+static void
+generate_ifNilifNotNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    generate_nil_test (gt, code, node, node->message.arguments->next);
+    generate_branches (gt, code, node, JUMP_FALSE,
+		       node->message.arguments, node->message.arguments->next);
+}
+
+/* #ifNotNil:ifNil:
+ */
+static bool
+match_ifNotNilifNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNotNil:ifNil:") != 0)
+	return false;
+
+    return is_inlinable_block (node->message.arguments, 1)
+	&& is_inlinable_block (node->message.arguments->next, 0);
+}
+
+static void
+generate_ifNotNilifNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    generate_nil_test (gt, code, node, node->message.arguments);
+    generate_branches (gt, code, node, JUMP_TRUE,
+		       node->message.arguments, node->message.arguments->next);
+}
+
+/* #isNil
+ */
+static bool
+match_isNil (Generator *gt, st_node *node)
+{
+    return strcmp (CSTRING (node->message.selector), "isNil") == 0;
+}
+
+static void
+generate_isNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    generate_nil_test (gt, code, node, NULL);
+
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
+}
+
+/* #isNotNil
+ */
+static bool
+match_isNotNil (Generator *gt, st_node *node)
+{
+    return strcmp (CSTRING (node->message.selector), "isNotNil") == 0;
+}
+
+static void
+generate_isNotNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    generate_nil_test (gt, code, node, NULL);
+
+    emit (code, JUMP_TRUE);
+    emit (code, 4);
+    emit (code, 0);
+    emit (code, PUSH_TRUE);
+    emit (code, JUMP);
+    emit (code, 1);
+    emit (code, 0);
+    emit (code, PUSH_FALSE);
+
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
+}
+
+typedef void (* CodeGenerationFunc)    (Generator *gt, st_bytecode *code, st_node *node);
+typedef bool (* OptimisationMatchFunc) (Generator *gt, st_node *node);
+
 static const struct optimisers {
     
     CodeGenerationFunc    generation_func;
@@ -982,9 +1870,34 @@ static const struct optimisers {
     { generate_whileTrueArg,       match_whileTrueArg },
     { generate_whileFalseArg,      match_whileFalseArg },
     { generate_and,                match_and },
-    { generate_or,                 match_or  }
+    { generate_or,                 match_or  },
+    { generate_loop,               match_toDo },
+    { generate_loop,               match_toByDo },
+    { generate_loop,               match_timesRepeat },
+    { generate_ifNil,              match_ifNil },
+    { generate_ifNotNil,           match_ifNotNil },
+    { generate_ifNilifNotNil,      match_ifNilifNotNil },
+    { generate_ifNotNilifNil,      match_ifNotNilifNil },
+    { generate_isNil,              match_isNil },
+    { generate_isNotNil,           match_isNotNil }
 };
 
+static bool
+is_inlined_message (Generator *gt, st_node *node, bool *inlines_receiver)
+{
+    for (st_uint i = 0; i < ST_N_ELEMENTS (optimisers); i++) {
+	if (optimisers[i].match_func (gt, node)) {
+	    /* the loops inline their receiver block as well */
+	    *inlines_receiver = optimisers[i].match_func == match_whileTrue
+		|| optimisers[i].match_func == match_whileFalse
+		|| optimisers[i].match_func == match_whileTrueArg
+		|| optimisers[i].match_func == match_whileFalseArg;
+	    return true;
+	}
+    }
+    return false;
+}
+
 static void
 generate_message_send (Generator *gt, st_bytecode *code, st_node *node)
 {
@@ -1097,7 +2010,8 @@ size_message (Generator *gt, st_node *node)
 static void
 generate_expression (Generator *gt, st_bytecode *code, st_node *node)
 {   
-    int index;
+    Variable *var;
+    int       index;
 
     switch (node->type) {
     case ST_VARIABLE_NODE:
@@ -1124,9 +2038,9 @@ generate_expression (Generator *gt, st_bytecode *code, st_node *node)
 	    break;
 	}
 
-	index = find_temporary (gt, node->variable.name);
-	if (index >= 0) {
-	    push (gt, code, PUSH_TEMP, index);
+	var = lookup_variable (gt->scope, node->variable.name);
+	if (var != NULL) {
+	    push_variable (gt, code, var, node);
 	    break;
 	}
 	index = find_instvar (gt, node->variable.name);
@@ -1299,50 +2213,237 @@ generate_method_statements (Generator *gt, st_bytecode *code, st_node *statement
    emit (code, RETURN_STACK_TOP);
 }
 
-static st_list *
-collect_temporaries (Generator *gt, st_node *node)
+/*
+ * Computes the maximum operand stack depth reached by the code
+ * in [start, end), which is entered with @depth slots in use.
+ *
+ * Jumps only ever target code at the same nesting level, so a
+ * single pass in program order suffices. Depths at jump targets are
+ * remembered in @depths so that code following an unconditional
+ * jump starts out with the right depth. Nested blocks execute on their own
+ * stack, which also holds their arguments, copied values and temporaries,
+ * so their depth is computed separately and stored in the last operand
+ * of their BLOCK_COPY instruction.
+ */
+static int
+compute_stack_depth (Generator *gt, st_node *node, st_uchar *codes, int *depths,
+		     st_uint start, st_uint end, int depth)
 {
-    st_list *temps = NULL;
+    st_uint ip = start;
+    int     max = depth;
+    st_uint block_end;
+    int     block_depth;
+    st_uint copied_count;
+    CleanBlock *block;
 
-    if (node == NULL)
-	return NULL;
+    while (ip < end) {
 
-    if (node->type == ST_BLOCK_NODE) {
-	temps = st_list_concat (get_block_temporaries (gt, node->block.arguments),
-				get_block_temporaries (gt, node->block.temporaries));
-    }    
+	if (depths[ip] >= 0)
+	    depth = depths[ip];
 
-    switch (node->type) {
-    case ST_BLOCK_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->block.statements));
-	break;
-    case ST_ASSIGN_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->assign.expression));
-	break;
-    case ST_RETURN_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->retrn.expression));
-	break;
-    case ST_MESSAGE_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->message.receiver));
-	temps = st_list_concat (temps, collect_temporaries (gt, node->message.arguments));
-	break;
-	break;
-    case ST_CASCADE_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->cascade.receiver));
-	for (st_list *l = node->cascade.messages; l; l = l->next)
-	    temps = st_list_concat (temps, collect_temporaries (gt, (st_node *) l->data));
+	switch (codes[ip]) {
 
-	break;
+	case PUSH_LITERAL_CONST:
+	    block = clean_block_at (gt, codes[ip + 1]);
+	    if (block == NULL) {
+		depth++;
+		break;
+	    }
+	    /* a clean block, its body follows the jump around it */
+	    block->initial_ip = ip + sizes[PUSH_LITERAL_CONST] + sizes[JUMP];
+	    block_end = block->initial_ip + *((short *) (codes + ip + sizes[PUSH_LITERAL_CONST] + 1));
+	    block_depth = compute_stack_depth (gt, node, codes, depths,
+					       block->initial_ip, block_end, block->argcount);
+	    if (block_depth > 255)
+		generation_error (gt, "block is too complex", node);
+	    block->stack_size = block_depth;
+
+	    ip = block_end;
+	    depth++;
+	    max = MAX (max, depth);
+	    continue;
 
-    case ST_METHOD_NODE:
-    case ST_VARIABLE_NODE:
-    case ST_LITERAL_NODE:
-	break;
+	case PUSH_TEMP:
+	case PUSH_REMOTE_TEMP:
+	case PUSH_NEW_ARRAY:
+	case PUSH_INSTVAR:
+	case PUSH_LITERAL_VAR:
+	case PUSH_SELF:
+	case PUSH_NIL:
+	case PUSH_TRUE:
+	case PUSH_FALSE:
+	case PUSH_INTEGER:
+	case PUSH_ACTIVE_CONTEXT:
+	case DUPLICATE_STACK_TOP:
+	    depth++;
+	    break;
+
+	case STORE_POP_LITERAL_VAR:
+	case STORE_POP_TEMP:
+	case STORE_POP_REMOTE_TEMP:
+	case STORE_POP_INSTVAR:
+	case POP_STACK_TOP:
+	    depth--;
+	    break;
+
+	case RETURN_STACK_TOP:
+	    /* leave room to send #cannotReturn: */
+	    max = MAX (max, depth + 2);
+	    break;
+
+	case JUMP_TRUE:
+	case JUMP_FALSE:
+	    /* room to send #mustBeBoolean */
+	    max = MAX (max, depth + 1);
+	    depth--;
+	    depths[ip + 3 + *((short *) (codes + ip + 1))] = depth;
+	    break;
+
+	case JUMP:
+	    if (*((short *) (codes + ip + 1)) >= 0)
+		depths[ip + 3 + *((short *) (codes + ip + 1))] = depth;
+	    break;
+
+	case BLOCK_COPY:
+	    /* the block body follows the jump around it, and starts out
+	       with its arguments and copied values */
+	    copied_count = codes[ip + 2] & ~ST_BLOCK_COPY_HOME;
+	    block_end = ip + sizes[BLOCK_COPY] + sizes[JUMP]
+		+ *((short *) (codes + ip + sizes[BLOCK_COPY] + 1));
+	    block_depth = compute_stack_depth (gt, node, codes, depths,
+					       ip + sizes[BLOCK_COPY] + sizes[JUMP],
+					       block_end, codes[ip + 1] + copied_count);
+	    if (block_depth > 255)
+		generation_error (gt, "block is too complex", node);
+	    codes[ip + 3] = block_depth;
+
+	    ip = block_end;
+	    depth -= copied_count;
+	    depth++;
+	    max = MAX (max, depth);
+	    continue;
+
+	case SEND:
+	case SEND_SUPER:
+	    /* a unary message that is not understood is replaced
+	       by a Message object, which takes an extra slot */
+	    if (codes[ip + 1] == 0)
+		max = MAX (max, depth + 1);
+	    depth -= codes[ip + 1];
+	    break;
+
+	case SEND_SIZE:
+	case SEND_VALUE:
+	case SEND_CLASS:
+	case SEND_NEW:
+	    max = MAX (max, depth + 1);
+	    break;
+
+	case SEND_PLUS:
+	case SEND_MINUS:
+	case SEND_LT:
+	case SEND_GT:
+	case SEND_LE:
+	case SEND_GE:
+	case SEND_EQ:
+	case SEND_NE:
+	case SEND_MUL:
+	case SEND_DIV:
+	case SEND_MOD:
+	case SEND_BITSHIFT:
+	case SEND_BITAND:
+	case SEND_BITOR:
+	case SEND_BITXOR:
+	case SEND_AT:
+	case SEND_VALUE_ARG:
+	case SEND_IDENTITY_EQ:
+	case SEND_NEW_ARG:
+	    depth -= 1;
+	    break;
+
+	case SEND_AT_PUT:
+	case SEND_VALUE_ARG2:
+	    depth -= 2;
+	    break;
+
+	case SEND_VALUE_ARG3:
+	    depth -= 3;
+	    break;
+
+	default:
+	    break;
+	}
+
+	max = MAX (max, depth);
+	ip += sizes[codes[ip]];
     }
 
-    temps = st_list_concat (temps, collect_temporaries (gt, node->next));
+    return max;
+}
+
+/* Allocates a clean block of @method, or answers 0 if the heap is full.
+ */
+st_oop
+st_clean_block_new (st_oop method, st_uint argcount, st_uint initial_ip, st_uint stack_size)
+{
+    st_oop context;
+
+    context = st_memory_allocate (ST_SIZE_OOPS (struct st_block_context) + stack_size);
+    if (context == 0)
+	return 0;
+
+    st_object_initialize_header (context, ST_BLOCK_CONTEXT_CLASS);
+    st_object_set_stack_size (context, stack_size);
+
+    /* room for the arguments */
+    for (st_uint i = 0; i < argcount; i++)
+	ST_BLOCK_CONTEXT_STACK (context)[i] = ST_NIL;
+
+    ST_CONTEXT_PART_SENDER (context) = ST_NIL;
+    ST_CONTEXT_PART_IP (context) = st_smi_new (initial_ip);
+    ST_CONTEXT_PART_SP (context) = st_smi_new (argcount);
+    ST_BLOCK_CONTEXT_INITIALIP (context) = st_smi_new (initial_ip);
+    ST_BLOCK_CONTEXT_ARGCOUNT (context) = st_smi_new (argcount);
+    ST_BLOCK_CONTEXT_HOME (context) = ST_NIL;
+    ST_BLOCK_CONTEXT_METHOD (context) = method;
+    ST_BLOCK_CONTEXT_RECEIVER (context) = ST_NIL;
+
+    return context;
+}
+
+/* Instantiates the clean blocks of @method and stores them into
+ * its literal frame. Returns @method, which may have been moved by
+ * the garbage collector.
+ */
+static st_oop
+create_clean_blocks (Generator *gt, st_oop method)
+{
+    CleanBlock *block;
+    st_oop      context;
+
+    for (st_list *l = gt->clean_blocks; l; l = l->next) {
+	block = (CleanBlock *) l->data;
+
+	context = st_clean_block_new (method, block->argcount, block->initial_ip, block->stack_size);
+	if (context == 0) {
+	    st_memory_perform_gc ();
+	    method = st_memory_remap_reference (method);
+	    context = st_clean_block_new (method, block->argcount, block->initial_ip, block->stack_size);
+	    st_assert (context != 0);
+	}
 
-    return temps;
+	st_array_at_put (ST_METHOD_LITERALS (method), block->index + 1, context);
+    }
+
+    return method;
+}
+
+/* size in bytes of the instruction starting with code */
+st_uint
+st_instruction_size (st_uchar code)
+{
+    check_init ();
+    return sizes[code];
 }
 
 st_oop
@@ -1353,6 +2454,7 @@ st_generate_method (st_oop class, st_node *node, st_compiler_error *error)
     st_uint     argcount;
     st_uint     tempcount;
     st_bytecode code;
+    int        *depths;
 
     st_assert (class != ST_NIL);
     st_assert (node != NULL && node->type == ST_METHOD_NODE);
@@ -1369,21 +2471,34 @@ st_generate_method (st_oop class, st_node *node, st_compiler_error *error)
 
     gt->class = class;
     gt->instvars = st_behavior_all_instance_variables (class);
-    gt->temporaries = get_temporaries (gt, gt->instvars, node->method.arguments, node->method.temporaries);
 
-    /* collect all block-level temporaries */
-    gt->temporaries = st_list_concat (gt->temporaries, collect_temporaries (gt, node->method.statements));
+    gt->scope = scope_new (gt, NULL, node);
+    declare_variables (gt, gt->scope, node->method.arguments, true);
+    declare_variables (gt, gt->scope, node->method.temporaries, false);
+    analyse_statements (gt, gt->scope, node->method.statements);
+    allocate_variables (gt);
 
     bytecode_init (&code);
+    generate_temp_vector (gt, &code, node);
     generate_method_statements (gt, &code, node->method.statements);
+
+    depths = st_malloc (sizeof (int) * (code.size + 1));
+    for (st_uint i = 0; i <= code.size; i++)
+	depths[i] = -1;
+    code.max_stack_depth = compute_stack_depth (gt, node, code.buffer, depths, 0, code.size, 0);
+    st_free (depths);
+    if (code.max_stack_depth > 255)
+	generation_error (gt, "method is too complex", node);
+
     method = st_object_new (ST_COMPILED_METHOD_CLASS);
 
     argcount  = st_node_list_length (node->method.arguments);
-    tempcount = st_list_length (gt->temporaries) - st_node_list_length (node->method.arguments);
+    tempcount = gt->scope->local_count + (gt->scope->vector ? 1 : 0);
 
     ST_METHOD_HEADER (method) = st_smi_new (0);
     st_method_set_arg_count    (method, argcount);
     st_method_set_temp_count   (method, tempcount);
+    st_method_set_stack_depth  (method, code.max_stack_depth);
     st_method_set_primitive_index (method, node->method.primitive);
 
     if (node->method.primitive >= 0) {
@@ -1396,6 +2511,8 @@ st_generate_method (st_oop class, st_node *node, st_compiler_error *error)
     ST_METHOD_BYTECODE (method) = create_bytecode_array (&code); 
     ST_METHOD_SELECTOR (method) = node->method.selector;
 
+    method = create_clean_blocks (gt, method);
+
     generator_destroy (gt);
     bytecode_destroy (&code);
 
@@ -1417,6 +2534,7 @@ print_bytecodes (st_oop literals, st_uchar *codes, int len)
 	"<%02x>       ",
 	"<%02x %02x>    ",
 	"<%02x %02x %02x> ",
+	"<%02x %02x %02x %02x> ",
     };
 
     ip = codes;
@@ -1523,8 +2641,32 @@ print_bytecodes (st_oop literals, st_uchar *codes, int len)
 	    NEXT (ip);
 
 	case BLOCK_COPY:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2], ip[3]);
+	    printf ("blockCopy: %i copied: %i depth: %i", ip[1], ip[2] & ~ST_BLOCK_COPY_HOME, ip[3]);
+
+	    NEXT (ip);
+
+	case PUSH_REMOTE_TEMP:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2]);
+	    printf ("pushRemoteTemp: %i inVector: %i", ip[1], ip[2]);
+
+	    NEXT (ip);
+
+	case STORE_REMOTE_TEMP:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2]);
+	    printf ("storeRemoteTemp: %i inVector: %i", ip[1], ip[2]);
+
+	    NEXT (ip);
+
+	case STORE_POP_REMOTE_TEMP:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2]);
+	    printf ("popIntoRemoteTemp: %i inVector: %i", ip[1], ip[2]);
+
+	    NEXT (ip);
+
+	case PUSH_NEW_ARRAY:
 	    printf (FORMAT (ip), ip[0], ip[1]);
-	    printf ("blockCopy: %i", ip[1]);
+	    printf ("pushNewArray: %i", ip[1]);
 
 	    NEXT (ip);
 
@@ -1624,6 +2766,8 @@ print_bytecodes (st_oop literals, st_uchar *codes, int len)
 	case SEND_CLASS:
 	case SEND_NEW:
 	case SEND_NEW_ARG:
+	case SEND_VALUE_ARG2:
+	case SEND_VALUE_ARG3:
 
 	    printf (FORMAT (ip), ip[0]);
 	    printf ("sendSpecial: #%s", st_byte_array_bytes (__machine.selectors[ip[0] - SEND_PLUS]));
@@ -1687,9 +2831,13 @@ st_print_method (st_oop method)
     st_uchar *bytecodes;
     int     size;
 
+    if (st_method_get_flags (method) == ST_METHOD_LAZY)
+	method = st_compile_lazy_method (method);
+
     printf ("flags: %i; ", st_method_get_flags (method));
     printf ("arg-count: %i; ", st_method_get_arg_count (method));
     printf ("temp-count: %i; ", st_method_get_temp_count (method));
+    printf ("stack-depth: %i; ", st_method_get_stack_depth (method));
     printf ("primitive: %i;\n", st_method_get_primitive_index (method));
     
     printf ("\n");
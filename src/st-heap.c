@@ -38,7 +38,14 @@ round_pagesize (st_uint size)
 st_heap *
 st_heap_new (st_uint reserved_size)
 {
-    /* Create a new heap with a reserved address space.
+    return st_heap_new_at (NULL, reserved_size);
+}
+
+st_heap *
+st_heap_new_at (st_pointer address, st_uint reserved_size)
+{
+    /* Create a new heap with a reserved address space, starting
+     * at the given address if it is free.
      * Returns NULL if address space could not be reserved
      */
     st_pointer result;
@@ -48,7 +55,7 @@ st_heap_new (st_uint reserved_size)
     st_assert (reserved_size > 0);
     size = round_pagesize (reserved_size);
 
-    result = st_system_reserve_memory (NULL, size);
+    result = st_system_reserve_memory (address, size);
     if (result == NULL)
 	return NULL;
 
@@ -86,6 +93,29 @@ st_heap_grow (st_heap *heap, st_uint grow_size)
     return true;
 }
 
+bool
+st_heap_map_file (st_heap *heap, int fd, off_t offset, st_uint size)
+{
+    /* Maps the specified part of a file at the end of the
+     * committed space, which grows by its size.
+     */
+    st_pointer result;
+
+    st_assert (size > 0);
+    size = round_pagesize (size);
+
+    if ((heap->p + size) >= heap->end)
+	return false;
+
+    result = st_system_map_file (heap->p, size, fd, offset);
+    if (result == NULL)
+	return false;
+
+    heap->p += size;
+
+    return true;
+}
+
 bool
 st_heap_shrink (st_heap *heap, st_uint shrink_size)
 {
@@ -26,6 +26,7 @@
 #define __ST_HEAP_H__
 
 #include <st-types.h>
+#include <sys/types.h>
 
 typedef struct st_heap
 {
@@ -37,8 +38,12 @@ typedef struct st_heap
 
 st_heap  *st_heap_new       (st_uint reserved_size);
 
+st_heap  *st_heap_new_at    (st_pointer address, st_uint reserved_size);
+
 bool      st_heap_grow      (st_heap *heap, st_uint grow_size);
 
+bool      st_heap_map_file  (st_heap *heap, int fd, off_t offset, st_uint size);
+
 bool      st_heap_shrink    (st_heap *heap, st_uint shrink_size);
 
 void      st_heap_destroy   (st_heap *heap);
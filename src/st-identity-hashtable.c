@@ -144,6 +144,22 @@ st_identity_hashtable_hash (st_identity_hashtable *ht, st_oop object)
     return ht->table[index].hash;
 }
 
+void
+st_identity_hashtable_set_hash (st_identity_hashtable *ht, st_oop object, st_uint hash)
+{
+    /* gives an object the hash it had in a previous session
+     */
+    st_uint index;
+
+    index = identity_hashtable_find (ht, object);
+    st_assert (ht->table[index].object == 0);
+
+    ht->size++;
+    ht->table[index].object = object;
+    ht->table[index].hash   = hash;
+    identity_hashtable_check_grow (ht);
+}
+
 void
 st_identity_hashtable_rehash_object (st_identity_hashtable *ht, st_oop old, st_oop new)
 {
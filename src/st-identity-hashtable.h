@@ -51,6 +51,10 @@ st_identity_hashtable *st_identity_hashtable_new           (void);
 
 void                   st_identity_hashtable_remove        (st_identity_hashtable *ht, st_oop object);
 
+void                   st_identity_hashtable_set_hash      (st_identity_hashtable *ht,
+							    st_oop object,
+							    st_uint hash);
+
 void                   st_identity_hashtable_rehash_object (st_identity_hashtable *ht,
 							    st_oop old,
 							    st_oop new);
@@ -0,0 +1,209 @@
+/*
+ * st-image.c
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+/*
+ * An image starts with a header, followed by the globals, the special
+ * selectors, the class table, the roots of the heap, and the identity
+ * hashes given out so far. The objects follow at a page boundary, just
+ * as they were in the heap, so that they can be mapped from the file with
+ * a single mmap(). Pages are then only read when they are first touched.
+ *
+ * The heap is mapped at the address it was written from if that is free,
+ * and otherwise every reference to an object is relocated.
+ */
+
+#include "st-image.h"
+#include "st-memory.h"
+#include "st-machine.h"
+#include "st-system.h"
+#include "st-universe.h"
+#include "st-utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE_MAGIC   "PANDAIMG"
+#define IMAGE_VERSION 1
+
+struct image_header {
+	char magic[8];
+	st_uint version;
+	st_uint oop_size;
+	st_uint compact_headers;
+	st_uint global_count;
+	st_uint selector_count;
+	st_uint class_count;
+	st_uint root_count;
+	st_uint hash_count;
+	st_uint next_hash;
+	st_oop heap_start;      /* address of the heap when written */
+	st_ulong heap_size;     /* in bytes */
+	st_ulong heap_offset;   /* in the file */
+};
+
+static void init_header(struct image_header *header) {
+	memset(header, 0, sizeof(struct image_header));
+	memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+	header->version = IMAGE_VERSION;
+	header->oop_size = sizeof(st_oop);
+#ifdef ST_HAVE_COMPACT_HEADERS
+	header->compact_headers = 1;
+#endif
+	header->global_count = ST_NUM_GLOBALS;
+	header->selector_count = ST_NUM_SELECTORS;
+}
+
+bool st_image_save(const char *filename) {
+	struct image_header header;
+	struct cell *cell;
+	st_ulong size;
+	st_uint page_size;
+	st_oop root;
+	FILE *file;
+	bool written;
+
+	/* leaves the objects with no gaps between them, and discards threaded
+	   code, which is referred to by methods. Before the machine has run,
+	   there is neither threaded code nor garbage */
+	if (__machine.context != 0) {
+		st_memory_perform_gc();
+		st_machine_flush_code(&__machine);
+	}
+
+	file = fopen(filename, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "panda: error: could not open `%s'\n", filename);
+		return false;
+	}
+
+	init_header(&header);
+	header.class_count = __machine.class_count;
+	header.root_count = memory->roots->length;
+	header.hash_count = memory->ht->size;
+	header.next_hash = memory->ht->current_hash;
+	header.heap_start = (st_oop) memory->start;
+	header.heap_size = (memory->p - memory->start) * sizeof(st_oop);
+
+	size = sizeof(header) + sizeof(__machine.globals) + sizeof(__machine.selectors)
+	       + (header.class_count + header.root_count) * sizeof(st_oop)
+	       + header.hash_count * sizeof(struct cell);
+	page_size = st_system_pagesize();
+	header.heap_offset = (size + page_size - 1) / page_size * page_size;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(__machine.globals, sizeof(__machine.globals), 1, file);
+	fwrite(__machine.selectors, sizeof(__machine.selectors), 1, file);
+	fwrite(__machine.classes, sizeof(st_oop), header.class_count, file);
+	for (st_uint i = 0; i < header.root_count; i++) {
+		root = (st_oop) ptr_array_get_index(memory->roots, i);
+		fwrite(&root, sizeof(st_oop), 1, file);
+	}
+	for (st_uint i = 0; i < memory->ht->alloc; i++) {
+		cell = &memory->ht->table[i];
+		if (cell->object != 0 && cell->object != (st_oop) memory->ht)
+			fwrite(cell, sizeof(struct cell), 1, file);
+	}
+
+	fseek(file, header.heap_offset, SEEK_SET);
+	fwrite(memory->start, 1, header.heap_size, file);
+
+	written = !ferror(file);
+	if (fclose(file) != 0)
+		written = false;
+	if (!written)
+		fprintf(stderr, "panda: error: could not write `%s'\n", filename);
+
+	if (__machine.context != 0 && __machine.context != ST_NIL)
+		__machine.code = st_machine_method_code(&__machine, __machine.method);
+
+	return written;
+}
+
+bool st_image_load(const char *filename) {
+	struct image_header header, expected;
+	struct cell *hashes = NULL;
+	st_oop *roots = NULL;
+	st_oop delta;
+	FILE *file;
+	bool loaded = false;
+
+	file = fopen(filename, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "panda: error: could not open `%s'\n", filename);
+		return false;
+	}
+
+	init_header(&expected);
+	if (fread(&header, sizeof(header), 1, file) != 1
+	    || memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+	    || header.version != expected.version
+	    || header.oop_size != expected.oop_size
+	    || header.compact_headers != expected.compact_headers
+	    || header.global_count != expected.global_count
+	    || header.selector_count != expected.selector_count
+	    || header.heap_offset % st_system_pagesize() != 0) {
+		fprintf(stderr, "panda: error: `%s' is not an image of this version of panda\n", filename);
+		goto out;
+	}
+
+	__machine.class_capacity = MAX (header.class_count, 1);
+	__machine.class_count = header.class_count;
+	__machine.classes = st_malloc(__machine.class_capacity * sizeof(st_oop));
+	roots = st_malloc(MAX (header.root_count, 1) * sizeof(st_oop));
+	hashes = st_malloc(MAX (header.hash_count, 1) * sizeof(struct cell));
+
+	if (fread(__machine.globals, sizeof(__machine.globals), 1, file) != 1
+	    || fread(__machine.selectors, sizeof(__machine.selectors), 1, file) != 1
+	    || fread(__machine.classes, sizeof(st_oop), header.class_count, file) != header.class_count
+	    || fread(roots, sizeof(st_oop), header.root_count, file) != header.root_count
+	    || fread(hashes, sizeof(struct cell), header.hash_count, file) != header.hash_count) {
+		fprintf(stderr, "panda: error: could not read `%s'\n", filename);
+		goto out;
+	}
+
+	if (st_memory_new_mapped((st_pointer) header.heap_start, fileno(file),
+	                         header.heap_offset, header.heap_size) == NULL) {
+		fprintf(stderr, "panda: error: could not map `%s'\n", filename);
+		goto out;
+	}
+
+	for (st_uint i = 0; i < header.root_count; i++)
+		st_memory_add_root(roots[i]);
+	st_memory_relocate((st_oop *) header.heap_start);
+
+	/* the identity hash table is keyed by address */
+	delta = (st_oop) memory->start - header.heap_start;
+	for (st_uint i = 0; i < header.hash_count; i++)
+		st_identity_hashtable_set_hash(memory->ht, hashes[i].object + delta, hashes[i].hash);
+	memory->ht->current_hash = header.next_hash;
+
+	loaded = true;
+
+out:
+	st_free(roots);
+	st_free(hashes);
+	fclose(file);
+
+	return loaded;
+}
@@ -0,0 +1,42 @@
+/*
+ * st-image.h
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_IMAGE_H__
+#define __ST_IMAGE_H__
+
+#include <st-types.h>
+
+/*
+ * An image holds the objects of the heap and the roots into it, so that
+ * the system can start from them instead of compiling the kernel from
+ * st/. It is written by "panda --save-image FILE" or by
+ * ObjectMemory class>>snapshot:, and read by "panda --image FILE".
+ *
+ * Images are only read by the build of panda that wrote them, since
+ * methods refer to primitives by their index in st_primitives.
+ */
+bool st_image_save(const char *filename);
+bool st_image_load(const char *filename);
+
+#endif /* __ST_IMAGE_H__ */
@@ -0,0 +1,869 @@
+/*
+ * st-jit.c
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+/*
+ * A compiler from threaded code to x86-64 machine code, in two tiers.
+ *
+ * Each instruction with a template is compiled in place, with the
+ * operands the threaded code has already resolved. Every other instruction
+ * compiles to an exit back into the interpreter, which goes on with that
+ * instruction. Sends, returns and anything that may allocate are left to
+ * the interpreter, so native code never triggers a gc. Native code loads
+ * literals from the threaded code, and guarded classes from a table of its
+ * own, which the gc updates, so it keeps working after objects move.
+ *
+ * The first tier records the receiver classes seen at sends. The second
+ * tier inlines sends that only ever saw one class, when the method found
+ * is trivial (an accessor, or answering self or a constant), or when the
+ * receiver is an Array sent #at:, #at:put: or #size. A class guard
+ * precedes the inlined code; when it fails, the send is left to the
+ * interpreter, on the same frame.
+ */
+
+#include "st-jit.h"
+#include "st-compiler.h"
+#include "st-universe.h"
+#include "st-method.h"
+#include "st-object.h"
+#include "st-association.h"
+#include "st-array.h"
+#include "st-behavior.h"
+#include "st-memory.h"
+#include "st-system.h"
+#include "st-utils.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* answers the number of arguments of a send the first tier profiles, or -1 */
+static int profiled_argcount(const st_oop *operands, st_uchar opcode) {
+	switch (opcode) {
+	case SEND:
+		return operands[1];
+	case SEND_SIZE:
+	case SEND_VALUE:
+		return 0;
+	case SEND_AT:
+	case SEND_VALUE_ARG:
+		return 1;
+	case SEND_AT_PUT:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Installs native code in the threaded code of a method. Instructions with
+ * an entry point enter the native code, and unless the code is optimized
+ * already, sends record the classes of their receivers.
+ */
+void st_jit_install(st_machine *machine, st_threaded_code *threaded, st_jit_code *jit) {
+	const st_uchar *bytecode;
+	st_uint size;
+	int argcount;
+
+	bytecode = st_method_bytecode_bytes(threaded->method);
+	size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (threaded->method)));
+
+	jit->handlers = st_malloc0(size * sizeof(st_pointer));
+	if (!jit->optimized)
+		jit->sites = st_malloc0(size * sizeof(st_jit_site));
+
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		jit->handlers[i] = (st_pointer) threaded->code[i];
+		argcount = profiled_argcount(threaded->code + i, bytecode[i]);
+		if (jit->entries[i] != NULL) {
+			threaded->code[i] = (st_oop) machine->labels[HANDLER_JIT_ENTRY];
+		} else if (jit->sites != NULL && argcount >= 0) {
+			jit->sites[i].argcount = argcount;
+			jit->sites[i].handler = jit->handlers[i];
+			jit->handlers[i] = machine->labels[HANDLER_PROFILE_SEND];
+			threaded->code[i] = (st_oop) machine->labels[HANDLER_PROFILE_SEND];
+		}
+	}
+	threaded->jit = jit;
+}
+
+void st_jit_free(st_jit_code *jit) {
+	if (jit->memory != NULL)
+		st_system_release_memory(jit->memory, jit->size);
+	st_free(jit->entries);
+	st_free(jit->handlers);
+	st_free(jit->sites);
+	st_free(jit->guards);
+	st_free(jit);
+}
+
+/*
+ * Brings the classes native code refers to up to date after a gc has
+ * moved them. A class that was collected no longer matches any receiver.
+ */
+void st_jit_remap(st_jit_code *jit, st_uint size) {
+	for (st_uint i = 0; i < size; i++) {
+		if (jit->sites != NULL && jit->sites[i].class != 0) {
+			if (st_memory_is_live(jit->sites[i].class))
+				jit->sites[i].class = st_memory_remap_reference(jit->sites[i].class);
+			else
+				jit->sites[i].class = 0;
+		}
+		if (jit->guards != NULL && jit->guards[i] != 0) {
+			if (st_memory_is_live(jit->guards[i]))
+				jit->guards[i] = st_memory_remap_reference(jit->guards[i]);
+			else
+				jit->guards[i] = 0;
+		}
+	}
+}
+
+#ifdef ST_HAVE_JIT
+
+/* a native run shorter than this costs more to enter than it saves */
+#define MIN_RUN_LENGTH 3
+
+#define FIELDS_OFFSET ((int) offsetof(struct st_header, fields) - ST_POINTER_TAG)
+#define VALUE_OFFSET  ((int) offsetof(struct st_association, value) - ST_POINTER_TAG)
+#ifdef ST_HAVE_COMPACT_HEADERS
+#define CLASS_INDEX_OFFSET ((int) offsetof(struct st_header, mark) + ST_CLASS_INDEX_SHIFT / 8 - ST_POINTER_TAG)
+#else
+#define CLASS_OFFSET  ((int) offsetof(struct st_header, class) - ST_POINTER_TAG)
+#endif
+#define SIZE_OFFSET   ((int) offsetof(struct st_arrayed_object, size) - ST_POINTER_TAG)
+#define ELEMENTS_OFFSET ((int) offsetof(struct st_array, elements) - ST_POINTER_TAG)
+
+/* tag bits that tell heap pointers from immediate Floats */
+#ifdef ST_HAVE_IMMEDIATE_FLOATS
+#define POINTER_TAG_MASK ((1 << ST_FLOAT_TAG_SIZE) - 1)
+#else
+#define POINTER_TAG_MASK ((1 << ST_TAG_SIZE) - 1)
+#endif
+
+/* While native code runs, rdi holds the machine, rsi the stack pointer,
+   r8 the temporaries and r9 the receiver */
+enum {
+	RAX = 0,
+	RCX = 1,
+	RDX = 2,
+	RSI = 6,
+	RDI = 7,
+	R8 = 8,
+	R9 = 9,
+	R10 = 10,
+};
+
+enum {
+	OP_ADD = 0x01,
+	OP_OR = 0x09,
+	OP_AND = 0x21,
+	OP_SUB = 0x29,
+	OP_XOR = 0x31,
+	OP_CMP = 0x39,
+	OP_MOV = 0x89,
+};
+
+enum {
+	CC_O = 0x0,
+	CC_E = 0x4,
+	CC_NE = 0x5,
+	CC_L = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G = 0xF,
+	CC_ALWAYS = -1,
+};
+
+typedef struct st_fixup {
+	st_uint position;   /* of a rel32 operand */
+	st_uint index;      /* of the instruction jumped to */
+	bool bailout;       /* jumps to the exit of the instruction rather than its code */
+} st_fixup;
+
+typedef struct st_assembler {
+	st_machine *machine;
+	st_threaded_code *threaded;
+	st_jit_site *profile;  /* receiver classes seen by the first tier, when optimizing */
+	st_oop *guards;        /* class guarded at each instruction */
+
+	st_uchar *buffer;
+	st_uint size;
+	st_uint capacity;
+
+	st_uint *offsets;     /* code of each instruction */
+	st_uint *bailouts;    /* exit of each instruction back to the interpreter */
+	bool *needs_bailout;
+
+	st_fixup *fixups;
+	st_uint fixup_count;
+	st_uint fixup_capacity;
+} st_assembler;
+
+static void emit_byte(st_assembler *as, st_uchar byte) {
+	if (as->size == as->capacity) {
+		as->capacity *= 2;
+		as->buffer = st_realloc(as->buffer, as->capacity);
+	}
+	as->buffer[as->size++] = byte;
+}
+
+static void emit_int32(st_assembler *as, int32_t value) {
+	for (int i = 0; i < 4; i++)
+		emit_byte(as, ((uint32_t) value >> (i * 8)) & 0xFF);
+}
+
+static void emit_int64(st_assembler *as, uint64_t value) {
+	for (int i = 0; i < 8; i++)
+		emit_byte(as, (value >> (i * 8)) & 0xFF);
+}
+
+/* reg = [base + disp] */
+static void emit_load(st_assembler *as, int reg, int base, int32_t disp) {
+	emit_byte(as, 0x48 | ((reg >> 3) << 2) | (base >> 3));
+	emit_byte(as, 0x8B);
+	emit_byte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+	emit_int32(as, disp);
+}
+
+/* [base + disp] = reg */
+static void emit_store(st_assembler *as, int base, int32_t disp, int reg) {
+	emit_byte(as, 0x48 | ((reg >> 3) << 2) | (base >> 3));
+	emit_byte(as, 0x89);
+	emit_byte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+	emit_int32(as, disp);
+}
+
+/* dst = dst op src */
+static void emit_alu(st_assembler *as, st_uchar op, int dst, int src) {
+	emit_byte(as, 0x48 | ((src >> 3) << 2) | (dst >> 3));
+	emit_byte(as, op);
+	emit_byte(as, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void emit_move_immediate(st_assembler *as, int reg, uint64_t value) {
+	emit_byte(as, 0x48 | (reg >> 3));
+	emit_byte(as, 0xB8 | (reg & 7));
+	emit_int64(as, value);
+}
+
+static void emit_load_global(st_assembler *as, int reg, const st_oop *global) {
+	emit_move_immediate(as, reg, (uintptr_t) global);
+	emit_load(as, reg, reg, 0);
+}
+
+static void emit_adjust_sp(st_assembler *as, int8_t delta) {
+	emit_byte(as, 0x48);
+	emit_byte(as, 0x83);
+	emit_byte(as, 0xC6);
+	emit_byte(as, (st_uchar) delta);
+}
+
+static void emit_push(st_assembler *as, int reg) {
+	emit_store(as, RSI, 0, reg);
+	emit_adjust_sp(as, sizeof(st_oop));
+}
+
+static void emit_jump(st_assembler *as, int cc, st_uint index, bool bailout) {
+	if (cc == CC_ALWAYS) {
+		emit_byte(as, 0xE9);
+	} else {
+		emit_byte(as, 0x0F);
+		emit_byte(as, 0x80 | cc);
+	}
+
+	if (as->fixup_count == as->fixup_capacity) {
+		as->fixup_capacity *= 2;
+		as->fixups = st_realloc(as->fixups, as->fixup_capacity * sizeof(st_fixup));
+	}
+	as->fixups[as->fixup_count].position = as->size;
+	as->fixups[as->fixup_count].index = index;
+	as->fixups[as->fixup_count].bailout = bailout;
+	as->fixup_count++;
+
+	if (bailout)
+		as->needs_bailout[index] = true;
+
+	emit_int32(as, 0);
+}
+
+/* leave the instruction at index to the interpreter */
+static void emit_exit(st_assembler *as, st_uint index) {
+	/* mov dword [rdi + ip], index */
+	emit_byte(as, 0xC7);
+	emit_byte(as, 0x87);
+	emit_int32(as, offsetof(st_machine, ip));
+	emit_int32(as, index);
+
+	emit_alu(as, OP_MOV, RAX, RSI);
+	emit_byte(as, 0xC3);
+}
+
+/* loads the receiver and argument into rax and rcx, if both are SmallIntegers */
+static void emit_smi_operands(st_assembler *as, st_uint index) {
+	emit_load(as, RAX, RSI, -2 * (int) sizeof(st_oop));
+	emit_load(as, RCX, RSI, -1 * (int) sizeof(st_oop));
+	emit_alu(as, OP_MOV, RDX, RAX);
+	emit_alu(as, OP_OR, RDX, RCX);
+
+	/* test dl, tag mask */
+	emit_byte(as, 0xF6);
+	emit_byte(as, 0xC2);
+	emit_byte(as, (1 << ST_TAG_SIZE) - 1);
+	emit_jump(as, CC_NE, index, true);
+}
+
+/* SmallIntegers take the whole word, so a tagged result overflows exactly when it is out of range */
+static void emit_smi_range_check(st_assembler *as, st_uint index) {
+	emit_jump(as, CC_O, index, true);
+}
+
+/* replaces the receiver and argument with rax */
+static void emit_result(st_assembler *as) {
+	emit_store(as, RSI, -2 * (int) sizeof(st_oop), RAX);
+	emit_adjust_sp(as, -(int) sizeof(st_oop));
+}
+
+/* answers true or false for the flags of a comparison */
+static void emit_boolean_result(st_assembler *as, int cc) {
+	emit_load_global(as, RAX, &ST_FALSE);
+	emit_load_global(as, RDX, &ST_TRUE);
+
+	/* cmovcc rax, rdx */
+	emit_byte(as, 0x48);
+	emit_byte(as, 0x0F);
+	emit_byte(as, 0x40 | cc);
+	emit_byte(as, 0xC2);
+
+	emit_result(as);
+}
+
+static void emit_smi_comparison(st_assembler *as, st_uint index, int cc) {
+	emit_smi_operands(as, index);
+	emit_alu(as, OP_CMP, RAX, RCX);
+	emit_boolean_result(as, cc);
+}
+
+static void emit_conditional_jump(st_assembler *as, st_uint index, st_uint target, bool when) {
+	st_uint skip;
+
+	emit_load(as, RAX, RSI, -1 * (int) sizeof(st_oop));
+	emit_load_global(as, RCX, when ? &ST_TRUE : &ST_FALSE);
+	emit_alu(as, OP_CMP, RAX, RCX);
+
+	/* jne over the taken branch */
+	emit_byte(as, 0x75);
+	emit_byte(as, 0);
+	skip = as->size;
+	emit_adjust_sp(as, -(int) sizeof(st_oop));
+	emit_jump(as, CC_ALWAYS, target, false);
+	as->buffer[skip - 1] = as->size - skip;
+
+	/* anything but a boolean is left to the interpreter */
+	emit_load_global(as, RCX, when ? &ST_FALSE : &ST_TRUE);
+	emit_alu(as, OP_CMP, RAX, RCX);
+	emit_jump(as, CC_NE, index, true);
+	emit_adjust_sp(as, -(int) sizeof(st_oop));
+}
+
+/* backward jumps of the first tier count towards optimizing the method */
+static void emit_backward_jump(st_assembler *as, st_uint index, st_uint target) {
+	emit_move_immediate(as, R10, (uintptr_t) &as->threaded->activations);
+
+	/* cmp dword [r10], threshold - 1 */
+	emit_byte(as, 0x41);
+	emit_byte(as, 0x81);
+	emit_byte(as, 0x3A);
+	emit_int32(as, ST_JIT_OPTIMIZE_THRESHOLD - 1);
+	emit_jump(as, CC_E, index, true);
+
+	/* add dword [r10], 1 */
+	emit_byte(as, 0x41);
+	emit_byte(as, 0x83);
+	emit_byte(as, 0x02);
+	emit_byte(as, 0x01);
+	emit_jump(as, CC_ALWAYS, target, false);
+}
+
+/* leaves the instruction at index to the interpreter unless reg is an instance of class */
+static void emit_class_guard(st_assembler *as, int reg, st_oop class, st_uint index) {
+	/* mov edx, reg; and edx, tag mask */
+	emit_byte(as, 0x89);
+	emit_byte(as, 0xC0 | (reg << 3) | RDX);
+	emit_byte(as, 0x83);
+	emit_byte(as, 0xE2);
+	if (class == ST_SMI_CLASS || class == ST_CHARACTER_CLASS)
+		emit_byte(as, (1 << ST_TAG_SIZE) - 1);
+	else
+		emit_byte(as, POINTER_TAG_MASK);
+
+	/* cmp edx, tag */
+	emit_byte(as, 0x83);
+	emit_byte(as, 0xFA);
+	if (class == ST_SMI_CLASS)
+		emit_byte(as, ST_SMI_TAG);
+	else if (class == ST_CHARACTER_CLASS)
+		emit_byte(as, ST_CHARACTER_TAG);
+	else
+		emit_byte(as, ST_POINTER_TAG);
+	emit_jump(as, CC_NE, index, true);
+
+	if (class == ST_SMI_CLASS || class == ST_CHARACTER_CLASS)
+		return;
+
+#ifdef ST_HAVE_COMPACT_HEADERS
+	/* cmp dword [reg + class index], index of class */
+	if (reg >> 3)
+		emit_byte(as, 0x41);
+	emit_byte(as, 0x81);
+	emit_byte(as, 0x80 | (7 << 3) | (reg & 7));
+	emit_int32(as, CLASS_INDEX_OFFSET);
+	emit_int32(as, st_behavior_index(class));
+#else
+	as->guards[index] = class;
+	emit_load(as, RDX, reg, CLASS_OFFSET);
+	emit_load_global(as, R10, as->guards + index);
+	emit_alu(as, OP_CMP, RDX, R10);
+#endif
+	emit_jump(as, CC_NE, index, true);
+}
+
+/* checks the Array in rax and the index in rcx */
+static void emit_array_index(st_assembler *as, st_uint index) {
+	emit_class_guard(as, RAX, ST_ARRAY_CLASS, index);
+
+	/* test cl, tag mask */
+	emit_byte(as, 0xF6);
+	emit_byte(as, 0xC1);
+	emit_byte(as, (1 << ST_TAG_SIZE) - 1);
+	emit_jump(as, CC_NE, index, true);
+
+	/* cmp rcx, 1 */
+	emit_byte(as, 0x48);
+	emit_byte(as, 0x81);
+	emit_byte(as, 0xF9);
+	emit_int32(as, st_smi_new(1));
+	emit_jump(as, CC_L, index, true);
+
+	emit_load(as, RDX, RAX, SIZE_OFFSET);
+	emit_alu(as, OP_CMP, RCX, RDX);
+	emit_jump(as, CC_G, index, true);
+}
+
+/* rax = [rax + rcx / 4 * 8 - 8 + elements], or the reverse with rdx */
+static void emit_array_element(st_assembler *as, bool store) {
+	emit_byte(as, 0x48);
+	emit_byte(as, store ? 0x89 : 0x8B);
+	emit_byte(as, store ? 0x94 : 0x84);
+	emit_byte(as, 0x48);
+	emit_int32(as, ELEMENTS_OFFSET - (int) sizeof(st_oop));
+}
+
+/*
+ * Emits a send whose receiver was always of the same class, when the
+ * method it finds is simple enough to be inlined.
+ */
+static bool emit_inlined_send(st_assembler *as, const st_oop *operands, st_uint index, st_uchar opcode) {
+	st_oop class, method, selector;
+	const st_uchar *bytecode;
+	st_uint argcount, size;
+	int receiver;
+
+	/* Floats can be immediates or boxed, which a single guard can't tell */
+	class = as->profile[index].class;
+	if (class == 0 || class == ST_NIL || class == ST_FLOAT_CLASS)
+		return false;
+
+	switch (opcode) {
+	case SEND_SIZE:
+		if (class != ST_ARRAY_CLASS)
+			return false;
+		emit_load(as, RAX, RSI, -1 * (int) sizeof(st_oop));
+		emit_class_guard(as, RAX, class, index);
+		emit_load(as, RAX, RAX, SIZE_OFFSET);
+		emit_store(as, RSI, -1 * (int) sizeof(st_oop), RAX);
+		return true;
+	case SEND_AT:
+		if (class != ST_ARRAY_CLASS)
+			return false;
+		emit_load(as, RAX, RSI, -2 * (int) sizeof(st_oop));
+		emit_load(as, RCX, RSI, -1 * (int) sizeof(st_oop));
+		emit_array_index(as, index);
+		emit_array_element(as, false);
+		emit_result(as);
+		return true;
+	case SEND_AT_PUT:
+		if (class != ST_ARRAY_CLASS)
+			return false;
+		emit_load(as, RAX, RSI, -3 * (int) sizeof(st_oop));
+		emit_load(as, RCX, RSI, -2 * (int) sizeof(st_oop));
+		emit_array_index(as, index);
+		emit_load(as, RDX, RSI, -1 * (int) sizeof(st_oop));
+		emit_array_element(as, true);
+		emit_store(as, RSI, -3 * (int) sizeof(st_oop), RDX);
+		emit_adjust_sp(as, -2 * (int) sizeof(st_oop));
+		return true;
+	case SEND:
+		argcount = operands[1];
+		selector = operands[2];
+		break;
+	case SEND_VALUE:
+		argcount = 0;
+		selector = ST_SELECTOR_VALUE;
+		break;
+	case SEND_VALUE_ARG:
+		argcount = 1;
+		selector = ST_SELECTOR_VALUE_ARG;
+		break;
+	default:
+		return false;
+	}
+
+	method = st_machine_find_method(as->machine, class, selector);
+	if (method == ST_NIL || st_method_get_flags(method) != ST_METHOD_NORMAL
+	    || ST_METHOD_BYTECODE (method) == ST_NIL)
+		return false;
+
+	bytecode = st_method_bytecode_bytes(method);
+	size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (method)));
+	receiver = -(int) (argcount + 1) * (int) sizeof(st_oop);
+
+	/* ^ instVar */
+	if (argcount == 0 && size >= 3 && bytecode[0] == PUSH_INSTVAR && bytecode[2] == RETURN_STACK_TOP
+	    && st_smi_value(ST_BEHAVIOR_FORMAT (class)) == ST_FORMAT_OBJECT) {
+		emit_load(as, RAX, RSI, receiver);
+		emit_class_guard(as, RAX, class, index);
+		emit_load(as, RAX, RAX, FIELDS_OFFSET + bytecode[1] * sizeof(st_oop));
+		emit_store(as, RSI, receiver, RAX);
+		return true;
+	}
+
+	/* instVar := argument */
+	if (argcount == 1 && size >= 6 && bytecode[0] == PUSH_TEMP && bytecode[1] == 0
+	    && bytecode[2] == STORE_POP_INSTVAR && bytecode[4] == PUSH_SELF && bytecode[5] == RETURN_STACK_TOP
+	    && st_smi_value(ST_BEHAVIOR_FORMAT (class)) == ST_FORMAT_OBJECT) {
+		emit_load(as, RAX, RSI, receiver);
+		emit_class_guard(as, RAX, class, index);
+		emit_load(as, RDX, RSI, -1 * (int) sizeof(st_oop));
+		emit_store(as, RAX, FIELDS_OFFSET + bytecode[3] * sizeof(st_oop), RDX);
+		emit_adjust_sp(as, -(int) sizeof(st_oop));
+		return true;
+	}
+
+	/* ^ self, ^ nil, ^ true, ^ false */
+	if (size >= 2 && bytecode[1] == RETURN_STACK_TOP
+	    && (bytecode[0] == PUSH_SELF || bytecode[0] == PUSH_NIL
+	        || bytecode[0] == PUSH_TRUE || bytecode[0] == PUSH_FALSE)) {
+		emit_load(as, RAX, RSI, receiver);
+		emit_class_guard(as, RAX, class, index);
+		if (bytecode[0] != PUSH_SELF) {
+			emit_load_global(as, RAX, bytecode[0] == PUSH_NIL ? &ST_NIL
+			                          : bytecode[0] == PUSH_TRUE ? &ST_TRUE : &ST_FALSE);
+			emit_store(as, RSI, receiver, RAX);
+		}
+		if (argcount > 0)
+			emit_adjust_sp(as, -(int) (argcount * sizeof(st_oop)));
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Emits the template for the instruction at index, if it has one.
+ */
+static bool emit_instruction(st_assembler *as, const st_oop *code, st_uint index, st_uchar opcode) {
+	const st_oop *operands = code + index;
+
+	switch (opcode) {
+	case PUSH_TEMP:
+		emit_load(as, RAX, R8, operands[1] * sizeof(st_oop));
+		emit_push(as, RAX);
+		return true;
+	case PUSH_INSTVAR:
+		emit_load(as, RAX, R9, FIELDS_OFFSET + operands[1] * sizeof(st_oop));
+		emit_push(as, RAX);
+		return true;
+	case STORE_TEMP:
+	case STORE_POP_TEMP:
+		emit_load(as, RAX, RSI, -1 * (int) sizeof(st_oop));
+		emit_store(as, R8, operands[1] * sizeof(st_oop), RAX);
+		if (opcode == STORE_POP_TEMP)
+			emit_adjust_sp(as, -(int) sizeof(st_oop));
+		return true;
+	case STORE_INSTVAR:
+	case STORE_POP_INSTVAR:
+		emit_load(as, RAX, RSI, -1 * (int) sizeof(st_oop));
+		emit_store(as, R9, FIELDS_OFFSET + operands[1] * sizeof(st_oop), RAX);
+		if (opcode == STORE_POP_INSTVAR)
+			emit_adjust_sp(as, -(int) sizeof(st_oop));
+		return true;
+	case PUSH_SELF:
+		emit_push(as, R9);
+		return true;
+	case PUSH_NIL:
+		emit_load_global(as, RAX, &ST_NIL);
+		emit_push(as, RAX);
+		return true;
+	case PUSH_TRUE:
+		emit_load_global(as, RAX, &ST_TRUE);
+		emit_push(as, RAX);
+		return true;
+	case PUSH_FALSE:
+		emit_load_global(as, RAX, &ST_FALSE);
+		emit_push(as, RAX);
+		return true;
+	case PUSH_INTEGER:
+		emit_move_immediate(as, RAX, operands[1]);
+		emit_push(as, RAX);
+		return true;
+	case PUSH_LITERAL_CONST:
+		emit_load_global(as, RAX, operands + 1);
+		emit_push(as, RAX);
+		return true;
+	case PUSH_LITERAL_VAR:
+		emit_load_global(as, RAX, operands + 1);
+		emit_load(as, RAX, RAX, VALUE_OFFSET);
+		emit_push(as, RAX);
+		return true;
+	case STORE_LITERAL_VAR:
+	case STORE_POP_LITERAL_VAR:
+		emit_load_global(as, RCX, operands + 1);
+		emit_load(as, RAX, RSI, -1 * (int) sizeof(st_oop));
+		emit_store(as, RCX, VALUE_OFFSET, RAX);
+		if (opcode == STORE_POP_LITERAL_VAR)
+			emit_adjust_sp(as, -(int) sizeof(st_oop));
+		return true;
+	case POP_STACK_TOP:
+		emit_adjust_sp(as, -(int) sizeof(st_oop));
+		return true;
+	case DUPLICATE_STACK_TOP:
+		emit_load(as, RAX, RSI, -1 * (int) sizeof(st_oop));
+		emit_push(as, RAX);
+		return true;
+	case JUMP:
+		if (as->profile == NULL && (const st_oop *) operands[1] < operands)
+			emit_backward_jump(as, index, (const st_oop *) operands[1] - code);
+		else
+			emit_jump(as, CC_ALWAYS, (const st_oop *) operands[1] - code, false);
+		return true;
+	case JUMP_TRUE:
+	case JUMP_FALSE:
+		emit_conditional_jump(as, index, (const st_oop *) operands[1] - code, opcode == JUMP_TRUE);
+		return true;
+	case SEND_PLUS:
+	case SEND_MINUS:
+		emit_smi_operands(as, index);
+		emit_alu(as, opcode == SEND_PLUS ? OP_ADD : OP_SUB, RAX, RCX);
+		emit_smi_range_check(as, index);
+		emit_result(as);
+		return true;
+	case SEND_MUL:
+		emit_smi_operands(as, index);
+		/* sar rax, tag size; imul rax, rcx */
+		emit_byte(as, 0x48);
+		emit_byte(as, 0xC1);
+		emit_byte(as, 0xF8);
+		emit_byte(as, ST_TAG_SIZE);
+		emit_byte(as, 0x48);
+		emit_byte(as, 0x0F);
+		emit_byte(as, 0xAF);
+		emit_byte(as, 0xC1);
+		emit_smi_range_check(as, index);
+		emit_result(as);
+		return true;
+	case SEND_BITAND:
+	case SEND_BITOR:
+	case SEND_BITXOR:
+		/* the tags of SmallIntegers are zero, and stay so */
+		emit_smi_operands(as, index);
+		emit_alu(as, opcode == SEND_BITAND ? OP_AND : opcode == SEND_BITOR ? OP_OR : OP_XOR, RAX, RCX);
+		emit_result(as);
+		return true;
+	case SEND_LT:
+		emit_smi_comparison(as, index, CC_L);
+		return true;
+	case SEND_GT:
+		emit_smi_comparison(as, index, CC_G);
+		return true;
+	case SEND_LE:
+		emit_smi_comparison(as, index, CC_LE);
+		return true;
+	case SEND_GE:
+		emit_smi_comparison(as, index, CC_GE);
+		return true;
+	case SEND_EQ:
+		emit_smi_comparison(as, index, CC_E);
+		return true;
+	case SEND_NE:
+		emit_smi_comparison(as, index, CC_NE);
+		return true;
+	case SEND_IDENTITY_EQ:
+		emit_load(as, RAX, RSI, -2 * (int) sizeof(st_oop));
+		emit_load(as, RCX, RSI, -1 * (int) sizeof(st_oop));
+		emit_alu(as, OP_CMP, RAX, RCX);
+		emit_boolean_result(as, CC_E);
+		return true;
+	case SEND:
+	case SEND_SIZE:
+	case SEND_AT:
+	case SEND_AT_PUT:
+	case SEND_VALUE:
+	case SEND_VALUE_ARG:
+		return as->profile != NULL && emit_inlined_send(as, operands, index, opcode);
+	default:
+		return false;
+	}
+}
+
+/* the handler of an instruction in the threaded code before it was compiled */
+static st_pointer original_handler(st_jit_code *jit, st_uint index) {
+	if (jit->sites != NULL && jit->sites[index].handler != NULL)
+		return jit->sites[index].handler;
+	return jit->handlers[index];
+}
+
+/*
+ * Compiles a method, or compiles it again with the classes its
+ * sends have seen if it has been compiled already.
+ */
+void st_jit_compile(st_machine *machine, st_threaded_code *threaded) {
+	st_assembler as;
+	st_jit_code *jit, *previous;
+	const st_uchar *bytecode;
+	st_uint *entries;
+	st_uint *runs;
+	bool *native;
+	st_uint size, length, run, target;
+
+	previous = threaded->jit;
+	if (machine->labels == NULL || ST_METHOD_BYTECODE (threaded->method) == ST_NIL
+	    || (previous != NULL && previous->optimized))
+		return;
+
+	bytecode = st_method_bytecode_bytes(threaded->method);
+	size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (threaded->method)));
+
+	if (previous != NULL) {
+		for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i]))
+			threaded->code[i] = (st_oop) original_handler(previous, i);
+		threaded->jit = NULL;
+	}
+
+	as.machine = machine;
+	as.threaded = threaded;
+	as.profile = previous != NULL ? previous->sites : NULL;
+	as.guards = st_malloc0(size * sizeof(st_oop));
+	as.capacity = 256;
+	as.size = 0;
+	as.buffer = st_malloc(as.capacity);
+	as.fixup_capacity = 32;
+	as.fixup_count = 0;
+	as.fixups = st_malloc(as.fixup_capacity * sizeof(st_fixup));
+	as.offsets = st_malloc0(size * sizeof(st_uint));
+	as.bailouts = st_malloc0(size * sizeof(st_uint));
+	as.needs_bailout = st_malloc0(size * sizeof(bool));
+	entries = st_malloc0(size * sizeof(st_uint));
+	runs = st_malloc0(size * sizeof(st_uint));
+	native = st_malloc0(size * sizeof(bool));
+
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		as.offsets[i] = as.size;
+		native[i] = emit_instruction(&as, threaded->code, i, bytecode[i]);
+		if (!native[i])
+			emit_exit(&as, i);
+	}
+
+	for (st_uint i = 0; i < size; i++) {
+		if (as.needs_bailout[i]) {
+			as.bailouts[i] = as.size;
+			emit_exit(&as, i);
+		}
+	}
+
+	/* the length of the native run from each instruction on */
+	length = 0;
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i]))
+		entries[length++] = i;
+	run = 0;
+	while (length-- > 0) {
+		st_uint i = entries[length];
+		run = native[i] ? run + 1 : 0;
+		runs[i] = run;
+	}
+
+	/* entry points load the registers that native code keeps */
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		entries[i] = 0;
+		if (!native[i] || runs[i] < MIN_RUN_LENGTH)
+			continue;
+		entries[i] = as.size;
+		emit_load(&as, R8, RDI, offsetof(st_machine, temps));
+		emit_load(&as, R9, RDI, offsetof(st_machine, receiver));
+		emit_jump(&as, CC_ALWAYS, i, false);
+	}
+
+	for (st_uint i = 0; i < as.fixup_count; i++) {
+		target = as.fixups[i].bailout ? as.bailouts[as.fixups[i].index] : as.offsets[as.fixups[i].index];
+		int32_t displacement = target - (as.fixups[i].position + 4);
+		memcpy(as.buffer + as.fixups[i].position, &displacement, sizeof(int32_t));
+	}
+
+	jit = st_new0(st_jit_code);
+	jit->size = (as.size + st_system_pagesize() - 1) / st_system_pagesize() * st_system_pagesize();
+	jit->memory = st_system_commit_memory(NULL, jit->size);
+	if (jit->memory == NULL) {
+		st_free(jit);
+		st_free(as.guards);
+		goto out;
+	}
+	memcpy(jit->memory, as.buffer, as.size);
+	if (!st_system_protect_executable(jit->memory, jit->size)) {
+		st_system_release_memory(jit->memory, jit->size);
+		st_free(jit);
+		st_free(as.guards);
+		goto out;
+	}
+	jit->guards = as.guards;
+
+	jit->entries = st_malloc0(size * sizeof(st_jit_entry));
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		if (entries[i] != 0)
+			jit->entries[i] = (st_jit_entry) (jit->memory + entries[i]);
+	}
+	jit->optimized = previous != NULL;
+	st_jit_install(machine, threaded, jit);
+
+out:
+	if (previous != NULL)
+		st_jit_free(previous);
+	st_free(as.buffer);
+	st_free(as.fixups);
+	st_free(as.offsets);
+	st_free(as.bailouts);
+	st_free(as.needs_bailout);
+	st_free(entries);
+	st_free(runs);
+	st_free(native);
+}
+
+#endif /* ST_HAVE_JIT */
@@ -0,0 +1,78 @@
+/*
+ * st-jit.h
+ *
+ * Copyright (C) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_JIT_H__
+#define __ST_JIT_H__
+
+#include <st-types.h>
+#include <st-machine.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define ST_HAVE_JIT
+#endif
+
+/* activations of a method, or backward jumps in it, before it is compiled
+   to native code, and before it is compiled again using the receiver
+   classes seen at its sends */
+#define ST_JIT_THRESHOLD          1000
+#define ST_JIT_OPTIMIZE_THRESHOLD 10000
+
+/*
+ * Native code runs from an instruction of a method until it reaches an
+ * instruction it has no template for, or until a fast path or a class
+ * guard fails. It then leaves the index of that instruction in machine->ip
+ * and answers the stack pointer. The interpreter executes the instruction
+ * with the handler that the native code replaced in the threaded code.
+ */
+typedef st_oop *(*st_jit_entry)(st_machine *machine, st_oop *sp);
+
+/* a send profiled by the first tier */
+typedef struct st_jit_site {
+	st_oop class;           /* receiver class, 0 if not yet sent and nil if several were seen */
+	st_uint argcount;
+	st_pointer handler;     /* interpreter handler of the send */
+} st_jit_site;
+
+struct st_jit_code {
+	st_uchar *memory;
+	st_uint size;
+
+	st_jit_entry *entries;  /* entry point of each instruction, or NULL */
+	st_pointer *handlers;   /* interpreter handler of each instruction */
+
+	bool optimized;
+	st_jit_site *sites;     /* profiled sends of the first tier, or NULL */
+	st_oop *guards;         /* class guarded at each instruction, which native code loads from here, or NULL */
+};
+
+static inline bool st_jit_is_due(st_uint activations) {
+	return activations == ST_JIT_THRESHOLD || activations == ST_JIT_OPTIMIZE_THRESHOLD;
+}
+
+void st_jit_compile(st_machine *machine, st_threaded_code *threaded);
+void st_jit_install(st_machine *machine, st_threaded_code *threaded, st_jit_code *jit);
+void st_jit_free(st_jit_code *jit);
+void st_jit_remap(st_jit_code *jit, st_uint size);
+
+#endif /* __ST_JIT_H__ */
@@ -24,12 +24,14 @@
 
 #include "st-large-integer.h"
 #include "st-universe.h"
+#include "st-small-integer.h"
 #include "st-types.h"
 
-#define VALUE(oop)  (&(ST_LARGE_INTEGER(oop)->value))
+#include <string.h>
 
 st_oop st_large_integer_new_from_string(const char *string, st_uint radix) {
 	mp_int value;
+	st_oop integer;
 	int result;
 
 	st_assert (string != NULL);
@@ -42,7 +44,9 @@ st_oop st_large_integer_new_from_string(const char *string, st_uint radix) {
 	if (result != MP_OKAY)
 		goto out;
 
-	return st_large_integer_new(&value);
+	integer = st_large_integer_new(&value);
+	mp_clear(&value);
+	return integer;
 
 	out:
 	mp_clear(&value);
@@ -51,16 +55,18 @@ st_oop st_large_integer_new_from_string(const char *string, st_uint radix) {
 }
 
 char *st_large_integer_to_string(st_oop integer, st_uint radix) {
+	mp_int value;
 	int result;
 	int size;
 
-	result = mp_radix_size(VALUE (integer), radix, &size);
+	value = st_large_integer_value(integer);
+	result = mp_radix_size(&value, radix, &size);
 	if (result != MP_OKAY)
 		goto out;
 
 	char *str = st_malloc(size);
 
-	mp_toradix(VALUE (integer), str, radix);
+	mp_toradix(&value, str, radix);
 	if (result != MP_OKAY)
 		goto out;
 
@@ -71,11 +77,18 @@ char *st_large_integer_to_string(st_oop integer, st_uint radix) {
 	return NULL;
 }
 
+/*
+ * Allocates a LargeInteger holding a copy of the digits of value, or
+ * zero if value is NULL. The caller still owns value, whose digits must
+ * not be those of another LargeInteger, since allocating may move it.
+ */
 st_oop st_large_integer_allocate(st_oop class, mp_int *value) {
 	st_oop object;
 	st_uint size;
+	int used;
 
-	size = ST_SIZE_OOPS (struct st_large_integer);
+	used = value ? value->used : 0;
+	size = ST_SIZE_OOPS (struct st_large_integer) + ST_ROUNDED_UP_OOPS ((used > 0 ? used : 1) * sizeof(mp_digit));
 	object = st_memory_allocate(size);
 	if (object == 0) {
 		st_memory_perform_gc();
@@ -86,13 +99,96 @@ st_oop st_large_integer_allocate(st_oop class, mp_int *value) {
 
 	st_object_initialize_header(object, class);
 
-	if (value)
-		*VALUE (object) = *value;
+	ST_LARGE_INTEGER (object)->used = used;
+	ST_LARGE_INTEGER (object)->sign = value ? value->sign : MP_ZPOS;
+	ST_LARGE_INTEGER (object)->digits[0] = 0;
+	if (used > 0)
+		memcpy(ST_LARGE_INTEGER (object)->digits, value->dp, used * sizeof(mp_digit));
 
 	return object;
 }
 
+/* the value of the given digits, if it fits in 64 bits */
+static bool get_int64(int used, int sign, const mp_digit *digits, int64_t *result) {
+	uint64_t magnitude = 0;
+
+	if (used > ST_LARGE_INTEGER_INT64_DIGITS)
+		return false;
+
+	for (int i = used - 1; i >= 0; i--) {
+		if (magnitude >> (64 - DIGIT_BIT))
+			return false;
+		magnitude = (magnitude << DIGIT_BIT) | digits[i];
+	}
+
+	if (sign == MP_NEG) {
+		if (magnitude > (uint64_t) INT64_MAX + 1)
+			return false;
+		*result = (int64_t) -magnitude;
+	}
+	else {
+		if (magnitude > INT64_MAX)
+			return false;
+		*result = (int64_t) magnitude;
+	}
+
+	return true;
+}
+
 st_oop st_large_integer_new(mp_int *value) {
 	return st_large_integer_allocate(ST_LARGE_INTEGER_CLASS, value);
+}
+
+static st_oop new_from_int64(int64_t integer) {
+	mp_digit digits[ST_LARGE_INTEGER_INT64_DIGITS];
+	mp_int value;
+
+	value = st_large_integer_int64_value(integer, digits);
+
+	return st_large_integer_new(&value);
+}
+
+st_oop st_large_integer_new_from_smi(st_smi integer) {
+	return new_from_int64(integer);
+}
+
+st_oop st_large_integer_new_from_int64(int64_t integer) {
+	if (st_smi_in_range(integer))
+		return st_smi_new(integer);
+
+	return new_from_int64(integer);
+}
+
+st_oop st_large_integer_new_normalized(mp_int *value) {
+	int64_t integer;
+
+	if (get_int64(value->used, value->sign, value->dp, &integer) && st_smi_in_range(integer))
+		return st_smi_new(integer);
+
+	return st_large_integer_new(value);
+}
+
+mp_int st_large_integer_int64_value(int64_t integer, mp_digit *digits) {
+	mp_int value;
+	uint64_t magnitude;
+
+	magnitude = integer < 0 ? -(uint64_t) integer : (uint64_t) integer;
+
+	value.used = 0;
+	value.alloc = ST_LARGE_INTEGER_INT64_DIGITS;
+	value.sign = integer < 0 ? MP_NEG : MP_ZPOS;
+	value.dp = digits;
+
+	digits[0] = 0;
+	while (magnitude != 0) {
+		digits[value.used++] = (mp_digit) (magnitude & MP_MASK);
+		magnitude >>= DIGIT_BIT;
+	}
+
+	return value;
+}
 
+bool st_large_integer_get_int64(st_oop integer, int64_t *result) {
+	return get_int64(ST_LARGE_INTEGER (integer)->used, ST_LARGE_INTEGER (integer)->sign,
+	                 ST_LARGE_INTEGER (integer)->digits, result);
 }
@@ -31,20 +31,54 @@
 
 #define ST_LARGE_INTEGER(oop) ((struct st_large_integer *) st_detag_pointer (oop))
 
+/* The digits of a LargeInteger are kept in the object itself, so that
+ * libtommath can read them in place and nothing has to be freed when
+ * the object dies. A zero still has one digit, which libtommath reads.
+ */
 struct st_large_integer {
 	struct st_header __parent__;
-	mp_int value;
+	int used;
+	int sign;
+	mp_digit digits[];
 };
 
+/* digits of a value of 64 bits at most */
+#define ST_LARGE_INTEGER_INT64_DIGITS ((64 + DIGIT_BIT - 1) / DIGIT_BIT)
+
 st_oop st_large_integer_new(mp_int *value);
-st_oop st_large_integer_new_from_smi(int integer);
+st_oop st_large_integer_new_from_smi(st_smi integer);
+
+/* these answer a SmallInteger instead, for a value in its range */
+st_oop st_large_integer_new_from_int64(int64_t integer);
+st_oop st_large_integer_new_normalized(mp_int *value);
 st_oop st_large_integer_new_from_string(const char *string, st_uint radix);
 char *st_large_integer_to_string(st_oop integer, st_uint radix);
 st_oop st_large_integer_allocate(st_oop class, mp_int *value);
 
+/*
+ * LargeIntegers of up to 64 bits, which are the most common ones, are
+ * computed with native arithmetic. These convert from and to int64_t,
+ * the first answering an mp_int over the given digits.
+ */
+mp_int st_large_integer_int64_value(int64_t integer, mp_digit *digits);
+bool st_large_integer_get_int64(st_oop integer, int64_t *result);
+
 /* inline definitions */
-static inline mp_int *st_large_integer_value(st_oop integer) {
-	return &ST_LARGE_INTEGER (integer)->value;
+static inline st_uint st_large_integer_digit_count(st_oop integer) {
+	return ST_LARGE_INTEGER (integer)->used > 0 ? ST_LARGE_INTEGER (integer)->used : 1;
+}
+
+/* an mp_int reading the digits of integer in place. It must not be
+   modified, and it is only valid until the next allocation. */
+static inline mp_int st_large_integer_value(st_oop integer) {
+	mp_int value;
+
+	value.used = ST_LARGE_INTEGER (integer)->used;
+	value.alloc = st_large_integer_digit_count(integer);
+	value.sign = ST_LARGE_INTEGER (integer)->sign;
+	value.dp = ST_LARGE_INTEGER (integer)->digits;
+
+	return value;
 }
 
 #endif /* __ST_LARGE_INTEGER__ */
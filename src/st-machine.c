@@ -34,7 +34,11 @@
 #include "st-method.h"
 #include "st-array.h"
 #include "st-association.h"
+#include "st-character.h"
+#include "st-float.h"
 #include "st-memory.h"
+#include "st-jit.h"
+#include "st-aot.h"
 
 #include <stdlib.h>
 #include <setjmp.h>
@@ -48,12 +52,23 @@ st_machine __machine;
 static inline st_oop method_context_new(st_machine *machine) {
 	st_oop context;
 	st_uint temp_count;
+	st_uint stack_size;
 	st_oop *stack;
-	bool large;
 
 	temp_count = st_method_get_arg_count(machine->new_method) + st_method_get_temp_count(machine->new_method);
+	stack_size = temp_count + st_method_get_stack_depth(machine->new_method);
+
+	if (ST_UNLIKELY (machine->frames_top + ST_SIZE_OOPS (struct st_method_context) + stack_size > machine->frames_end))
+		st_machine_materialize_contexts(machine);
+
+	context = st_tag_pointer(machine->frames_top);
+	machine->frames_top += ST_SIZE_OOPS (struct st_method_context) + stack_size;
 
-	context = st_memory_allocate_context();
+	ST_OBJECT_MARK (context) = 0 | ST_MARK_TAG;
+	st_object_set_class(context, ST_METHOD_CONTEXT_CLASS);
+	st_object_set_format(context, ST_FORMAT_CONTEXT);
+	st_object_set_instance_size(context, ST_SIZE_OOPS (struct st_method_context) - ST_SIZE_OOPS (struct st_header));
+	st_object_set_stack_size(context, stack_size);
 
 	ST_CONTEXT_PART_SENDER (context) = machine->context;
 	ST_CONTEXT_PART_IP (context) = st_smi_new(0);
@@ -69,40 +84,188 @@ static inline st_oop method_context_new(st_machine *machine) {
 	return context;
 }
 
-static st_oop block_context_new(st_machine *machine, st_uint initial_ip, st_uint argcount) {
+/*
+ * Copies all activations on the frame stack into the heap and empties
+ * the frame stack. This must happen before a context can be referenced
+ * from anywhere but the frame stack itself, i.e. when it is pushed by
+ * thisContext, becomes the home of a block or the sender of an activated
+ * block, and when the frame stack overflows. Heap contexts therefore never
+ * refer to contexts on the frame stack.
+ *
+ * The execution state of the active context must be stored beforehand,
+ * since the sp of each context determines which slots are live.
+ */
+void st_machine_materialize_contexts(st_machine *machine) {
+	st_oop chunk, context;
+	st_oop *fields, *p;
+	st_uint size, count;
+	st_oop offset;
+
+	size = machine->frames_top - machine->frames_start;
+	if (size == 0)
+		return;
+
+	chunk = st_memory_allocate(size);
+	if (chunk == 0) {
+		st_memory_perform_gc();
+		chunk = st_memory_allocate(size);
+		st_assert (chunk != 0);
+	}
+
+	/* The copies keep the layout of the frame stack, so references between
+	 * activations are relocated by a constant offset */
+	st_oops_copy(st_detag_pointer(chunk), machine->frames_start, size);
+	offset = (st_oop) st_detag_pointer(chunk) - (st_oop) machine->frames_start;
+
+	p = st_detag_pointer(chunk);
+	while (p < st_detag_pointer(chunk) + size) {
+		context = st_tag_pointer(p);
+		fields = ST_OBJECT_FIELDS (context);
+		count = st_object_instance_size(context) + st_smi_value(ST_CONTEXT_PART_SP (context));
+		for (st_uint i = 0; i < count; i++) {
+			if (st_object_is_heap(fields[i]) && st_machine_is_stack_context(machine, fields[i]))
+				fields[i] += offset;
+		}
+		p += ST_SIZE_OOPS (struct st_header) + st_object_instance_size(context) + st_object_stack_size(context);
+	}
+
+	if (st_machine_is_stack_context(machine, machine->context)) {
+		machine->context += offset;
+		if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
+			machine->stack = ST_BLOCK_CONTEXT_STACK (machine->context);
+		else
+			machine->stack = ST_METHOD_CONTEXT_STACK (machine->context);
+		machine->temps = machine->stack;
+	}
+
+	machine->frames_top = machine->frames_start;
+}
+
+/*
+ * Creates a block closure. The closure is a BlockContext which is never
+ * activated itself, instead each activation starts out as a copy of it
+ * (see block_context_new). Its stack holds room for the arguments
+ * followed by the @copied_count values on top of the machine stack,
+ * which are popped. Its sp marks the end of the copied values.
+ *
+ * Only blocks with a non-local return refer to their home context.
+ */
+static st_oop block_closure_new(st_machine *machine, st_uint initial_ip, st_uint argcount, st_uint copied_count,
+                                bool needs_home, st_uint stack_size) {
 	st_oop home;
-	st_oop context;
-	st_oop method;
+	st_oop closure;
 	st_oop *stack;
-	st_uint stack_size;
 
-	stack_size = 32;
+	home = ST_NIL;
+	if (needs_home) {
+		if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS) {
+			home = ST_BLOCK_CONTEXT_HOME (machine->context);
+		} else {
+			st_machine_materialize_contexts(machine);
+			home = machine->context;
+		}
+	}
 
-	context = st_memory_allocate(ST_SIZE_OOPS (struct st_block_context) + stack_size);
-	if (context == 0) {
+	closure = st_memory_allocate(ST_SIZE_OOPS (struct st_block_context) + stack_size);
+	if (closure == 0) {
 		st_memory_perform_gc();
-		context = st_memory_allocate(ST_SIZE_OOPS (struct st_block_context) + stack_size);
-		st_assert (context != 0);
+		home = st_memory_remap_reference(home);
+		closure = st_memory_allocate(ST_SIZE_OOPS (struct st_block_context) + stack_size);
+		st_assert (closure != 0);
 	}
 
-	st_object_initialize_header(context, ST_BLOCK_CONTEXT_CLASS);
+	st_object_initialize_header(closure, ST_BLOCK_CONTEXT_CLASS);
+	st_object_set_stack_size(closure, stack_size);
 
-	if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
-		home = ST_BLOCK_CONTEXT_HOME (machine->context);
-	else
-		home = machine->context;
+	ST_CONTEXT_PART_SENDER (closure) = ST_NIL;
+	ST_CONTEXT_PART_IP (closure) = st_smi_new(initial_ip);
+	ST_CONTEXT_PART_SP (closure) = st_smi_new(argcount + copied_count);
 
-	ST_CONTEXT_PART_SENDER (context) = ST_NIL;
-	ST_CONTEXT_PART_IP (context) = st_smi_new(0);
-	ST_CONTEXT_PART_SP (context) = st_smi_new(0);
+	ST_BLOCK_CONTEXT_INITIALIP (closure) = st_smi_new(initial_ip);
+	ST_BLOCK_CONTEXT_ARGCOUNT (closure) = st_smi_new(argcount);
+	ST_BLOCK_CONTEXT_HOME (closure) = home;
+	ST_BLOCK_CONTEXT_METHOD (closure) = machine->method;
+	ST_BLOCK_CONTEXT_RECEIVER (closure) = machine->receiver;
+
+	stack = ST_BLOCK_CONTEXT_STACK (closure);
+	for (st_uint i = 0; i < argcount; i++)
+		stack[i] = ST_NIL;
+	st_oops_copy(stack + argcount, machine->stack + machine->sp - copied_count, copied_count);
+	machine->sp -= copied_count;
+
+	return closure;
+}
+
+/*
+ * Creates an activation of the block closure machine->message_receiver
+ * on the frame stack, with the closure's copied values in place.
+ */
+static inline st_oop block_context_new(st_machine *machine) {
+	st_oop closure;
+	st_oop context;
+	st_uint size;
+
+	closure = machine->message_receiver;
+	size = ST_SIZE_OOPS (struct st_block_context) + st_object_stack_size(closure);
+
+	if (ST_UNLIKELY (machine->frames_top + size > machine->frames_end)) {
+		st_machine_materialize_contexts(machine);
+		closure = machine->message_receiver;
+	}
+
+	context = st_tag_pointer(machine->frames_top);
+	machine->frames_top += size;
+
+	st_oops_copy(st_detag_pointer(context), st_detag_pointer(closure),
+	             ST_SIZE_OOPS (struct st_block_context) + st_smi_value(ST_CONTEXT_PART_SP (closure)));
 
-	ST_BLOCK_CONTEXT_INITIALIP (context) = st_smi_new(initial_ip);
-	ST_BLOCK_CONTEXT_ARGCOUNT (context) = st_smi_new(argcount);
-	ST_BLOCK_CONTEXT_HOME (context) = home;
+	ST_OBJECT_MARK (context) = 0 | ST_MARK_TAG;
+	st_object_set_class(context, ST_OBJECT_CLASS (closure));
+	st_object_set_format(context, ST_FORMAT_CONTEXT);
+	st_object_set_instance_size(context, ST_SIZE_OOPS (struct st_block_context) - ST_SIZE_OOPS (struct st_header));
+	st_object_set_stack_size(context, st_object_stack_size(closure));
+
+	ST_CONTEXT_PART_SENDER (context) = machine->context;
+	ST_CONTEXT_PART_IP (context) = ST_BLOCK_CONTEXT_INITIALIP (closure);
 
 	return context;
 }
 
+/*
+ * Activates the block closure machine->message_receiver. Its arguments
+ * are on top of the stack, and they are popped along with the closure.
+ */
+void st_machine_activate_block(st_machine *machine) {
+	st_oop context;
+
+	context = block_context_new(machine);
+
+	st_oops_copy(ST_BLOCK_CONTEXT_STACK (context),
+	             machine->stack + machine->sp - machine->message_argcount,
+	             machine->message_argcount);
+	machine->sp -= machine->message_argcount + 1;
+
+	st_machine_set_active_context(machine, context);
+}
+
+/*
+ * Like st_machine_activate_block(), but the arguments are the elements
+ * of an Array on top of the stack.
+ */
+void st_machine_activate_block_with_arguments(st_machine *machine) {
+	st_oop context;
+	st_oop array;
+
+	context = block_context_new(machine);
+
+	array = machine->stack[machine->sp - 1];
+	st_oops_copy(ST_BLOCK_CONTEXT_STACK (context), st_array_elements(array),
+	             st_smi_value(ST_BLOCK_CONTEXT_ARGCOUNT (context)));
+	machine->sp -= 2;
+
+	st_machine_set_active_context(machine, context);
+}
+
 static void create_actual_message(st_machine *machine) {
 	st_oop *elements;
 	st_oop message;
@@ -131,33 +294,152 @@ static void create_actual_message(st_machine *machine) {
 	machine->message_argcount = 1;
 }
 
-static st_oop lookup_method(st_machine *machine, st_oop class) {
-	st_oop method, dict, parent;
-	st_uint hash;
+static inline st_uint dispatch_hash(st_oop oop) {
+	return (st_uint) (oop >> 3) * 2654435761u;
+}
+
+static void dispatch_table_add(st_dispatch_table *table, st_oop selector, st_oop method);
+
+static void dispatch_table_grow(st_dispatch_table *table) {
+	st_oop *entries;
+	st_uint mask;
+
+	entries = table->entries;
+	mask = table->mask;
+
+	table->mask = mask * 2 + 1;
+	table->count = 0;
+	table->entries = st_malloc0((table->mask + 1) * 2 * sizeof(st_oop));
+	for (st_uint i = 0; i <= mask; i++) {
+		if (entries[i * 2] != 0)
+			dispatch_table_add(table, entries[i * 2], entries[i * 2 + 1]);
+	}
+	st_free(entries);
+}
+
+/* adds or replaces the method for selector, which is nil for selectors that were removed */
+static void dispatch_table_add(st_dispatch_table *table, st_oop selector, st_oop method) {
+	st_uint i;
+
+	for (i = dispatch_hash(selector) & table->mask; table->entries[i * 2] != 0; i = (i + 1) & table->mask) {
+		if (table->entries[i * 2] == selector) {
+			table->entries[i * 2 + 1] = method;
+			return;
+		}
+	}
+	if ((table->count + 1) * 2 > table->mask + 1) {
+		dispatch_table_grow(table);
+		dispatch_table_add(table, selector, method);
+		return;
+	}
+	table->entries[i * 2] = selector;
+	table->entries[i * 2 + 1] = method;
+	table->count++;
+}
+
+/*
+ * Answers the dispatch table of class, building it from that of its
+ * superclass and its own method dictionary if there is none yet
+ */
+static st_dispatch_table *dispatch_table(st_machine *machine, st_oop class) {
+	st_dispatch_table *table, *super;
+	st_oop associations, element;
+	st_uint bucket, size, capacity;
+
+	bucket = dispatch_hash(class) % ST_DISPATCH_TABLE_BUCKETS;
+	for (table = machine->dispatch_tables[bucket]; table != NULL; table = table->next) {
+		if (table->class == class)
+			return table;
+	}
 
-	parent = class;
-	hash = st_byte_array_hash(machine->message_selector);
+	super = NULL;
+	if (ST_BEHAVIOR_SUPERCLASS (class) != ST_NIL)
+		super = dispatch_table(machine, ST_BEHAVIOR_SUPERCLASS (class));
 
-	while (parent != ST_NIL) {
+	associations = ST_OBJECT_FIELDS (ST_BEHAVIOR_METHOD_DICTIONARY (class))[2];
+	size = st_smi_value(st_arrayed_object_size(associations));
 
-		st_oop el;
-		st_uint mask, i;
+	/* keep the table at most half full */
+	capacity = 8;
+	while (capacity < ((super != NULL ? super->count : 0) + size) * 2)
+		capacity <<= 1;
 
-		dict = ST_BEHAVIOR_METHOD_DICTIONARY (parent);
-		mask = st_smi_value(st_arrayed_object_size(ST_OBJECT_FIELDS (dict)[2])) - 1;
-		i = (hash & mask) + 1;
+	table = st_new(st_dispatch_table);
+	table->class = class;
+	table->mask = capacity - 1;
+	table->count = 0;
+	table->entries = st_malloc0(capacity * 2 * sizeof(st_oop));
 
-		while (true) {
-			el = st_array_at(ST_OBJECT_FIELDS (dict)[2], i);
-			if (el == ST_NIL || el == (uintptr_t) ST_OBJECT_FIELDS (dict)[2])
-				break;
-			if (machine->message_selector == ST_ASSOCIATION_KEY (el))
-				return ST_ASSOCIATION_VALUE (el);
-			i = ((i + ST_ADVANCE_SIZE) & mask) + 1;
+	if (super != NULL) {
+		for (st_uint i = 0; i <= super->mask; i++) {
+			if (super->entries[i * 2] != 0 && super->entries[i * 2 + 1] != ST_NIL)
+				dispatch_table_add(table, super->entries[i * 2], super->entries[i * 2 + 1]);
 		}
+	}
+	for (st_uint i = 1; i <= size; i++) {
+		element = st_array_at(associations, i);
+		if (element != ST_NIL && element != associations)
+			dispatch_table_add(table, ST_ASSOCIATION_KEY (element), ST_ASSOCIATION_VALUE (element));
+	}
+
+	table->next = machine->dispatch_tables[bucket];
+	machine->dispatch_tables[bucket] = table;
+	return table;
+}
+
+static void dispatch_table_free(st_dispatch_table *table) {
+	st_free(table->entries);
+	st_free(table);
+}
+
+/*
+ * Answers the method for selector in class or its superclasses, or nil
+ */
+static st_oop find_method(st_machine *machine, st_oop class, st_oop selector) {
+	st_dispatch_table *table;
 
-		parent = ST_BEHAVIOR_SUPERCLASS (parent);
+	table = dispatch_table(machine, class);
+	for (st_uint i = dispatch_hash(selector) & table->mask; table->entries[i * 2] != 0; i = (i + 1) & table->mask) {
+		if (table->entries[i * 2] == selector)
+			return table->entries[i * 2 + 1];
 	}
+	return ST_NIL;
+}
+
+static void update_dispatch_tables(st_machine *machine, st_oop class, st_oop selector);
+
+/*
+ * Compiles a method which was filed in lazily, once a send finds it,
+ * and installs the compiled method in its place
+ */
+static st_oop compile_lazy_method(st_machine *machine, st_oop method) {
+	st_oop literals, class;
+	st_uint counter;
+
+	/* the compiler keeps objects where the collector cannot see them, so
+	   it must not run during the send. What the compiler allocates counts
+	   towards the next collection */
+	counter = memory->counter;
+	memory->counter = 0;
+	method = st_compile_lazy_method(method);
+	memory->counter += counter;
+
+	literals = ST_METHOD_LITERALS (method);
+	class = st_array_at(literals, st_smi_value(st_arrayed_object_size(literals)));
+	st_dictionary_at_put(ST_BEHAVIOR_METHOD_DICTIONARY (class), ST_METHOD_SELECTOR (method), method);
+	update_dispatch_tables(machine, class, ST_METHOD_SELECTOR (method));
+
+	return method;
+}
+
+static st_oop lookup_method(st_machine *machine, st_oop class) {
+	st_oop method;
+
+	method = find_method(machine, class, machine->message_selector);
+	if (ST_UNLIKELY (method != ST_NIL && st_method_get_flags(method) == ST_METHOD_LAZY))
+		method = compile_lazy_method(machine, method);
+	if (method != ST_NIL)
+		return method;
 
 	if (machine->message_selector == ST_SELECTOR_DOESNOTUNDERSTAND) {
 		fprintf(stderr, "panda: error: no method found for #doesNotUnderstand:\n");
@@ -173,6 +455,10 @@ st_oop st_machine_lookup_method(st_machine *machine, st_oop class) {
 	return lookup_method(machine, class);
 }
 
+st_oop st_machine_find_method(st_machine *machine, st_oop class, st_oop selector) {
+	return find_method(machine, class, selector);
+}
+
 /* 
  * Creates a new method context. Parameterised by
  * @sender, @receiver, @method, and @argcount
@@ -196,6 +482,56 @@ static inline void activate_method(st_machine *machine) {
 	st_machine_set_active_context(machine, context);
 }
 
+/*
+ * Executes machine->new_method for perform:, whose selector lies on the
+ * stack between the receiver and the message_argcount arguments. Only
+ * primitives need the arguments moved down over it, since a new context
+ * copies them from wherever they are.
+ */
+void st_machine_perform_method(st_machine *machine) {
+	st_oop context;
+	st_oop *arguments;
+	st_uint selector_index;
+
+	if (st_method_get_flags(machine->new_method) == ST_METHOD_PRIMITIVE) {
+		selector_index = machine->sp - machine->message_argcount - 1;
+		st_oops_move(machine->stack + selector_index, machine->stack + selector_index + 1, machine->message_argcount);
+		machine->sp -= 1;
+		st_machine_execute_method(machine);
+		return;
+	}
+
+	context = method_context_new(machine);
+
+	arguments = ST_METHOD_CONTEXT_STACK (context);
+	for (st_uint i = 0; i < machine->message_argcount; i++)
+		arguments[i] = machine->stack[machine->sp - machine->message_argcount + i];
+
+	machine->sp -= machine->message_argcount + 2;
+
+	st_machine_set_active_context(machine, context);
+}
+
+/*
+ * Activates machine->new_method with the elements of an Array as
+ * arguments. The Array is on top of the stack, just above the receiver,
+ * and both are popped.
+ */
+void st_machine_activate_method_with_arguments(st_machine *machine) {
+	st_oop context;
+	st_oop array;
+
+	context = method_context_new(machine);
+
+	/* read the array only now, in case creating the context moved it */
+	array = machine->stack[machine->sp - 1];
+	st_oops_copy(ST_METHOD_CONTEXT_STACK (context), st_array_elements(array), machine->message_argcount);
+
+	machine->sp -= 2;
+
+	st_machine_set_active_context(machine, context);
+}
+
 void st_machine_execute_method(st_machine *machine) {
 	st_uint primitive_index;
 	st_method_flags flags;
@@ -212,9 +548,371 @@ void st_machine_execute_method(st_machine *machine) {
 	activate_method(machine);
 }
 
-void st_machine_set_active_context(st_machine *machine, st_oop context) {
-	st_oop home;
+/*
+ * Executes machine->new_method with the elements of an Array as
+ * arguments, which lie on the stack as for
+ * st_machine_activate_method_with_arguments. A primitive takes its
+ * receiver and arguments from the stack, where the active context may
+ * have no room to spread them out, so it runs on the stack of a scratch
+ * context on top of the frame stack instead. The method is only activated
+ * if the primitive fails.
+ */
+void st_machine_execute_method_with_arguments(st_machine *machine) {
+	st_oop context, sender, result;
+	st_uint primitive_index;
+	st_uint stack_size, size;
+	st_oop *stack;
+
+	if (st_method_get_flags(machine->new_method) != ST_METHOD_PRIMITIVE) {
+		st_machine_activate_method_with_arguments(machine);
+		return;
+	}
 
+	/* the sp of the active context must be current, should the frame stack
+	   be materialized */
+	ST_CONTEXT_PART_SP (machine->context) = st_smi_new(machine->sp);
+
+	stack_size = machine->message_argcount + 1;
+	if (ST_UNLIKELY (machine->frames_top + ST_SIZE_OOPS (struct st_method_context) + stack_size > machine->frames_end))
+		st_machine_materialize_contexts(machine);
+
+	context = st_tag_pointer(machine->frames_top);
+	machine->frames_top += ST_SIZE_OOPS (struct st_method_context) + stack_size;
+
+	ST_OBJECT_MARK (context) = 0 | ST_MARK_TAG;
+	st_object_set_class(context, ST_METHOD_CONTEXT_CLASS);
+	st_object_set_format(context, ST_FORMAT_CONTEXT);
+	st_object_set_instance_size(context, ST_SIZE_OOPS (struct st_method_context) - ST_SIZE_OOPS (struct st_header));
+	st_object_set_stack_size(context, stack_size);
+
+	ST_CONTEXT_PART_SENDER (context) = machine->context;
+	ST_CONTEXT_PART_IP (context) = st_smi_new(0);
+	ST_CONTEXT_PART_SP (context) = st_smi_new(stack_size);
+	ST_METHOD_CONTEXT_RECEIVER (context) = machine->message_receiver;
+	ST_METHOD_CONTEXT_METHOD (context) = machine->new_method;
+
+	stack = ST_METHOD_CONTEXT_STACK (context);
+	stack[0] = machine->message_receiver;
+	st_oops_copy(stack + 1, st_array_elements(machine->stack[machine->sp - 1]), machine->message_argcount);
+
+	/* the code and ip of the sender stay in place, as nothing runs in the
+	   scratch context */
+	machine->context = context;
+	machine->method = machine->new_method;
+	machine->receiver = machine->message_receiver;
+	machine->temps = stack;
+	machine->stack = stack;
+	machine->sp = stack_size;
+
+	primitive_index = st_method_get_primitive_index(machine->new_method);
+	machine->success = true;
+	st_primitives[primitive_index].func(machine);
+
+	if (machine->context != context) {
+		/* the primitive activated a context, which returns to the sender
+		   of the scratch context instead. Creating it may have moved the
+		   scratch context into the heap */
+		context = ST_CONTEXT_PART_SENDER (machine->context);
+		sender = ST_CONTEXT_PART_SENDER (context);
+		ST_CONTEXT_PART_SENDER (machine->context) = sender;
+		ST_CONTEXT_PART_SP (sender) = st_smi_new(st_smi_value(ST_CONTEXT_PART_SP (sender)) - 2);
+
+		/* nothing refers to the new activation yet, so it is moved down
+		   over the scratch context, which would otherwise stay on the
+		   frame stack until the sender returns */
+		if (st_machine_is_stack_context(machine, context)) {
+			size = machine->frames_top - (st_oop *) st_detag_pointer(machine->context);
+			st_oops_move(st_detag_pointer(context), st_detag_pointer(machine->context), size);
+			machine->frames_top = (st_oop *) st_detag_pointer(context) + size;
+			machine->context = context;
+			if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS)
+				machine->stack = ST_BLOCK_CONTEXT_STACK (context);
+			else
+				machine->stack = ST_METHOD_CONTEXT_STACK (context);
+			machine->temps = machine->stack;
+		}
+		return;
+	}
+
+	result = ST_STACK_PEEK (machine);
+	sender = ST_CONTEXT_PART_SENDER (context);
+	machine->frames_top = st_detag_pointer(context);
+	st_machine_set_active_context(machine, sender);
+
+	if (!machine->success) {
+		st_machine_activate_method_with_arguments(machine);
+		return;
+	}
+
+	machine->sp -= 2;
+	ST_STACK_PUSH (machine, result);
+}
+
+static st_threaded_code *translate_method(st_machine *machine, st_oop method) {
+	st_threaded_code *threaded;
+	const st_uchar *bytecode;
+	st_oop *literals;
+	st_oop *code;
+	st_uint size;
+	st_uint length;
+
+	size = 0;
+	bytecode = NULL;
+	if (ST_METHOD_BYTECODE (method) != ST_NIL) {
+		size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (method)));
+		bytecode = st_method_bytecode_bytes(method);
+	}
+	literals = st_array_elements(ST_METHOD_LITERALS (method));
+
+	threaded = st_malloc(sizeof(st_threaded_code) + size * sizeof(st_oop));
+	threaded->method = method;
+	threaded->activations = 0;
+	threaded->jit = NULL;
+	code = threaded->code;
+
+	for (st_uint i = 0; i < size; i += length) {
+#ifdef HAVE_COMPUTED_GOTO
+		code[i] = (st_oop) machine->labels[bytecode[i]];
+#else
+		code[i] = bytecode[i];
+#endif
+		switch (bytecode[i]) {
+		case PUSH_LITERAL_CONST:
+		case PUSH_LITERAL_VAR:
+		case STORE_LITERAL_VAR:
+		case STORE_POP_LITERAL_VAR:
+			code[i + 1] = literals[bytecode[i + 1]];
+			length = 2;
+			break;
+		case PUSH_INTEGER:
+			code[i + 1] = st_smi_new((signed char) bytecode[i + 1]);
+			length = 2;
+			break;
+		case PUSH_TEMP:
+		case PUSH_INSTVAR:
+		case STORE_TEMP:
+		case STORE_INSTVAR:
+		case STORE_POP_TEMP:
+		case STORE_POP_INSTVAR:
+		case PUSH_NEW_ARRAY:
+			code[i + 1] = bytecode[i + 1];
+			length = 2;
+			break;
+		case JUMP_TRUE:
+		case JUMP_FALSE:
+			code[i + 1] = (st_oop) (code + i + 3 + *((unsigned short *) (bytecode + i + 1)));
+			code[i + 2] = 0;
+			length = 3;
+			break;
+		case JUMP:
+			code[i + 1] = (st_oop) (code + i + 3 + *((short *) (bytecode + i + 1)));
+			code[i + 2] = 0;
+#if defined(HAVE_COMPUTED_GOTO) && defined(ST_HAVE_JIT)
+			if (machine->jit && *((short *) (bytecode + i + 1)) < 0)
+				code[i] = (st_oop) machine->labels[HANDLER_JUMP_BACKWARD];
+#endif
+			length = 3;
+			break;
+		case SEND:
+		case SEND_SUPER:
+			code[i + 1] = bytecode[i + 1];
+			code[i + 2] = literals[bytecode[i + 2]];
+			length = 3;
+			break;
+		case PUSH_REMOTE_TEMP:
+		case STORE_REMOTE_TEMP:
+		case STORE_POP_REMOTE_TEMP:
+			code[i + 1] = bytecode[i + 1];
+			code[i + 2] = bytecode[i + 2];
+			length = 3;
+			break;
+		case BLOCK_COPY:
+			code[i + 1] = bytecode[i + 1];
+			code[i + 2] = bytecode[i + 2];
+			code[i + 3] = bytecode[i + 3];
+			length = 4;
+			break;
+		default:
+			length = 1;
+			break;
+		}
+	}
+
+	/* malloc'd memory is aligned, so the pointer looks like a SmallInteger to the gc */
+	st_assert (st_object_is_smi((st_oop) threaded));
+	ST_METHOD_CODE (method) = (st_oop) threaded;
+
+	threaded->next = machine->threaded_code;
+	machine->threaded_code = threaded;
+
+	if (machine->jit)
+		st_aot_install(machine, threaded);
+
+	return threaded;
+}
+
+static inline const st_oop *method_code(st_machine *machine, st_oop method) {
+	st_threaded_code *threaded;
+
+	if (ST_UNLIKELY (ST_METHOD_CODE (method) == ST_NIL))
+		threaded = translate_method(machine, method);
+	else
+		threaded = (st_threaded_code *) ST_METHOD_CODE (method);
+
+#ifdef ST_HAVE_JIT
+	if (ST_UNLIKELY (st_jit_is_due(++threaded->activations)) && machine->jit)
+		st_jit_compile(machine, threaded);
+#endif
+
+	return threaded->code;
+}
+
+const st_oop *st_machine_method_code(st_machine *machine, st_oop method) {
+	return method_code(machine, method);
+}
+
+/*
+ * Discards all threaded code, and the native code installed in it,
+ * once the methods it depends on have changed.
+ */
+void st_machine_flush_code(st_machine *machine) {
+	st_threaded_code *threaded;
+
+	while (machine->threaded_code != NULL) {
+		threaded = machine->threaded_code;
+		machine->threaded_code = threaded->next;
+		ST_METHOD_CODE (threaded->method) = ST_NIL;
+		if (threaded->jit != NULL)
+			st_jit_free(threaded->jit);
+		st_free(threaded);
+	}
+	machine->code = NULL;
+}
+
+static bool remap_operand(st_oop *operand) {
+	if (!st_memory_is_live(*operand))
+		return false;
+	*operand = st_memory_remap_reference(*operand);
+	return true;
+}
+
+/* updates the method and literals of threaded code, answering false if any was collected */
+static bool remap_threaded_code(st_threaded_code *threaded) {
+	const st_uchar *bytecode;
+	st_oop *code;
+	st_uint size;
+
+	if (!remap_operand(&threaded->method))
+		return false;
+
+	size = 0;
+	bytecode = NULL;
+	if (ST_METHOD_BYTECODE (threaded->method) != ST_NIL) {
+		size = st_smi_value(st_arrayed_object_size(ST_METHOD_BYTECODE (threaded->method)));
+		bytecode = st_method_bytecode_bytes(threaded->method);
+	}
+	code = threaded->code;
+
+	for (st_uint i = 0; i < size; i += st_instruction_size(bytecode[i])) {
+		switch (bytecode[i]) {
+		case PUSH_LITERAL_CONST:
+		case PUSH_LITERAL_VAR:
+		case STORE_LITERAL_VAR:
+		case STORE_POP_LITERAL_VAR:
+			if (!remap_operand(&code[i + 1]))
+				return false;
+			break;
+		case SEND:
+		case SEND_SUPER:
+			if (!remap_operand(&code[i + 2]))
+				return false;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (threaded->jit != NULL)
+		st_jit_remap(threaded->jit, size);
+	return true;
+}
+
+/* updates the class and entries of a dispatch table, answering false if any was collected */
+static bool remap_dispatch_table(st_dispatch_table *table) {
+	st_oop *entries;
+
+	if (!st_memory_is_live(table->class))
+		return false;
+	for (st_uint i = 0; i <= table->mask * 2 + 1; i++) {
+		if (table->entries[i] != 0 && !st_memory_is_live(table->entries[i]))
+			return false;
+	}
+
+	/* entries are hashed by identity, so they are added again */
+	entries = table->entries;
+	table->class = st_memory_remap_reference(table->class);
+	table->count = 0;
+	table->entries = st_malloc0((table->mask + 1) * 2 * sizeof(st_oop));
+	for (st_uint i = 0; i <= table->mask; i++) {
+		if (entries[i * 2] != 0)
+			dispatch_table_add(table,
+			                   st_memory_remap_reference(entries[i * 2]),
+			                   st_memory_remap_reference(entries[i * 2 + 1]));
+	}
+	st_free(entries);
+	return true;
+}
+
+/*
+ * Brings threaded code, native code and dispatch tables up to date once
+ * a gc has moved the objects they refer to, so that they need not be
+ * built again. Those of methods and classes that were collected are
+ * freed. Lookups in the method cache are discarded.
+ */
+void st_machine_remap(st_machine *machine) {
+	st_threaded_code **link, *threaded;
+	st_dispatch_table *tables, *table;
+	st_uint bucket;
+
+	link = &machine->threaded_code;
+	while (*link != NULL) {
+		threaded = *link;
+		if (remap_threaded_code(threaded)) {
+			link = &threaded->next;
+			continue;
+		}
+		*link = threaded->next;
+		if (threaded->jit != NULL)
+			st_jit_free(threaded->jit);
+		st_free(threaded);
+	}
+
+	/* tables are hashed into buckets by the address of their class */
+	tables = NULL;
+	for (bucket = 0; bucket < ST_DISPATCH_TABLE_BUCKETS; bucket++) {
+		while (machine->dispatch_tables[bucket] != NULL) {
+			table = machine->dispatch_tables[bucket];
+			machine->dispatch_tables[bucket] = table->next;
+			table->next = tables;
+			tables = table;
+		}
+	}
+	while (tables != NULL) {
+		table = tables;
+		tables = table->next;
+		if (!remap_dispatch_table(table)) {
+			dispatch_table_free(table);
+			continue;
+		}
+		bucket = dispatch_hash(table->class) % ST_DISPATCH_TABLE_BUCKETS;
+		table->next = machine->dispatch_tables[bucket];
+		machine->dispatch_tables[bucket] = table;
+	}
+
+	memset(machine->method_cache, 0, ST_METHOD_CACHE_SIZE * 3 * sizeof(st_oop));
+}
+
+void st_machine_set_active_context(st_machine *machine, st_oop context) {
 	/* save executation state of active context */
 	if (ST_UNLIKELY (machine->context != ST_NIL)) {
 		ST_CONTEXT_PART_IP (machine->context) = st_smi_new(machine->ip);
@@ -222,10 +920,10 @@ void st_machine_set_active_context(st_machine *machine, st_oop context) {
 	}
 
 	if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS) {
-		home = ST_BLOCK_CONTEXT_HOME (context);
-		machine->method = ST_METHOD_CONTEXT_METHOD (home);
-		machine->receiver = ST_METHOD_CONTEXT_RECEIVER (home);
-		machine->temps = ST_METHOD_CONTEXT_STACK (home);
+		/* arguments, copied values and temporaries all live on the block's own stack */
+		machine->method = ST_BLOCK_CONTEXT_METHOD (context);
+		machine->receiver = ST_BLOCK_CONTEXT_RECEIVER (context);
+		machine->temps = ST_BLOCK_CONTEXT_STACK (context);
 		machine->stack = ST_BLOCK_CONTEXT_STACK (context);
 	}
 	else {
@@ -238,7 +936,7 @@ void st_machine_set_active_context(st_machine *machine, st_oop context) {
 	machine->context = context;
 	machine->sp = st_smi_value(ST_CONTEXT_PART_SP (context));
 	machine->ip = st_smi_value(ST_CONTEXT_PART_IP (context));
-	machine->bytecode = st_method_bytecode_bytes(machine->method);
+	machine->code = method_code(machine, machine->method);
 }
 
 #define SEND_SELECTOR(selector, argcount)            \
@@ -277,6 +975,10 @@ static const st_pointer labels[] =            \
     && DUPLICATE_STACK_TOP,                   \
     && PUSH_ACTIVE_CONTEXT,                   \
     && BLOCK_COPY,                            \
+    && PUSH_REMOTE_TEMP,                      \
+    && STORE_REMOTE_TEMP,                     \
+    && STORE_POP_REMOTE_TEMP,                 \
+    && PUSH_NEW_ARRAY,                        \
     && JUMP_TRUE,                             \
     && JUMP_FALSE,                            \
     && JUMP,                                  \
@@ -306,6 +1008,9 @@ static const st_pointer labels[] =            \
     && SEND_CLASS,                            \
     && SEND_NEW,                              \
     && SEND_NEW_ARG,                          \
+    && SEND_VALUE_ARG2,                       \
+    && SEND_VALUE_ARG3,                       \
+    && INVALID, && INVALID, && INVALID,                            \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
@@ -345,48 +1050,310 @@ static const st_pointer labels[] =            \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
-    && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
-    && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,    \
-    && INVALID,                                                    \
+    && INVALID, && INVALID,                                        \
+    && JIT_ENTRY,                                                  \
+    && JUMP_BACKWARD,                                              \
+    && PROFILE_SEND,                                               \
 };                                                                 \
-goto *labels[*ip];
+if (ST_UNLIKELY (machine->labels == NULL)) {                       \
+    machine->labels = labels;                                      \
+    return;                                                        \
+}                                                                  \
+goto *(st_pointer) *ip;
 #else
 #define SWITCH(ip) \
 start:             \
 switch (*ip)
 #endif
 
-#ifdef HAVE_COMPUTED_GOTO
-#define INVALID() INVALID:
-#else
-#define INVALID() default:
-#define CASE(OP) case OP:
-#endif
+#ifdef HAVE_COMPUTED_GOTO
+#define INVALID() INVALID:
+#else
+#define INVALID() default:
+#define CASE(OP) case OP:
+#endif
+
+#ifdef HAVE_COMPUTED_GOTO
+#define NEXT() goto *(st_pointer) *ip
+#else
+#define NEXT() goto start
+#endif
+
+static inline void install_method_in_cache(st_machine *machine) {
+	st_uint index;
+	index = ST_METHOD_CACHE_HASH (machine->lookup_class, machine->message_selector) & ST_METHOD_CACHE_MASK;
+	machine->method_cache[index].class = machine->lookup_class;
+	machine->method_cache[index].selector = machine->message_selector;
+	machine->method_cache[index].method = machine->new_method;
+}
+
+static inline bool lookup_method_in_cache(st_machine *machine) {
+	st_uint index;
+
+	index = ST_METHOD_CACHE_HASH (machine->lookup_class, machine->message_selector) & ST_METHOD_CACHE_MASK;
+	if (machine->method_cache[index].class == machine->lookup_class &&
+	    machine->method_cache[index].selector == machine->message_selector) {
+		machine->new_method = machine->method_cache[index].method;
+		return true;
+	}
+	return false;
+}
+
+static inline st_oop cached_method(st_machine *machine, st_oop class, st_oop selector) {
+	st_uint index;
+
+	index = ST_METHOD_CACHE_HASH (class, selector) & ST_METHOD_CACHE_MASK;
+	if (machine->method_cache[index].class == class && machine->method_cache[index].selector == selector)
+		return machine->method_cache[index].method;
+	return ST_NIL;
+}
+
+/*
+ * Answers the method for selector in class, or nil, going through the
+ * method cache like sends do
+ */
+st_oop st_machine_lookup_cached(st_machine *machine, st_oop class, st_oop selector) {
+	st_uint index;
+	st_oop method;
+
+	index = ST_METHOD_CACHE_HASH (class, selector) & ST_METHOD_CACHE_MASK;
+	if (machine->method_cache[index].class == class && machine->method_cache[index].selector == selector)
+		return machine->method_cache[index].method;
+
+	method = find_method(machine, class, selector);
+	if (ST_UNLIKELY (method != ST_NIL && st_method_get_flags(method) == ST_METHOD_LAZY))
+		method = compile_lazy_method(machine, method);
+	if (method != ST_NIL) {
+		machine->method_cache[index].class = class;
+		machine->method_cache[index].selector = selector;
+		machine->method_cache[index].method = method;
+	}
+	return method;
+}
+
+static inline bool is_behavior_method(st_oop method) {
+	st_oop literals;
+
+	if (method == ST_NIL)
+		return false;
+	literals = ST_METHOD_LITERALS (method);
+	return st_array_elements(literals)[st_smi_value(st_arrayed_object_size(literals)) - 1] == ST_BEHAVIOR_CLASS;
+}
+
+/*
+ * Answers whether the message in machine is new or new: resolving,
+ * through the method cache, to the methods in Behavior, which send
+ * basicNew or basicNew: and then initialize.
+ */
+static inline bool is_default_new(st_machine *machine) {
+	st_oop basic_new;
+
+	basic_new = machine->message_argcount == 0 ? ST_SELECTOR_BASICNEW : ST_SELECTOR_BASICNEW_ARG;
+
+	return is_behavior_method(cached_method(machine, machine->lookup_class, machine->message_selector))
+	       && is_behavior_method(cached_method(machine, machine->lookup_class, basic_new));
+}
+
+/*
+ * Bump allocates an object of class with size oops and nils its fields,
+ * leaving the size field of arrayed objects to the caller. Answers 0 when
+ * a collection is due or the heap must grow.
+ */
+static inline st_oop allocate_pointers(st_oop class, st_uint size) {
+	st_oop *chunk;
+	st_oop object;
+
+	if (ST_UNLIKELY (memory->counter > ST_COLLECTION_THRESHOLD || memory->p + size >= memory->end))
+		return 0;
+
+	chunk = memory->p;
+	memory->p += size;
+	memory->counter += size * sizeof(st_oop);
+
+	object = st_tag_pointer(chunk);
+	ST_OBJECT_MARK (object) = 0 | ST_MARK_TAG;
+	st_object_set_class(object, class);
+	st_object_set_format(object, st_smi_value(ST_BEHAVIOR_FORMAT (class)));
+	st_object_set_instance_size(object, st_smi_value(ST_BEHAVIOR_INSTANCE_SIZE (class)));
+
+	for (st_uint i = ST_SIZE_OOPS (struct st_header); i < size; i++)
+		chunk[i] = ST_NIL;
+
+	return object;
+}
+
+/*
+ * Answers the operands of an arithmetic message as doubles, if one of
+ * them is a Float and the other a Float or SmallInteger. SmallIntegers
+ * are converted as the coercion in Number would.
+ */
+static inline bool float_operands(st_oop a, st_oop b, double *x, double *y) {
+	if (st_object_is_smi(a))
+		*x = st_smi_value(a);
+	else if (st_object_is_float(a))
+		*x = st_float_value(a);
+	else
+		return false;
+
+	if (st_object_is_smi(b))
+		*y = st_smi_value(b);
+	else if (st_object_is_float(b))
+		*y = st_float_value(b);
+	else
+		return false;
+
+	return true;
+}
+
+/*
+ * Fast paths for #at:, #at:put: and #size on the indexable classes whose
+ * methods are primitives. They answer false, leaving everything as it
+ * was, when the message must be sent after all: for other classes
+ * (which may override these methods), indices out of bounds and values
+ * which cannot be stored.
+ */
+static inline bool is_in_bounds(st_oop object, st_oop index) {
+	return st_object_is_smi(index) && st_smi_value(index) >= 1
+	       && st_smi_value(index) <= st_smi_value(st_arrayed_object_size(object));
+}
+
+static inline bool indexed_at(st_oop object, st_oop index, st_oop *result) {
+	st_oop class;
+
+	if (!st_object_is_heap(object))
+		return false;
+
+	class = ST_OBJECT_CLASS (object);
+
+	switch (st_object_format(object)) {
+	case ST_FORMAT_ARRAY:
+		if (class != ST_ARRAY_CLASS || !is_in_bounds(object, index))
+			return false;
+		*result = st_array_at(object, st_smi_value(index));
+		return true;
+
+	case ST_FORMAT_BYTE_ARRAY:
+		if (!is_in_bounds(object, index))
+			return false;
+		if (class == ST_BYTE_ARRAY_CLASS)
+			*result = st_smi_new(st_byte_array_at(object, st_smi_value(index)));
+		else if (class == ST_STRING_CLASS || class == ST_SYMBOL_CLASS)
+			*result = st_character_new(st_byte_array_at(object, st_smi_value(index)));
+		else
+			return false;
+		return true;
+
+	case ST_FORMAT_WORD_ARRAY:
+		if (class != ST_WORD_ARRAY_CLASS || !is_in_bounds(object, index))
+			return false;
+		*result = st_smi_new(st_word_array_at(object, st_smi_value(index)));
+		return true;
+
+	case ST_FORMAT_INTEGER_ARRAY: {
+		int64_t element;
+
+		if (class != ST_INTEGER_ARRAY_CLASS || !is_in_bounds(object, index))
+			return false;
+		/* elements outside the SmallInteger range need a LargeInteger */
+		element = st_integer_array_at(object, st_smi_value(index));
+		if (element < ST_SMALL_INTEGER_MIN || element > ST_SMALL_INTEGER_MAX)
+			return false;
+		*result = st_smi_new(element);
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+static inline bool indexed_at_put(st_oop object, st_oop index, st_oop value) {
+	st_oop class;
+
+	if (!st_object_is_heap(object))
+		return false;
+
+	class = ST_OBJECT_CLASS (object);
+
+	switch (st_object_format(object)) {
+	case ST_FORMAT_ARRAY:
+		if (class != ST_ARRAY_CLASS || !is_in_bounds(object, index))
+			return false;
+		st_array_at_put(object, st_smi_value(index), value);
+		return true;
 
-#ifdef HAVE_COMPUTED_GOTO
-#define NEXT() goto *labels[*ip]
-#else
-#define NEXT() goto start
-#endif
+	case ST_FORMAT_BYTE_ARRAY:
+		if (!is_in_bounds(object, index))
+			return false;
+		if (class == ST_BYTE_ARRAY_CLASS && st_object_is_smi(value)
+		    && st_smi_value(value) >= 0 && st_smi_value(value) <= 255)
+			st_byte_array_at_put(object, st_smi_value(index), st_smi_value(value));
+		else if (class == ST_STRING_CLASS && st_object_is_character(value)
+		         && st_character_value(value) <= 255)
+			st_byte_array_at_put(object, st_smi_value(index), st_character_value(value));
+		else
+			return false;
+		return true;
 
-static inline void install_method_in_cache(st_machine *machine) {
-	st_uint index;
-	index = ST_METHOD_CACHE_HASH (machine->lookup_class, machine->message_selector) & ST_METHOD_CACHE_MASK;
-	machine->method_cache[index].class = machine->lookup_class;
-	machine->method_cache[index].selector = machine->message_selector;
-	machine->method_cache[index].method = machine->new_method;
-}
+	case ST_FORMAT_WORD_ARRAY:
+		if (class != ST_WORD_ARRAY_CLASS || !is_in_bounds(object, index) || !st_object_is_smi(value))
+			return false;
+		st_word_array_at_put(object, st_smi_value(index), st_smi_value(value));
+		return true;
 
-static inline bool lookup_method_in_cache(st_machine *machine) {
-	st_uint index;
+	case ST_FORMAT_FLOAT_ARRAY:
+		if (class != ST_FLOAT_ARRAY_CLASS || !is_in_bounds(object, index)
+		    || !st_object_is_float(value))
+			return false;
+		st_float_array_at_put(object, st_smi_value(index), st_float_value(value));
+		return true;
 
-	index = ST_METHOD_CACHE_HASH (machine->lookup_class, machine->message_selector) & ST_METHOD_CACHE_MASK;
-	if (machine->method_cache[index].class == machine->lookup_class &&
-	    machine->method_cache[index].selector == machine->message_selector) {
-		machine->new_method = machine->method_cache[index].method;
+	case ST_FORMAT_INTEGER_ARRAY:
+		if (class != ST_INTEGER_ARRAY_CLASS || !is_in_bounds(object, index) || !st_object_is_smi(value))
+			return false;
+		st_integer_array_at_put(object, st_smi_value(index), st_smi_value(value));
 		return true;
+
+	default:
+		return false;
 	}
-	return false;
+}
+
+static inline bool indexed_size(st_oop object, st_oop *result) {
+	st_oop class;
+
+	if (!st_object_is_heap(object))
+		return false;
+
+	class = ST_OBJECT_CLASS (object);
+
+	switch (st_object_format(object)) {
+	case ST_FORMAT_ARRAY:
+		if (class != ST_ARRAY_CLASS)
+			return false;
+		break;
+	case ST_FORMAT_BYTE_ARRAY:
+		if (class != ST_BYTE_ARRAY_CLASS && class != ST_STRING_CLASS && class != ST_SYMBOL_CLASS)
+			return false;
+		break;
+	case ST_FORMAT_WORD_ARRAY:
+		if (class != ST_WORD_ARRAY_CLASS)
+			return false;
+		break;
+	case ST_FORMAT_FLOAT_ARRAY:
+		if (class != ST_FLOAT_ARRAY_CLASS)
+			return false;
+		break;
+	case ST_FORMAT_INTEGER_ARRAY:
+		if (class != ST_INTEGER_ARRAY_CLASS)
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	*result = st_arrayed_object_size(object);
+	return true;
 }
 
 #define STACK_POP(oop)     (*--sp)
@@ -394,22 +1361,23 @@ static inline bool lookup_method_in_cache(st_machine *machine) {
 #define STACK_PEEK(oop)    (*(sp-1))
 #define STACK_UNPOP(count) (sp += count)
 #define STORE_REGISTERS()                                             \
-    machine->ip = ip - machine->bytecode;                             \
+    machine->ip = ip - machine->code;                                 \
     machine->sp = sp - machine->stack;                                \
     ST_CONTEXT_PART_IP (machine->context) = st_smi_new (machine->ip); \
     ST_CONTEXT_PART_SP (machine->context) = st_smi_new (machine->sp);
 #define LOAD_REGISTERS()                    \
-    ip = machine->bytecode + machine->ip;   \
+    ip = machine->code + machine->ip;       \
     sp = machine->stack + machine->sp;
 
-void st_machine_main(st_machine *machine) {
-	register const st_uchar *ip;
+/*
+ * Runs until System>>exitWithResult: jumps back to st_machine_main(),
+ * which keeps setjmp() out of here so ip and sp can stay in registers.
+ */
+static void interpret(st_machine *machine) {
+	register const st_oop *ip;
 	register st_oop *sp = machine->stack;
 
-	if (setjmp (machine->main_loop))
-		goto out;
-
-	ip = machine->bytecode + machine->ip;
+	ip = machine->code + machine->ip;
 
 	SWITCH (ip)
 	{
@@ -451,13 +1419,13 @@ void st_machine_main(st_machine *machine) {
 		}
 		STORE_LITERAL_VAR:
 		{
-			ST_ASSOCIATION_VALUE (st_array_elements(ST_METHOD_LITERALS(machine->method))[ip[1]]) = STACK_PEEK ();
+			ST_ASSOCIATION_VALUE (ip[1]) = STACK_PEEK ();
 			ip += 2;
 			NEXT ();
 		}
 		STORE_POP_LITERAL_VAR:
 		{
-			ST_ASSOCIATION_VALUE (st_array_elements(ST_METHOD_LITERALS(machine->method))[ip[1]]) = STACK_POP ();
+			ST_ASSOCIATION_VALUE (ip[1]) = STACK_POP ();
 			ip += 2;
 			NEXT ();
 		}
@@ -487,19 +1455,23 @@ void st_machine_main(st_machine *machine) {
 		}
 		PUSH_INTEGER:
 		{
-			STACK_PUSH (st_smi_new((signed char) ip[1]));
+			STACK_PUSH (ip[1]);
 			ip += 2;
 			NEXT ();
 		}
 		PUSH_ACTIVE_CONTEXT:
 		{
+			STORE_REGISTERS ();
+			st_machine_materialize_contexts(machine);
+			LOAD_REGISTERS ();
+
 			STACK_PUSH (machine->context);
 			ip += 1;
 			NEXT ();
 		}
 		PUSH_LITERAL_CONST:
 		{
-			STACK_PUSH (st_array_elements(ST_METHOD_LITERALS(machine->method))[ip[1]]);
+			STACK_PUSH (ip[1]);
 			ip += 2;
 			NEXT ();
 		}
@@ -507,7 +1479,7 @@ void st_machine_main(st_machine *machine) {
 		PUSH_LITERAL_VAR:
 		{
 			st_oop var;
-			var = ST_ASSOCIATION_VALUE (st_array_elements(ST_METHOD_LITERALS(machine->method))[ip[1]]);
+			var = ST_ASSOCIATION_VALUE (ip[1]);
 			STACK_PUSH (var);
 			ip += 2;
 			NEXT ();
@@ -517,7 +1489,7 @@ void st_machine_main(st_machine *machine) {
 		{
 			if (STACK_PEEK () == ST_TRUE) {
 				(void) STACK_POP ();
-				ip += *((unsigned short *) (ip + 1)) + 3;
+				ip = (const st_oop *) ip[1];
 			}
 			else if (ST_LIKELY (STACK_PEEK() == ST_FALSE)) {
 				(void) STACK_POP ();
@@ -534,7 +1506,7 @@ void st_machine_main(st_machine *machine) {
 		{
 			if (STACK_PEEK () == ST_FALSE) {
 				(void) STACK_POP ();
-				ip += *((unsigned short *) (ip + 1)) + 3;
+				ip = (const st_oop *) ip[1];
 			}
 			else if (ST_LIKELY (STACK_PEEK() == ST_TRUE)) {
 				(void) STACK_POP ();
@@ -549,22 +1521,46 @@ void st_machine_main(st_machine *machine) {
 
 		JUMP:
 		{
-			ip += *((short *) (ip + 1)) + 3;
+			ip = (const st_oop *) ip[1];
+			NEXT ();
+		}
+		JUMP_BACKWARD:
+		{
+#ifdef ST_HAVE_JIT
+			st_threaded_code *threaded;
+
+			/* a loop may be hot in a method that is hardly ever activated. Once
+			   compiled, the loop enters native code from the jump target */
+			threaded = (st_threaded_code *) ST_METHOD_CODE (machine->method);
+			if (ST_UNLIKELY (st_jit_is_due(++threaded->activations)))
+				st_jit_compile(machine, threaded);
+#endif
+			ip = (const st_oop *) ip[1];
 			NEXT ();
 		}
 		SEND_PLUS:
 		{
-			int a, b, result;
+			st_smi a, b, result;
+			double x, y;
+			st_oop value;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = st_smi_value(sp[-1]);
 				a = st_smi_value(sp[-2]);
-				result = a + b;
-				if (((result << 1) ^ (result << 2)) >= 0) {
+				if (!__builtin_add_overflow(a, b, &result) && st_smi_in_range(result)) {
 					sp -= 2;
 					STACK_PUSH (st_smi_new(result));
 					ip++;
 					NEXT ();
 				}
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				STORE_REGISTERS ();
+				value = st_float_new(x + y);
+				LOAD_REGISTERS ();
+				sp -= 2;
+				STACK_PUSH (value);
+				ip++;
+				NEXT ();
 			}
 
 			machine->message_argcount = 1;
@@ -576,20 +1572,27 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_MINUS:
 		{
-			int a, b, result;
+			st_smi a, b, result;
+			double x, y;
+			st_oop value;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = st_smi_value(sp[-1]);
 				a = st_smi_value(sp[-2]);
-				result = a - b;
-				if (((result << 1) ^ (result << 2)) >= 0) {
+				if (!__builtin_sub_overflow(a, b, &result) && st_smi_in_range(result)) {
 					sp -= 2;
 					STACK_PUSH (st_smi_new(result));
 					ip++;
 					NEXT ();
 				}
-				else {
-					STACK_UNPOP (2);
-				}
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				STORE_REGISTERS ();
+				value = st_float_new(x - y);
+				LOAD_REGISTERS ();
+				sp -= 2;
+				STACK_PUSH (value);
+				ip++;
+				NEXT ();
 			}
 
 			machine->message_argcount = 1;
@@ -601,18 +1604,27 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_MUL:
 		{
-			int a, b;
-			int64_t result;
+			st_smi a, b, result;
+			double x, y;
+			st_oop value;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = st_smi_value(sp[-1]);
 				a = st_smi_value(sp[-2]);
-				result = a * b;
-				if (result >= ST_SMALL_INTEGER_MIN && result <= ST_SMALL_INTEGER_MAX) {
+				if (!__builtin_mul_overflow(a, b, &result) && st_smi_in_range(result)) {
 					sp -= 2;
-					STACK_PUSH (st_smi_new((int) result));
+					STACK_PUSH (st_smi_new(result));
 					ip++;
 					NEXT ();
 				}
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				STORE_REGISTERS ();
+				value = st_float_new(x * y);
+				LOAD_REGISTERS ();
+				sp -= 2;
+				STACK_PUSH (value);
+				ip++;
+				NEXT ();
 			}
 
 			machine->message_argcount = 1;
@@ -625,10 +1637,11 @@ void st_machine_main(st_machine *machine) {
 		SEND_MOD:
 		{
 			st_oop a, b;
-			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
+			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2])
+				       && sp[-1] != st_smi_new(0))) {
 				b = STACK_POP ();
 				a = STACK_POP ();
-				STACK_PUSH (st_smi_new(st_smi_value(a) % st_smi_value(b)));
+				STACK_PUSH (st_smi_new(st_smi_floor_mod(st_smi_value(a), st_smi_value(b))));
 				ip++;
 				NEXT ();
 			}
@@ -642,6 +1655,30 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_DIV:
 		{
+			st_smi a, b;
+			double x, y;
+			st_oop value;
+
+			/* exact quotients only, others answer a Fraction */
+			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
+				b = st_smi_value(sp[-1]);
+				a = st_smi_value(sp[-2]);
+				if (b != 0 && a % b == 0 && st_smi_in_range(a / b)) {
+					sp -= 2;
+					STACK_PUSH (st_smi_new(a / b));
+					ip++;
+					NEXT ();
+				}
+			} else if (float_operands(sp[-2], sp[-1], &x, &y) && y != 0.0) {
+				STORE_REGISTERS ();
+				value = st_float_new(x / y);
+				LOAD_REGISTERS ();
+				sp -= 2;
+				STACK_PUSH (value);
+				ip++;
+				NEXT ();
+			}
+
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_DIV;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -651,17 +1688,13 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_BITSHIFT:
 		{
-			st_oop a, b;
+			st_smi result;
 
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) &&
-			               st_object_is_smi(sp[-2]))) {
-				b = STACK_POP ();
-				a = STACK_POP ();
-				if (st_smi_value(b) < 0) {
-					STACK_PUSH (st_smi_new(st_smi_value(a) >> -st_smi_value(b)));
-				}
-				else
-					STACK_PUSH (st_smi_new(st_smi_value(a) << st_smi_value(b)));
+			               st_object_is_smi(sp[-2]))
+			    && st_smi_bit_shift(st_smi_value(sp[-2]), st_smi_value(sp[-1]), &result)) {
+				sp -= 2;
+				STACK_PUSH (st_smi_new(result));
 				ip++;
 				NEXT ();
 			}
@@ -729,12 +1762,19 @@ void st_machine_main(st_machine *machine) {
 		SEND_LT:
 		{
 			st_oop a, b;
+			double x, y;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = STACK_POP ();
 				a = STACK_POP ();
 				STACK_PUSH (st_smi_value(a) < st_smi_value(b) ? ST_TRUE : ST_FALSE);
 				ip++;
 				NEXT ();
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				sp -= 2;
+				STACK_PUSH (x < y ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
 			}
 
 			machine->message_argcount = 1;
@@ -747,13 +1787,21 @@ void st_machine_main(st_machine *machine) {
 		SEND_GT:
 		{
 			st_oop a, b;
+			double x, y;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = STACK_POP ();
 				a = STACK_POP ();
 				STACK_PUSH (st_smi_value(a) > st_smi_value(b) ? ST_TRUE : ST_FALSE);
 				ip++;
 				NEXT ();
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				sp -= 2;
+				STACK_PUSH (x > y ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
 			}
+
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_GT;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -764,12 +1812,19 @@ void st_machine_main(st_machine *machine) {
 		SEND_LE:
 		{
 			st_oop a, b;
+			double x, y;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = STACK_POP ();
 				a = STACK_POP ();
 				STACK_PUSH (st_smi_value(a) <= st_smi_value(b) ? ST_TRUE : ST_FALSE);
 				ip++;
 				NEXT ();
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				sp -= 2;
+				STACK_PUSH (x <= y ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
 			}
 
 			machine->message_argcount = 1;
@@ -782,12 +1837,19 @@ void st_machine_main(st_machine *machine) {
 		SEND_GE:
 		{
 			st_oop a, b;
+			double x, y;
+
 			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
 				b = STACK_POP ();
 				a = STACK_POP ();
 				STACK_PUSH (st_smi_value(a) >= st_smi_value(b) ? ST_TRUE : ST_FALSE);
 				ip++;
 				NEXT ();
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				sp -= 2;
+				STACK_PUSH (x >= y ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
 			}
 
 			machine->message_argcount = 1;
@@ -808,6 +1870,14 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_SIZE:
 		{
+			st_oop size;
+
+			if (ST_LIKELY (indexed_size(sp[-1], &size))) {
+				sp[-1] = size;
+				ip++;
+				NEXT ();
+			}
+
 			machine->message_argcount = 0;
 			machine->message_selector = ST_SELECTOR_SIZE;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -817,6 +1887,27 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_AT:
 		{
+			st_oop element;
+
+			if (ST_LIKELY (indexed_at(sp[-2], sp[-1], &element))) {
+				sp--;
+				sp[-1] = element;
+				ip++;
+				NEXT ();
+			}
+
+			/* a FloatArray answers a new Float */
+			if (st_object_is_heap(sp[-2]) && ST_OBJECT_CLASS (sp[-2]) == ST_FLOAT_ARRAY_CLASS
+			    && is_in_bounds(sp[-2], sp[-1])) {
+				STORE_REGISTERS ();
+				element = st_float_new(st_float_array_at(sp[-2], st_smi_value(sp[-1])));
+				LOAD_REGISTERS ();
+				sp--;
+				sp[-1] = element;
+				ip++;
+				NEXT ();
+			}
+
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_AT;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -826,6 +1917,13 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_AT_PUT:
 		{
+			if (ST_LIKELY (indexed_at_put(sp[-3], sp[-2], sp[-1]))) {
+				sp[-3] = sp[-1];
+				sp -= 2;
+				ip++;
+				NEXT ();
+			}
+
 			machine->message_argcount = 2;
 			machine->message_selector = ST_SELECTOR_ATPUT;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -835,6 +1933,22 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_EQ:
 		{
+			st_oop a, b;
+			double x, y;
+
+			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
+				b = STACK_POP ();
+				a = STACK_POP ();
+				STACK_PUSH (a == b ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				sp -= 2;
+				STACK_PUSH (x == y ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
+			}
+
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_EQ;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -844,6 +1958,22 @@ void st_machine_main(st_machine *machine) {
 		}
 		SEND_NE:
 		{
+			st_oop a, b;
+			double x, y;
+
+			if (ST_LIKELY (st_object_is_smi(sp[-1]) && st_object_is_smi(sp[-2]))) {
+				b = STACK_POP ();
+				a = STACK_POP ();
+				STACK_PUSH (a != b ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
+			} else if (float_operands(sp[-2], sp[-1], &x, &y)) {
+				sp -= 2;
+				STACK_PUSH (x != y ? ST_TRUE : ST_FALSE);
+				ip++;
+				NEXT ();
+			}
+
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_NE;
 			machine->message_receiver = sp[-machine->message_argcount - 1];
@@ -864,36 +1994,120 @@ void st_machine_main(st_machine *machine) {
 		{
 			machine->message_argcount = 0;
 			machine->message_selector = ST_SELECTOR_VALUE;
-			machine->message_receiver = sp[-machine->message_argcount - 1];
-			machine->lookup_class = st_object_class(machine->message_receiver);
-			ip += 1;
-			goto send_common;
+			goto send_value;
 		}
 		SEND_VALUE_ARG:
 		{
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_VALUE_ARG;
+			goto send_value;
+		}
+		SEND_VALUE_ARG2:
+		{
+			machine->message_argcount = 2;
+			machine->message_selector = ST_SELECTOR_VALUE_ARG2;
+			goto send_value;
+		}
+		SEND_VALUE_ARG3:
+		{
+			st_oop context;
+			st_oop closure;
+
+			machine->message_argcount = 3;
+			machine->message_selector = ST_SELECTOR_VALUE_ARG3;
+
+			send_value:
+
 			machine->message_receiver = sp[-machine->message_argcount - 1];
-			machine->lookup_class = st_object_class(machine->message_receiver);
 			ip += 1;
-			goto send_common;
+
+			/* activate block closures directly, skipping the lookup
+			   and the BlockContext>>value primitive */
+			closure = machine->message_receiver;
+			if (ST_UNLIKELY (!st_object_is_heap(closure)
+			                 || ST_OBJECT_CLASS (closure) != ST_BLOCK_CONTEXT_CLASS
+			                 || st_smi_value(ST_BLOCK_CONTEXT_ARGCOUNT (closure)) != machine->message_argcount)) {
+				machine->lookup_class = st_object_class(closure);
+				goto send_common;
+			}
+
+			/* a gc could occur */
+			STORE_REGISTERS ();
+			context = block_context_new(machine);
+			LOAD_REGISTERS ();
+
+			st_oops_copy(ST_BLOCK_CONTEXT_STACK (context), sp - machine->message_argcount,
+			             machine->message_argcount);
+			sp -= machine->message_argcount + 1;
+
+			STORE_REGISTERS ();
+			machine->method = ST_BLOCK_CONTEXT_METHOD (context);
+			machine->receiver = ST_BLOCK_CONTEXT_RECEIVER (context);
+			machine->temps = ST_BLOCK_CONTEXT_STACK (context);
+			machine->stack = ST_BLOCK_CONTEXT_STACK (context);
+			machine->context = context;
+			machine->sp = st_smi_value(ST_CONTEXT_PART_SP (context));
+			machine->ip = st_smi_value(ST_CONTEXT_PART_IP (context));
+			machine->code = method_code(machine, machine->method);
+			LOAD_REGISTERS ();
+
+			machine->message_receiver = ST_NIL;
+			machine->message_selector = ST_NIL;
+
+			NEXT ();
 		}
 		SEND_NEW:
 		{
 			machine->message_argcount = 0;
 			machine->message_selector = ST_SELECTOR_NEW;
-			machine->message_receiver = sp[-machine->message_argcount - 1];
-			machine->lookup_class = st_object_class(machine->message_receiver);
-			ip += 1;
-			goto send_common;
+			goto send_new;
 		}
 		SEND_NEW_ARG:
 		{
+			st_oop class;
+			st_oop instance;
+			int size;
+
 			machine->message_argcount = 1;
 			machine->message_selector = ST_SELECTOR_NEW_ARG;
+
+			send_new:
+
 			machine->message_receiver = sp[-machine->message_argcount - 1];
 			machine->lookup_class = st_object_class(machine->message_receiver);
 			ip += 1;
+
+			if (!is_default_new(machine))
+				goto send_common;
+
+			/* allocate inline what basicNew or basicNew: would answer for
+			   pointer formats, then send initialize to the instance */
+			class = machine->message_receiver;
+			if (machine->message_argcount == 0) {
+				if (st_smi_value(ST_BEHAVIOR_FORMAT (class)) != ST_FORMAT_OBJECT)
+					goto send_common;
+				instance = allocate_pointers(class, ST_SIZE_OOPS (struct st_header)
+				                                    + st_smi_value(ST_BEHAVIOR_INSTANCE_SIZE (class)));
+			} else {
+				if (st_smi_value(ST_BEHAVIOR_FORMAT (class)) != ST_FORMAT_ARRAY || !st_object_is_smi(sp[-1]))
+					goto send_common;
+				size = st_smi_value(sp[-1]);
+				if (size < 0)
+					goto send_common;
+				instance = allocate_pointers(class, ST_SIZE_OOPS (struct st_array) + size);
+				if (instance != 0)
+					ST_ARRAYED_OBJECT (instance)->size = st_smi_new(size);
+			}
+			if (instance == 0)
+				goto send_common;
+
+			sp -= machine->message_argcount;
+			sp[-1] = instance;
+
+			machine->message_argcount = 0;
+			machine->message_selector = ST_SELECTOR_INITIALIZE;
+			machine->message_receiver = instance;
+			machine->lookup_class = class;
 			goto send_common;
 		}
 		SEND:
@@ -904,7 +2118,7 @@ void st_machine_main(st_machine *machine) {
 			st_oop *arguments;
 
 			machine->message_argcount = ip[1];
-			machine->message_selector = st_array_elements(ST_METHOD_LITERALS (machine->method))[ip[2]];
+			machine->message_selector = ip[2];
 			machine->message_receiver = sp[-machine->message_argcount - 1];
 			machine->lookup_class = st_object_class(machine->message_receiver);
 			ip += 3;
@@ -958,7 +2172,7 @@ void st_machine_main(st_machine *machine) {
 		{
 			st_oop index;
 			machine->message_argcount = ip[1];
-			machine->message_selector = st_array_elements(ST_METHOD_LITERALS (machine->method))[ip[2]];
+			machine->message_selector = ip[2];
 			machine->message_receiver = sp[-machine->message_argcount - 1];
 
 			index = st_smi_value(st_arrayed_object_size(ST_METHOD_LITERALS (machine->method))) - 1;
@@ -977,29 +2191,69 @@ void st_machine_main(st_machine *machine) {
 		}
 		DUPLICATE_STACK_TOP:
 		{
-			STACK_PUSH (STACK_PEEK());
+			st_oop top;
+
+			/* sp must not be read and incremented in the same expression */
+			top = STACK_PEEK ();
+			STACK_PUSH (top);
 			ip += 1;
 			NEXT ();
 		}
 		BLOCK_COPY:
 		{
 			st_oop block;
-			st_oop home;
 			st_uint argcount = ip[1];
+			st_uint copied_count = ip[2] & ~ST_BLOCK_COPY_HOME;
+			bool needs_home = ip[2] & ST_BLOCK_COPY_HOME;
+			st_uint depth = ip[3];
 			st_uint initial_ip;
 
-			ip += 2;
+			ip += 4;
 
-			initial_ip = ip - machine->bytecode + 3;
+			/* the block body follows the jump around it */
+			initial_ip = ip - machine->code + 3;
 
 			STORE_REGISTERS ();
-			block = block_context_new(machine, initial_ip, argcount);
+			block = block_closure_new(machine, initial_ip, argcount, copied_count, needs_home, depth);
 			LOAD_REGISTERS ();
 
 			STACK_PUSH (block);
 
 			NEXT ();
 		}
+		PUSH_REMOTE_TEMP:
+		{
+			STACK_PUSH (st_array_elements(machine->temps[ip[2]])[ip[1]]);
+			ip += 3;
+			NEXT ();
+		}
+		STORE_REMOTE_TEMP:
+		{
+			st_array_elements(machine->temps[ip[2]])[ip[1]] = STACK_PEEK ();
+			ip += 3;
+			NEXT ();
+		}
+		STORE_POP_REMOTE_TEMP:
+		{
+			st_array_elements(machine->temps[ip[2]])[ip[1]] = STACK_POP ();
+			ip += 3;
+			NEXT ();
+		}
+		PUSH_NEW_ARRAY:
+		{
+			st_oop array;
+			st_uint size = ip[1];
+
+			ip += 2;
+
+			STORE_REGISTERS ();
+			array = st_object_new_arrayed(ST_ARRAY_CLASS, size);
+			LOAD_REGISTERS ();
+
+			STACK_PUSH (array);
+
+			NEXT ();
+		}
 		RETURN_STACK_TOP:
 		{
 			st_oop sender;
@@ -1008,20 +2262,38 @@ void st_machine_main(st_machine *machine) {
 
 			value = STACK_PEEK ();
 
-			if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
-				sender = ST_CONTEXT_PART_SENDER (ST_BLOCK_CONTEXT_HOME(machine->context));
-			else {
+			if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS) {
+				home = ST_BLOCK_CONTEXT_HOME (machine->context);
+				st_assert (home != ST_NIL);
+				sender = ST_CONTEXT_PART_SENDER (home);
+			} else {
 				sender = ST_CONTEXT_PART_SENDER (machine->context);
-				st_memory_recycle_context(machine->context);
 			}
 
 			if (ST_UNLIKELY (sender == ST_NIL)) {
+				STORE_REGISTERS ();
+				st_machine_materialize_contexts(machine);
+				LOAD_REGISTERS ();
 				STACK_PUSH (machine->context);
 				STACK_PUSH (value);
 				SEND_SELECTOR (ST_SELECTOR_CANNOTRETURN, 1);
 				NEXT ();
 			}
 
+			if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS) {
+				/* the home context lives in the heap, so every activation
+				   on the frame stack is newer and is unwound as well */
+				ST_CONTEXT_PART_SENDER (home) = ST_NIL;
+				machine->frames_top = machine->frames_start;
+			}
+			else if (st_machine_is_stack_context(machine, machine->context)) {
+				machine->frames_top = st_detag_pointer(machine->context);
+			}
+			else {
+				/* mark the materialized context as returned */
+				ST_CONTEXT_PART_SENDER (machine->context) = ST_NIL;
+			}
+
 			st_machine_set_active_context(machine, sender);
 			LOAD_REGISTERS ();
 			STACK_PUSH (value);
@@ -1037,23 +2309,111 @@ void st_machine_main(st_machine *machine) {
 			caller = ST_CONTEXT_PART_SENDER (machine->context);
 			value = STACK_PEEK ();
 
+			if (st_machine_is_stack_context(machine, machine->context))
+				machine->frames_top = st_detag_pointer(machine->context);
+
 			st_machine_set_active_context(machine, caller);
 			LOAD_REGISTERS ();
 			STACK_PUSH (value);
 
 			NEXT ();
 		}
+		JIT_ENTRY:
+		{
+#ifdef HAVE_COMPUTED_GOTO
+			st_jit_code *jit;
+
+			jit = ((st_threaded_code *) ST_METHOD_CODE (machine->method))->jit;
+			/* functions compiled ahead of time are entered at machine->ip */
+			machine->ip = ip - machine->code;
+			sp = jit->entries[machine->ip](machine, sp);
+			ip = machine->code + machine->ip;
+
+			goto *jit->handlers[machine->ip];
+#else
+			abort();
+#endif
+		}
+		PROFILE_SEND:
+		{
+#ifdef HAVE_COMPUTED_GOTO
+			st_jit_site *site;
+			st_oop class;
+
+			site = ((st_threaded_code *) ST_METHOD_CODE (machine->method))->jit->sites + (ip - machine->code);
+			class = st_object_class(sp[-(int) site->argcount - 1]);
+			if (site->class == 0)
+				site->class = class;
+			else if (site->class != class)
+				site->class = ST_NIL;
+
+			goto *site->handler;
+#else
+			abort();
+#endif
+		}
 		INVALID ()
 		{
 			abort();
 		}
 	}
-	out:
+}
+
+void st_machine_main(st_machine *machine) {
+	if (!setjmp (machine->main_loop))
+		interpret(machine);
+
 	st_log("gc", "totalPauseTime: %.6fs\n", st_timespec_to_double_seconds(&memory->total_pause_time));
 }
 
+/*
+ * Brings the dispatch tables of class and its subclasses up to date
+ * with the method for selector, or discards the tables of all classes
+ * if class is nil.
+ */
+static void update_dispatch_tables(st_machine *machine, st_oop class, st_oop selector) {
+	st_dispatch_table **link, *table;
+	st_oop parent, method;
+
+	for (st_uint bucket = 0; bucket < ST_DISPATCH_TABLE_BUCKETS; bucket++) {
+		link = &machine->dispatch_tables[bucket];
+		while (*link != NULL) {
+			table = *link;
+			if (class == ST_NIL) {
+				*link = table->next;
+				dispatch_table_free(table);
+				continue;
+			}
+
+			for (parent = table->class; parent != ST_NIL && parent != class; parent = ST_BEHAVIOR_SUPERCLASS (parent))
+				;
+			if (parent == class) {
+				method = ST_NIL;
+				for (parent = table->class; parent != ST_NIL && method == ST_NIL; parent = ST_BEHAVIOR_SUPERCLASS (parent))
+					method = st_dictionary_at(ST_BEHAVIOR_METHOD_DICTIONARY (parent), selector);
+				dispatch_table_add(table, selector, method);
+			}
+			link = &table->next;
+		}
+	}
+}
+
 void st_machine_clear_caches(st_machine *machine) {
 	memset(machine->method_cache, 0, ST_METHOD_CACHE_SIZE * 3 * sizeof(st_oop));
+	update_dispatch_tables(machine, ST_NIL, ST_NIL);
+}
+
+/*
+ * Discards lookups and native code that depend on the methods
+ * installed, once the method for selector in class has been added,
+ * replaced or removed.
+ */
+void st_machine_methods_changed(st_machine *machine, st_oop class, st_oop selector) {
+	memset(machine->method_cache, 0, ST_METHOD_CACHE_SIZE * 3 * sizeof(st_oop));
+	update_dispatch_tables(machine, class, selector);
+	st_machine_flush_code(machine);
+	if (machine->context != ST_NIL)
+		machine->code = method_code(machine, machine->method);
 }
 
 void st_machine_initialize(st_machine *machine) {
@@ -1069,7 +2429,18 @@ void st_machine_initialize(st_machine *machine) {
 	machine->ip = 0;
 	machine->stack = NULL;
 
+	if (machine->frames_start == NULL) {
+		machine->frames_start = st_malloc(ST_FRAME_STACK_SIZE * sizeof(st_oop));
+		machine->frames_end = machine->frames_start + ST_FRAME_STACK_SIZE;
+	}
+	machine->frames_top = machine->frames_start;
+
 	st_machine_clear_caches(machine);
+	st_machine_flush_code(machine);
+
+	/* the first run of the interpreter only hands out its handler addresses */
+	if (machine->labels == NULL)
+		interpret(machine);
 
 	machine->message_argcount = 0;
 	machine->message_receiver = ST_SMALLTALK;
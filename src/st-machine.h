@@ -34,8 +34,25 @@
 #define ST_METHOD_CACHE_MASK      (ST_METHOD_CACHE_SIZE - 1)
 #define ST_METHOD_CACHE_HASH(k, s) ((k) ^ (s))
 
-#define ST_NUM_GLOBALS 36
-#define ST_NUM_SELECTORS 24
+/* number of buckets, a power of 2, holding the dispatch tables of classes */
+#define ST_DISPATCH_TABLE_BUCKETS 256
+
+/* size of the native stack holding activation records, in oops */
+#define ST_FRAME_STACK_SIZE (256 * 1024)
+
+#define ST_NUM_GLOBALS 40
+#define ST_NUM_SELECTORS 26
+
+/* handlers which no bytecode names follow those of the bytecodes in labels:
+   the one entering native code, the one of backward jumps, which count
+   towards compilation, and the one recording receiver classes at sends of
+   compiled methods. They are only read through labels, since gcc warns of
+   label addresses stored anywhere else */
+enum {
+	HANDLER_JIT_ENTRY = 256,
+	HANDLER_JUMP_BACKWARD,
+	HANDLER_PROFILE_SEND
+};
 
 typedef struct st_method_cache {
 	st_oop class;
@@ -43,13 +60,46 @@ typedef struct st_method_cache {
 	st_oop method;
 } st_method_cache;
 
+/*
+ * Dispatch table of a class, flattened from those of its superclasses:
+ * every selector the class understands, hashed by identity, and the
+ * method it runs. Tables are built when a lookup misses the method
+ * cache, and the gc updates the object references they hold.
+ */
+typedef struct st_dispatch_table st_dispatch_table;
+
+struct st_dispatch_table {
+	st_dispatch_table *next;
+	st_oop class;
+	st_uint mask;
+	st_uint count;
+	st_oop *entries;        /* selector and method pairs, with 0 for free slots */
+};
+
+/*
+ * Threaded code of a CompiledMethod. Each bytecode instruction is
+ * translated to the address of its handler, at the same index, followed
+ * by its operands with literals and jump targets resolved. Instruction
+ * pointers saved in contexts index both the bytecode and the threaded code.
+ */
+typedef struct st_threaded_code st_threaded_code;
+typedef struct st_jit_code st_jit_code;
+
+struct st_threaded_code {
+	st_threaded_code *next;
+	st_oop method;
+	st_uint activations;
+	st_jit_code *jit;
+	st_oop code[];
+};
+
 typedef struct st_machine st_machine;
 
 struct st_machine {
 	st_oop context;
 	st_oop receiver;
 	st_oop method;
-	st_uchar *bytecode;
+	const st_oop *code;
 	st_oop *temps;
 	st_oop *stack;
 	st_oop lookup_class;
@@ -62,11 +112,31 @@ struct st_machine {
 	st_uint sp;
 	jmp_buf main_loop;
 
+	/* Activation records are allocated on this contiguous stack
+	 * and only copied into the heap when they escape */
+	st_oop *frames_start;
+	st_oop *frames_end;
+	st_oop *frames_top;
+
 	st_method_cache method_cache[ST_METHOD_CACHE_SIZE];
+	st_dispatch_table *dispatch_tables[ST_DISPATCH_TABLE_BUCKETS];
+
+	/* handler addresses, and all threaded code translated since it was last flushed */
+	const st_pointer *labels;
+	st_threaded_code *threaded_code;
+
+	/* whether hot methods are compiled to native code */
+	bool jit;
 
 	st_oop globals[ST_NUM_GLOBALS];
 	st_oop selectors[ST_NUM_SELECTORS];
 
+	/* classes by the index kept in object headers, where the index
+	   of nil is 0 */
+	st_oop *classes;
+	st_uint class_count;
+	st_uint class_capacity;
+
 };
 extern st_machine __machine;
 #define ST_STACK_POP(machine)          (machine->stack[--machine->sp])
@@ -78,7 +148,23 @@ void st_machine_main(st_machine *machine);
 void st_machine_initialize(st_machine *machine);
 void st_machine_set_active_context(st_machine *machine, st_oop context);
 void st_machine_execute_method(st_machine *machine);
+void st_machine_activate_method_with_arguments(st_machine *machine);
+void st_machine_execute_method_with_arguments(st_machine *machine);
+void st_machine_perform_method(st_machine *machine);
+void st_machine_activate_block(st_machine *machine);
+void st_machine_activate_block_with_arguments(st_machine *machine);
 st_oop st_machine_lookup_method(st_machine *machine, st_oop class);
+st_oop st_machine_find_method(st_machine *machine, st_oop class, st_oop selector);
+st_oop st_machine_lookup_cached(st_machine *machine, st_oop class, st_oop selector);
 void st_machine_clear_caches(st_machine *machine);
+void st_machine_methods_changed(st_machine *machine, st_oop class, st_oop selector);
+void st_machine_flush_code(st_machine *machine);
+void st_machine_remap(st_machine *machine);
+const st_oop *st_machine_method_code(st_machine *machine, st_oop method);
+void st_machine_materialize_contexts(st_machine *machine);
+
+static inline bool st_machine_is_stack_context(st_machine *machine, st_oop context) {
+	return st_detag_pointer(context) >= machine->frames_start && st_detag_pointer(context) < machine->frames_end;
+}
 
 #endif /* __ST_CPU_H__ */
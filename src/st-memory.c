@@ -106,15 +106,8 @@ static void grow_heap(st_uint min_size_oops) {
 	ensure_metadata();
 }
 
-st_memory *st_memory_new(void) {
-	st_oop *ptr;
-	st_ulong size_bits;
-	st_heap *heap;
-
-	heap = st_heap_new(RESERVED_SIZE);
-	if (!heap)
-		abort();
-
+/* objects take up the first size bytes of the heap */
+static st_memory *memory_new(st_heap *heap, st_uint size) {
 	if (!st_heap_grow(heap, INITIAL_COMMIT_SIZE))
 		abort();
 
@@ -123,13 +116,15 @@ st_memory *st_memory_new(void) {
 	memory->heap = heap;
 	memory->start = (st_oop *) heap->start;
 	memory->end = (st_oop *) heap->p;
-	memory->p = memory->start;
+	memory->p = memory->start + size / sizeof(st_oop);
+	memory->bytes_allocated = size;
 
 	memory->roots = ptr_array_new(15);
 
 	memory->total_pause_time.tv_sec = 0;
 	memory->total_pause_time.tv_nsec = 0;
 	memory->counter = 0;
+	memory->total_allocated = 0;
 
 	memory->mark_stack = st_malloc(MARK_STACK_SIZE);
 	memory->mark_stack_size = MARK_STACK_SIZE;
@@ -138,8 +133,6 @@ st_memory *st_memory_new(void) {
 	memory->alloc_bits = NULL;
 	memory->offsets = NULL;
 
-	memory->free_context = 0;
-
 	memory->ht = st_identity_hashtable_new();
 
 	ensure_metadata();
@@ -147,6 +140,35 @@ st_memory *st_memory_new(void) {
 	return memory;
 }
 
+st_memory *st_memory_new(void) {
+	st_heap *heap;
+
+	heap = st_heap_new(RESERVED_SIZE);
+	if (!heap)
+		abort();
+
+	return memory_new(heap, 0);
+}
+
+/*
+ * Creates the heap from the objects in size bytes of a file, mapped at
+ * address if that is free. Answers NULL if the file can't be mapped.
+ */
+st_memory *st_memory_new_mapped(st_pointer address, int fd, off_t offset, st_uint size) {
+	st_heap *heap;
+
+	heap = st_heap_new_at(address, RESERVED_SIZE);
+	if (!heap)
+		return NULL;
+
+	if (!st_heap_map_file(heap, fd, offset, size)) {
+		st_heap_destroy(heap);
+		return NULL;
+	}
+
+	return memory_new(heap, size);
+}
+
 void st_memory_destroy(void) {
 	st_free(memory);
 }
@@ -162,7 +184,7 @@ void st_memory_remove_root(st_oop object) {
 st_oop st_memory_allocate(st_uint size) {
 	st_oop *chunk;
 
-	st_assert (size >= 2);
+	st_assert (size >= ST_SIZE_OOPS (struct st_header));
 
 	if (memory->counter > ST_COLLECTION_THRESHOLD)
 		return 0;
@@ -176,31 +198,6 @@ st_oop st_memory_allocate(st_uint size) {
 	return st_tag_pointer(chunk);
 }
 
-st_oop st_memory_allocate_context(void) {
-	st_oop context;
-
-	if (ST_LIKELY (memory->free_context)) {
-		context = memory->free_context;
-		memory->free_context = ST_CONTEXT_PART_SENDER (memory->free_context);
-		return context;
-	}
-
-	context = st_memory_allocate(ST_SIZE_OOPS (struct st_method_context) + 32);
-	if (context == 0) {
-		st_memory_perform_gc();
-		context = st_memory_allocate(ST_SIZE_OOPS (struct st_method_context) + 32);
-		st_assert (context != 0);
-	}
-	st_object_initialize_header(context, ST_METHOD_CONTEXT_CLASS);
-
-	return context;
-}
-
-void st_memory_recycle_context(st_oop context) {
-	ST_CONTEXT_PART_SENDER (context) = memory->free_context;
-	memory->free_context = context;
-}
-
 static inline bool get_bit(st_uchar *bits, st_uint index) {
 	return (bits[index >> 3] >> (index & 0x7)) & 1;
 }
@@ -209,6 +206,11 @@ static inline void set_bit(st_uchar *bits, st_uint index) {
 	bits[index >> 3] |= 1 << (index & 0x7);
 }
 
+/* activation records on the frame stack are not part of the heap */
+static inline bool in_heap(st_oop object) {
+	return st_detag_pointer(object) >= memory->start && st_detag_pointer(object) < memory->end;
+}
+
 static inline st_uint bit_index(st_oop object) {
 	return st_detag_pointer(object) - memory->start;
 }
@@ -240,7 +242,8 @@ static st_uint object_size(st_oop object) {
 		case ST_FORMAT_FLOAT:
 			return ST_SIZE_OOPS (struct st_float);
 		case ST_FORMAT_LARGE_INTEGER:
-			return ST_SIZE_OOPS (struct st_large_integer);
+			return ST_SIZE_OOPS (struct st_large_integer)
+			       + ST_ROUNDED_UP_OOPS (st_large_integer_digit_count(object) * sizeof(mp_digit));
 		case ST_FORMAT_HANDLE:
 			return ST_SIZE_OOPS (struct st_handle);
 		case ST_FORMAT_ARRAY:
@@ -253,11 +256,9 @@ static st_uint object_size(st_oop object) {
 		case ST_FORMAT_FLOAT_ARRAY:
 			return ST_SIZE_OOPS (struct st_arrayed_object) + (st_smi_value(st_arrayed_object_size(object)) * ST_SIZE_OOPS (double));
 		case ST_FORMAT_INTEGER_ARRAY:
-			/* object format not used yet */
-			abort();
-			break;
+			return ST_SIZE_OOPS (struct st_arrayed_object) + (st_smi_value(st_arrayed_object_size(object)) * ST_SIZE_OOPS (int64_t));
 		case ST_FORMAT_CONTEXT:
-			return ST_SIZE_OOPS (struct st_header) + st_object_instance_size(object) + 32;
+			return ST_SIZE_OOPS (struct st_header) + st_object_instance_size(object) + st_object_stack_size(object);
 	}
 	/* should not reach */
 	abort();
@@ -316,7 +317,7 @@ static inline st_oop remap_oop(st_oop ref) {
 	st_uint ordinal;
 	st_oop *offset;
 
-	if (!st_object_is_heap(ref) || ref == ST_NIL)
+	if (!st_object_is_heap(ref) || ref == ST_NIL || !in_heap(ref))
 		return ref;
 
 	ordinal = compute_ordinal_number(memory, ref);
@@ -343,18 +344,27 @@ static void st_memory_remap(void) {
 
 	p = memory->start;
 	while (p < memory->p) {
+#ifndef ST_HAVE_COMPACT_HEADERS
 		p[1] = remap_oop(p[1]);
+#endif
 		object_contents(st_tag_pointer(p), &oops, &size);
 		for (st_uint i = 0; i < size; i++) {
 			oops[i] = remap_oop(oops[i]);
 		}
 		p += object_size(st_tag_pointer(p));
 	}
-}
 
-static inline void basic_finalize(st_oop object) {
-	if (ST_UNLIKELY (st_object_format(object) == ST_FORMAT_LARGE_INTEGER))
-		mp_clear(st_large_integer_value(object));
+	p = __machine.frames_start;
+	while (p < __machine.frames_top) {
+#ifndef ST_HAVE_COMPACT_HEADERS
+		p[1] = remap_oop(p[1]);
+#endif
+		object_contents(st_tag_pointer(p), &oops, &size);
+		for (st_uint i = 0; i < size; i++) {
+			oops[i] = remap_oop(oops[i]);
+		}
+		p += object_size(st_tag_pointer(p));
+	}
 }
 
 static void st_memory_compact(void) {
@@ -375,10 +385,8 @@ static void st_memory_compact(void) {
 	}
 	to = p;
 
-	while (!ismarked(st_tag_pointer(p)) && p < memory->p) {
-		basic_finalize(st_tag_pointer(p));
+	while (!ismarked(st_tag_pointer(p)) && p < memory->p)
 		p += object_size(st_tag_pointer(p));
-	}
 	from = p;
 
 	if (from == to && p >= memory->p)
@@ -405,7 +413,6 @@ static void st_memory_compact(void) {
 			from += size;
 		}
 		else {
-			basic_finalize(st_tag_pointer(from));
 			if (st_object_is_hashed(st_tag_pointer(from)))
 				st_identity_hashtable_remove(memory->ht, st_tag_pointer(from));
 			from += object_size(st_tag_pointer(from));
@@ -428,7 +435,7 @@ static st_uint grow_marking_stack(void) {
 
 static void st_memory_mark(void) {
 	st_oop object;
-	st_oop *oops, *stack;
+	st_oop *oops, *stack, *p;
 	st_uint size, stack_size, sp;
 
 	sp = 0;
@@ -439,18 +446,61 @@ static void st_memory_mark(void) {
 		stack[sp++] = (st_oop) ptr_array_get_index(memory->roots, i);
 	stack[sp++] = __machine.context;
 
+	/* the last message sent is remapped too, so it must survive */
+	stack[sp++] = __machine.message_receiver;
+	stack[sp++] = __machine.message_selector;
+	stack[sp++] = __machine.new_method;
+
+#ifdef ST_HAVE_COMPACT_HEADERS
+	/* objects refer to their classes only through the class table */
+	for (st_uint i = 1; i < __machine.class_count; i++) {
+		if (ST_UNLIKELY (sp >= stack_size)) {
+			stack_size = grow_marking_stack();
+			stack = memory->mark_stack;
+			st_log("gc", "increased size of marking stack");
+		}
+		stack[sp++] = __machine.classes[i];
+	}
+#endif
+
+	/* activations on the frame stack can't be marked themselves, so
+	   their contents are scanned up front */
+	for (p = __machine.frames_start; p < __machine.frames_top; p += object_size(st_tag_pointer(p))) {
+		if (ST_UNLIKELY (sp >= stack_size)) {
+			stack_size = grow_marking_stack();
+			stack = memory->mark_stack;
+			st_log("gc", "increased size of marking stack");
+		}
+#ifndef ST_HAVE_COMPACT_HEADERS
+		stack[sp++] = p[1];
+#endif
+		object_contents(st_tag_pointer(p), &oops, &size);
+		for (st_uint i = 0; i < size; i++) {
+			if (ST_UNLIKELY (sp >= stack_size)) {
+				stack_size = grow_marking_stack();
+				stack = memory->mark_stack;
+				st_log("gc", "increased size of marking stack");
+			}
+			if (oops[i] != ST_NIL) {
+				stack[sp++] = oops[i];
+			}
+		}
+	}
+
 	while (sp > 0) {
 		object = stack[--sp];
-		if (!st_object_is_heap(object) || ismarked(object))
+		if (!st_object_is_heap(object) || !in_heap(object) || ismarked(object))
 			continue;
 
 		set_marked(object);
+#ifndef ST_HAVE_COMPACT_HEADERS
 		if (ST_UNLIKELY (sp >= stack_size)) {
 			stack_size = grow_marking_stack();
 			stack = memory->mark_stack;
 			st_log("gc", "increased size of marking stack");
 		}
 		stack[sp++] = ST_OBJECT_CLASS (object);
+#endif
 		object_contents(object, &oops, &size);
 		for (st_uint i = 0; i < size; i++) {
 			if (ST_UNLIKELY (sp >= stack_size)) {
@@ -466,14 +516,13 @@ static void st_memory_mark(void) {
 }
 
 static void remap_machine(struct st_machine *machine) {
-	st_oop context, home;
+	st_oop context;
 
 	context = remap_oop(machine->context);
 	if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS) {
-		home = ST_BLOCK_CONTEXT_HOME (context);
-		machine->method = ST_METHOD_CONTEXT_METHOD (home);
-		machine->receiver = ST_METHOD_CONTEXT_RECEIVER (home);
-		machine->temps = ST_METHOD_CONTEXT_STACK (home);
+		machine->method = ST_BLOCK_CONTEXT_METHOD (context);
+		machine->receiver = ST_BLOCK_CONTEXT_RECEIVER (context);
+		machine->temps = ST_BLOCK_CONTEXT_STACK (context);
 		machine->stack = ST_BLOCK_CONTEXT_STACK (context);
 	}
 	else {
@@ -483,8 +532,10 @@ static void remap_machine(struct st_machine *machine) {
 		machine->stack = ST_METHOD_CONTEXT_STACK (context);
 	}
 
+	/* threaded code stays where it is, unless it was flushed */
 	machine->context = context;
-	machine->bytecode = st_method_bytecode_bytes(machine->method);
+	if (context != ST_NIL && machine->code == NULL)
+		machine->code = st_machine_method_code(machine, machine->method);
 	machine->message_receiver = remap_oop(machine->message_receiver);
 	machine->message_selector = remap_oop(machine->message_selector);
 	machine->new_method = remap_oop(machine->new_method);
@@ -499,6 +550,9 @@ static void remap_globals(void) {
 	for (i = 0; i < ST_N_ELEMENTS (__machine.selectors); i++)
 		__machine.selectors[i] = remap_oop(__machine.selectors[i]);
 
+	for (i = 0; i < __machine.class_count; i++)
+		__machine.classes[i] = remap_oop(__machine.classes[i]);
+
 	for (i = 0; i < memory->roots->length; i++) {
 		ptr_array_set_index(memory->roots,
 		                    i,
@@ -520,9 +574,8 @@ static void garbage_collect(void) {
 	double times[3];
 	struct timespec tm;
 
-	/* clear context pool */
-	memory->free_context = 0;
 	memory->bytes_allocated += memory->counter;
+	memory->total_allocated += memory->counter;
 
 	clear_metadata();
 
@@ -547,12 +600,12 @@ static void garbage_collect(void) {
 	st_memory_remap();
 	remap_globals();
 	remap_machine(&__machine);
+	st_machine_remap(&__machine);
 	timer_stop(&tm);
 
 	times[2] = st_timespec_to_double_seconds(&tm);
 	st_timespec_add(&memory->total_pause_time, &tm, &memory->total_pause_time);
 
-	st_machine_clear_caches(&__machine);
 	memory->counter = 0;
 
 	st_log("gc", "\n"
@@ -566,6 +619,64 @@ static void garbage_collect(void) {
 	       times[0], times[1], times[2]);
 }
 
+static inline st_oop relocate_oop(st_oop ref, st_oop *from, st_oop *to, st_oop delta) {
+	if (st_object_is_heap(ref) && st_detag_pointer(ref) >= from && st_detag_pointer(ref) < to)
+		return ref + delta;
+	return ref;
+}
+
+/*
+ * Adjusts all references to objects, in the heap and in the roots, after
+ * the heap was mapped at a different address than it started at before.
+ */
+void st_memory_relocate(st_oop *old_start) {
+	st_oop *from, *to, *oops, *p;
+	st_oop delta;
+	st_uint i, size;
+
+	if (old_start == memory->start)
+		return;
+
+	from = old_start;
+	to = old_start + (memory->p - memory->start);
+	delta = (st_oop) memory->start - (st_oop) old_start;
+
+	for (p = memory->start; p < memory->p; p += object_size(st_tag_pointer(p))) {
+#ifndef ST_HAVE_COMPACT_HEADERS
+		p[1] = relocate_oop(p[1], from, to, delta);
+#endif
+		object_contents(st_tag_pointer(p), &oops, &size);
+		for (i = 0; i < size; i++)
+			oops[i] = relocate_oop(oops[i], from, to, delta);
+	}
+
+	for (i = 0; i < ST_N_ELEMENTS (__machine.globals); i++)
+		__machine.globals[i] = relocate_oop(__machine.globals[i], from, to, delta);
+
+	for (i = 0; i < ST_N_ELEMENTS (__machine.selectors); i++)
+		__machine.selectors[i] = relocate_oop(__machine.selectors[i], from, to, delta);
+
+	for (i = 0; i < __machine.class_count; i++)
+		__machine.classes[i] = relocate_oop(__machine.classes[i], from, to, delta);
+
+	for (i = 0; i < memory->roots->length; i++) {
+		ptr_array_set_index(memory->roots,
+		                    i,
+		                    (st_pointer) relocate_oop((st_oop) ptr_array_get_index(memory->roots, i),
+		                                              from, to, delta));
+	}
+}
+
 st_oop st_memory_remap_reference(st_oop reference) {
 	return remap_oop(reference);
 }
+
+/*
+ * Answers whether reference survived the last gc, and so may be passed
+ * to st_memory_remap_reference(). Anything outside the heap survives.
+ */
+bool st_memory_is_live(st_oop reference) {
+	if (!st_object_is_heap(reference) || reference == ST_NIL || !in_heap(reference))
+		return true;
+	return ismarked(reference);
+}
@@ -55,29 +55,28 @@ typedef struct st_memory
     ptr_array  roots;
     st_uint    counter;
 
-    /* free context pool */
-    st_oop     free_context;
-
     /* statistics */
     struct timespec total_pause_time;     /* total accumulated pause time */
     st_ulong bytes_allocated;             /* current number of allocated bytes */
     st_ulong bytes_collected;             /* number of bytes collected in last compaction */
+    st_ulong total_allocated;             /* number of bytes allocated since startup, up to the last collection */
 
     st_identity_hashtable *ht;
 
 } st_memory;
 
 st_memory *st_memory_new             (void);
+st_memory *st_memory_new_mapped      (st_pointer address, int fd, off_t offset, st_uint size);
 void       st_memory_destroy         (void);
 void       st_memory_add_root        (st_oop object);
 void       st_memory_remove_root     (st_oop object);
 st_oop     st_memory_allocate        (st_uint size);
 
-st_oop     st_memory_allocate_context (void);
-void       st_memory_recycle_context  (st_oop context);
-
 void       st_memory_perform_gc       (void);
 
 st_oop     st_memory_remap_reference  (st_oop reference);
+bool       st_memory_is_live          (st_oop reference);
+
+void       st_memory_relocate         (st_oop *old_start);
 
 #endif /* __ST_MEMORY__ */
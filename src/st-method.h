@@ -37,6 +37,8 @@ struct st_method {
 	st_oop bytecode;
 	st_oop literals;
 	st_oop selector;
+	/* st_threaded_code pointer, which the gc takes for a SmallInteger */
+	st_oop code;
 };
 
 typedef enum {
@@ -45,6 +47,7 @@ typedef enum {
 	ST_METHOD_RETURN_INSTVAR,
 	ST_METHOD_RETURN_LITERAL,
 	ST_METHOD_PRIMITIVE,
+	ST_METHOD_LAZY,
 
 } st_method_flags;
 
@@ -63,6 +66,7 @@ typedef enum {
 #define ST_METHOD_LITERALS(oop) (ST_METHOD (oop)->literals)
 #define ST_METHOD_BYTECODE(oop) (ST_METHOD (oop)->bytecode)
 #define ST_METHOD_SELECTOR(oop) (ST_METHOD (oop)->selector)
+#define ST_METHOD_CODE(oop)     (ST_METHOD (oop)->code)
 
 /*
  * CompiledMethod Header:
@@ -80,15 +84,16 @@ typedef enum {
  *   2 : The method simply returns an instance variable. Ditto.
  *   3 : The method simply returns a literal. Ditto.
  *   4 : The method performs a primitive operation.
+ *   5 : The method is not compiled yet. A send which finds it compiles it first.
  *
  * Bitfield format
  * 
  * flag = 0:
- *   [ flag: 3 | arg_count: 5 | temp_count: 6 | unused: 7 | large_context: 1 | primitive: 8 | tag: 2 ]
+ *   [ flag: 3 | arg_count: 5 | temp_count: 6 | stack_depth: 8 | primitive: 8 | tag: 2 ]
  *
  *   arg_count:      number of args
  *   temp_count:     number of temps
- *   stack_depth:    depth of stack
+ *   stack_depth:    maximum depth of the operand stack
  *   primitive:      index of a primitive method
  *   tag:            The usual smi tag
  *
@@ -111,6 +116,12 @@ typedef enum {
  *       0:              4
  *       1:              5
  *       2:              6
+ *
+ * flag = 5:
+ *   header: [ flag: 3 | arg_count: 5 | unused: 22 | tag: 2 ]
+ *
+ *   The method has no bytecode. Its literals give the file it was read
+ *   from and where its source lies in it, see st_compile_lazy_method().
  */
 
 #define _ST_METHOD_SET_BITFIELD(bitfield, field, value)            \
@@ -124,8 +135,7 @@ enum {
 	_ST_METHOD_FLAG_BITS = 3,
 	_ST_METHOD_ARG_BITS = 5,
 	_ST_METHOD_TEMP_BITS = 6,
-	_ST_METHOD_UNUSED_BITS = 7,
-	_ST_METHOD_LARGE_BITS = 1,
+	_ST_METHOD_STACK_BITS = 8,
 	_ST_METHOD_INSTVAR_BITS = 16,
 	_ST_METHOD_LITERAL_BITS = 4,
 	_ST_METHOD_PRIMITIVE_BITS = 8,
@@ -133,14 +143,13 @@ enum {
 	_ST_METHOD_PRIMITIVE_SHIFT = ST_TAG_SIZE,
 	_ST_METHOD_INSTVAR_SHIFT = ST_TAG_SIZE,
 	_ST_METHOD_LITERAL_SHIFT = ST_TAG_SIZE,
-	_ST_METHOD_LARGE_SHIFT = _ST_METHOD_PRIMITIVE_BITS + _ST_METHOD_PRIMITIVE_SHIFT,
-	_ST_METHOD_UNUSED_SHIFT = _ST_METHOD_LARGE_BITS + _ST_METHOD_LARGE_SHIFT,
-	_ST_METHOD_TEMP_SHIFT = _ST_METHOD_UNUSED_BITS + _ST_METHOD_UNUSED_SHIFT,
+	_ST_METHOD_STACK_SHIFT = _ST_METHOD_PRIMITIVE_BITS + _ST_METHOD_PRIMITIVE_SHIFT,
+	_ST_METHOD_TEMP_SHIFT = _ST_METHOD_STACK_BITS + _ST_METHOD_STACK_SHIFT,
 	_ST_METHOD_ARG_SHIFT = _ST_METHOD_TEMP_BITS + _ST_METHOD_TEMP_SHIFT,
 	_ST_METHOD_FLAG_SHIFT = _ST_METHOD_ARG_BITS + _ST_METHOD_ARG_SHIFT,
 
 	_ST_METHOD_PRIMITIVE_MASK = ST_NTH_MASK (_ST_METHOD_PRIMITIVE_BITS),
-	_ST_METHOD_LARGE_MASK = ST_NTH_MASK (_ST_METHOD_LARGE_BITS),
+	_ST_METHOD_STACK_MASK = ST_NTH_MASK (_ST_METHOD_STACK_BITS),
 	_ST_METHOD_INSTVAR_MASK = ST_NTH_MASK (_ST_METHOD_INSTVAR_BITS),
 	_ST_METHOD_LITERAL_MASK = ST_NTH_MASK (_ST_METHOD_LITERAL_BITS),
 	_ST_METHOD_TEMP_MASK = ST_NTH_MASK (_ST_METHOD_TEMP_BITS),
@@ -156,8 +165,8 @@ static inline int st_method_get_arg_count(st_oop method) {
 	return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER(method), ARG);
 }
 
-static inline int st_method_get_large_context(st_oop method) {
-	return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER(method), LARGE);
+static inline int st_method_get_stack_depth(st_oop method) {
+	return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER(method), STACK);
 }
 
 static inline int st_method_get_primitive_index(st_oop method) {
@@ -180,8 +189,8 @@ static inline void st_method_set_temp_count(st_oop method, int count) {
 	_ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER(method), TEMP, count);
 }
 
-static inline void st_method_set_large_context(st_oop method, bool is_large) {
-	_ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER(method), LARGE, is_large);
+static inline void st_method_set_stack_depth(st_oop method, int depth) {
+	_ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER(method), STACK, depth);
 }
 
 static inline void st_method_set_primitive_index(st_oop method, int index) {
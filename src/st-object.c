@@ -40,7 +40,7 @@ void
 st_object_initialize_header (st_oop object, st_oop class)
 {
     ST_OBJECT_MARK (object)  = 0 | ST_MARK_TAG;
-    ST_OBJECT_CLASS (object) = class;
+    st_object_set_class (object, class);
     st_object_set_format (object, st_smi_value (ST_BEHAVIOR_FORMAT (class)));
     st_object_set_instance_size (object, st_smi_value (ST_BEHAVIOR_INSTANCE_SIZE (class)));
 }
@@ -54,7 +54,7 @@ st_object_equal (st_oop object, st_oop other)
     if (st_object_class (object) == ST_CHARACTER_CLASS)
 	return st_character_equal (object, other);
 
-    if (ST_OBJECT_CLASS (object) == ST_FLOAT_CLASS)
+    if (st_object_class (object) == ST_FLOAT_CLASS)
 	return st_float_equal (object, other);
 
     if (ST_OBJECT_CLASS (object) == ST_ASSOCIATION_CLASS)
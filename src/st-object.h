@@ -32,15 +32,22 @@
 
 #define ST_HEADER(oop)        ((struct st_header *) st_detag_pointer (oop))
 #define ST_OBJECT_MARK(oop)   (ST_HEADER (oop)->mark)
-#define ST_OBJECT_CLASS(oop)  (ST_HEADER (oop)->class)
 #define ST_OBJECT_FIELDS(oop) (ST_HEADER (oop)->fields)
 
+#ifdef ST_HAVE_COMPACT_HEADERS
+#define ST_OBJECT_CLASS(oop)  (__machine.classes[st_object_class_index (oop)])
+#else
+#define ST_OBJECT_CLASS(oop)  (ST_HEADER (oop)->class)
+#endif
+
 /* Every heap-allocated object starts with this header word */
 /* format of mark oop
- * [ unused: 16 | instance-size: 8 | format: 6 | tag: 2 ]
+ * [ class-index: 32 | unused: 5 | stack-size: 10 | hash: 1 | instance-size: 8 | format: 6 | tag: 2 ]
  *
  *
+ * class-index: index of the class in the class table, on 64-bit hosts only
  * format:      object format
+ * stack-size:  number of stack slots following the fields of a context
  * mark:        object contains a forwarding pointer
  * unused: 	not used yet (haven't implemented GC)
  * 
@@ -48,7 +55,9 @@
 struct st_header
 {
     st_oop mark;
+#ifndef ST_HAVE_COMPACT_HEADERS
     st_oop class;
+#endif
     st_oop fields[];
 };
 
@@ -61,7 +70,8 @@ struct st_header
 
 enum
 {
-    _ST_OBJECT_UNUSED_BITS   = 15,
+    _ST_OBJECT_UNUSED_BITS   = 5,
+    _ST_OBJECT_STACK_BITS    = 10,
     _ST_OBJECT_HASH_BITS     = 1,
     _ST_OBJECT_SIZE_BITS     = 8,
     _ST_OBJECT_FORMAT_BITS   = 6,
@@ -69,11 +79,13 @@ enum
     _ST_OBJECT_FORMAT_SHIFT  =  ST_TAG_SIZE,
     _ST_OBJECT_SIZE_SHIFT    = _ST_OBJECT_FORMAT_BITS + _ST_OBJECT_FORMAT_SHIFT,
     _ST_OBJECT_HASH_SHIFT    = _ST_OBJECT_SIZE_BITS  + _ST_OBJECT_SIZE_SHIFT,
-    _ST_OBJECT_UNUSED_SHIFT  = _ST_OBJECT_HASH_BITS   + _ST_OBJECT_HASH_SHIFT,
+    _ST_OBJECT_STACK_SHIFT   = _ST_OBJECT_HASH_BITS   + _ST_OBJECT_HASH_SHIFT,
+    _ST_OBJECT_UNUSED_SHIFT  = _ST_OBJECT_STACK_BITS  + _ST_OBJECT_STACK_SHIFT,
 
     _ST_OBJECT_FORMAT_MASK   = ST_NTH_MASK (_ST_OBJECT_FORMAT_BITS),
     _ST_OBJECT_SIZE_MASK     = ST_NTH_MASK (_ST_OBJECT_SIZE_BITS),
     _ST_OBJECT_HASH_MASK     = ST_NTH_MASK (_ST_OBJECT_HASH_BITS),
+    _ST_OBJECT_STACK_MASK    = ST_NTH_MASK (_ST_OBJECT_STACK_BITS),
     _ST_OBJECT_UNUSED_MASK   = ST_NTH_MASK (_ST_OBJECT_UNUSED_BITS),
 };
 
@@ -135,6 +147,35 @@ st_object_set_instance_size (st_oop object, st_uint size)
     _ST_OBJECT_SET_BITFIELD (ST_OBJECT_MARK (object), SIZE, size);
 }
 
+static inline st_uint
+st_object_stack_size (st_oop object)
+{
+    return _ST_OBJECT_GET_BITFIELD (ST_OBJECT_MARK (object), STACK);
+}
+
+static inline void
+st_object_set_stack_size (st_oop object, st_uint size)
+{
+    _ST_OBJECT_SET_BITFIELD (ST_OBJECT_MARK (object), STACK, size);
+}
+
+#ifdef ST_HAVE_COMPACT_HEADERS
+
+static inline st_uint
+st_object_class_index (st_oop object)
+{
+    return ST_OBJECT_MARK (object) >> ST_CLASS_INDEX_SHIFT;
+}
+
+static inline void
+st_object_set_class_index (st_oop object, st_uint index)
+{
+    ST_OBJECT_MARK (object) = (ST_OBJECT_MARK (object) & (((st_oop) 1 << ST_CLASS_INDEX_SHIFT) - 1))
+	| ((st_oop) index << ST_CLASS_INDEX_SHIFT);
+}
+
+#endif
+
 static inline int
 st_object_tag (st_oop object)
 {
@@ -144,7 +185,21 @@ st_object_tag (st_oop object)
 static inline bool
 st_object_is_heap (st_oop object)
 {
+#ifdef ST_HAVE_IMMEDIATE_FLOATS
+    return (object & ST_NTH_MASK (ST_FLOAT_TAG_SIZE)) == ST_POINTER_TAG;
+#else
     return st_object_tag (object) == ST_POINTER_TAG;
+#endif
+}
+
+static inline bool
+st_object_is_immediate_float (st_oop object)
+{
+#ifdef ST_HAVE_IMMEDIATE_FLOATS
+    return (object & ST_NTH_MASK (ST_FLOAT_TAG_SIZE)) == ST_FLOAT_TAG;
+#else
+    return false;
+#endif
 }
 
 static inline bool
@@ -174,6 +229,9 @@ st_object_class (st_oop object)
     if (ST_UNLIKELY (st_object_is_character (object)))
 	return ST_CHARACTER_CLASS;
 
+    if (ST_UNLIKELY (st_object_is_immediate_float (object)))
+	return ST_FLOAT_CLASS;
+
     return ST_OBJECT_CLASS (object);
 }
 
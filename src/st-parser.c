@@ -230,6 +230,7 @@ parse_number (st_parser *parser)
 		mp_neg (&value, &value);
 
 	    node->literal.value = st_large_integer_new (&value);
+	    mp_clear (&value);
 
 	} else {
 	    node->literal.value = st_smi_new (integer);
@@ -878,7 +879,7 @@ parse_message_pattern (st_parser *parser, st_node *method)
 }
 
 static st_node *
-parse_method (st_parser *parser)
+parse_method (st_parser *parser, bool pattern_only)
 {   
     st_node *node;
 
@@ -889,6 +890,8 @@ parse_method (st_parser *parser)
     node->method.primitive = -1;
    
     parse_message_pattern (parser, node);
+    if (pattern_only)
+	return node;
     
     node->method.temporaries = parse_temporaries (parser);
     node->method.primitive   = parse_primitive (parser);
@@ -899,9 +902,8 @@ parse_method (st_parser *parser)
     return node;
 }
 
-st_node *
-st_parser_parse (st_lexer *lexer,
-		 st_compiler_error *error)
+static st_node *
+parse (st_lexer *lexer, st_compiler_error *error, bool pattern_only)
 {
     st_parser *parser;
     st_node   *method;
@@ -915,7 +917,7 @@ st_parser_parse (st_lexer *lexer,
     parser->in_block = false;
 
     if (!setjmp (parser->jmploc)) {
-	method = parse_method (parser); 
+	method = parse_method (parser, pattern_only); 
     } else {
 	method = NULL;
     }
@@ -925,3 +927,20 @@ st_parser_parse (st_lexer *lexer,
     return method;
 }
 
+st_node *
+st_parser_parse (st_lexer *lexer,
+		 st_compiler_error *error)
+{
+    return parse (lexer, error, false);
+}
+
+/* Parses no further than the message pattern of a method, which
+ * gives its selector and arguments.
+ */
+st_node *
+st_parser_parse_pattern (st_lexer *lexer,
+			 st_compiler_error *error)
+{
+    return parse (lexer, error, true);
+}
+
@@ -38,8 +38,11 @@
 #include "st-unicode.h"
 #include "st-compiler.h"
 #include "st-handle.h"
+#include "st-wide-string.h"
+#include "st-image.h"
 
 #include <math.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <setjmp.h>
@@ -47,6 +50,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
 
 
 #define ST_PRIMITIVE_FAIL(machine)			\
@@ -59,7 +63,7 @@ set_success (st_machine *machine, bool success)
     machine->success = machine->success && success;
 }
 
-static inline int
+static inline st_smi
 pop_integer (st_machine *machine)
 {
     st_oop object = ST_STACK_POP (machine);
@@ -76,10 +80,13 @@ pop_integer32 (st_machine *machine)
 {
     st_oop object = ST_STACK_POP (machine);
  
-    if (ST_LIKELY (st_object_is_smi (object)))
+    if (ST_LIKELY (st_object_is_smi (object))
+	&& st_smi_value (object) >= INT_MIN && st_smi_value (object) <= INT_MAX)
 	return st_smi_value (object);
-    else if (st_object_class (object) == ST_LARGE_INTEGER_CLASS)
-	return (int) mp_get_int (st_large_integer_value (object));
+    else if (st_object_class (object) == ST_LARGE_INTEGER_CLASS) {
+	mp_int value = st_large_integer_value (object);
+	return (int) mp_get_int (&value);
+    }
 
     ST_PRIMITIVE_FAIL (machine);
     return 0;
@@ -88,13 +95,13 @@ pop_integer32 (st_machine *machine)
 static void
 SmallInteger_add (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
-    int result;
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
+    st_smi result;
 
     if (ST_LIKELY (machine->success)) {
 	result = x + y; 
-	if (((result << 1) ^ (result << 2)) >= 0) {
+	if (st_smi_in_range (result)) {
 	    ST_STACK_PUSH (machine, st_smi_new (result));
 	    return;
 	} else {
@@ -108,14 +115,14 @@ SmallInteger_add (st_machine *machine)
 static void
 SmallInteger_sub (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
-    int result;
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
+    st_smi result;
 
 
     if (ST_LIKELY (machine->success)) {
-	result = x + y; 
-	if (((result << 1) ^ (result << 2)) >= 0) {
+	result = x - y; 
+	if (st_smi_in_range (result)) {
 	    ST_STACK_PUSH (machine, st_smi_new (result));
 	    return;
 	} else {
@@ -129,8 +136,8 @@ SmallInteger_sub (st_machine *machine)
 static void
 SmallInteger_lt (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -145,8 +152,8 @@ SmallInteger_lt (st_machine *machine)
 static void
 SmallInteger_gt (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -161,8 +168,8 @@ SmallInteger_gt (st_machine *machine)
 static void
 SmallInteger_le (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -177,8 +184,8 @@ SmallInteger_le (st_machine *machine)
 static void
 SmallInteger_ge (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -193,8 +200,8 @@ SmallInteger_ge (st_machine *machine)
 static void
 SmallInteger_eq (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -209,8 +216,8 @@ SmallInteger_eq (st_machine *machine)
 static void
 SmallInteger_ne (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -225,14 +232,13 @@ SmallInteger_ne (st_machine *machine)
 static void
 SmallInteger_mul (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
-    int64_t result;
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
+    st_smi result;
 
     if (machine->success) {
-	result = x * y;
-	if (result >= ST_SMALL_INTEGER_MIN && result <= ST_SMALL_INTEGER_MAX) {
-	    ST_STACK_PUSH (machine, st_smi_new ((int) result));
+	if (!__builtin_mul_overflow (x, y, &result) && st_smi_in_range (result)) {
+	    ST_STACK_PUSH (machine, st_smi_new (result));
 	    return;
 	} else {
 	    ST_PRIMITIVE_FAIL (machine);
@@ -246,13 +252,13 @@ SmallInteger_mul (st_machine *machine)
 static void
 SmallInteger_div (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
     
     if (ST_LIKELY (machine->success)) {
 
-	if (y != 0 && x % y == 0) {
+	if (y != 0 && x % y == 0 && st_smi_in_range (x / y)) {
 	    result = st_smi_new (x / y);
 	    ST_STACK_PUSH (machine, result);
 	    return;
@@ -267,14 +273,14 @@ SmallInteger_div (st_machine *machine)
 static void
 SmallInteger_intDiv (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
 
-	if (y != 0) {
-	    result = st_smi_new (x / y);
+	if (y != 0 && st_smi_in_range (x / y)) {
+	    result = st_smi_new (st_smi_floor_div (x, y));
 	    ST_STACK_PUSH (machine, result);
 	    return;
 	} else {
@@ -288,14 +294,19 @@ SmallInteger_intDiv (st_machine *machine)
 static void
 SmallInteger_mod (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
     
     if (ST_LIKELY (machine->success)) {
-	result = st_smi_new (x % y);
-	ST_STACK_PUSH (machine, result);
-	return;	
+
+	if (y != 0) {
+	    result = st_smi_new (st_smi_floor_mod (x, y));
+	    ST_STACK_PUSH (machine, result);
+	    return;
+	} else {
+	    ST_PRIMITIVE_FAIL (machine);
+	}
     }
     
     ST_STACK_UNPOP (machine, 2);
@@ -304,8 +315,8 @@ SmallInteger_mod (st_machine *machine)
 static void
 SmallInteger_bitOr (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result = ST_NIL;
 
     if (ST_LIKELY (machine->success)) {
@@ -320,8 +331,8 @@ SmallInteger_bitOr (st_machine *machine)
 static void
 SmallInteger_bitXor (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result;
 
     if (ST_LIKELY (machine->success)) {
@@ -336,8 +347,8 @@ SmallInteger_bitXor (st_machine *machine)
 static void
 SmallInteger_bitAnd (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result = ST_NIL;
 
     if (ST_LIKELY (machine->success)) {
@@ -352,20 +363,17 @@ SmallInteger_bitAnd (st_machine *machine)
 static void
 SmallInteger_bitShift (st_machine *machine)
 {
-    int y = pop_integer (machine);
-    int x = pop_integer (machine);
-    st_oop result = ST_NIL;
+    st_smi y = pop_integer (machine);
+    st_smi x = pop_integer (machine);
+    st_smi result;
 
     if (ST_LIKELY (machine->success)) {
-	if (y > 0)
-	    result = st_smi_new (x << y);
-	else if (y < 0)
-	    result = st_smi_new (x >> (-y));
-	else
-	    result = st_smi_new (x);
-
-	ST_STACK_PUSH (machine, result);
-	return;
+	if (st_smi_bit_shift (x, y, &result)) {
+	    ST_STACK_PUSH (machine, st_smi_new (result));
+	    return;
+	} else {
+	    ST_PRIMITIVE_FAIL (machine);
+	}
     }
 
     ST_STACK_UNPOP (machine, 2);
@@ -374,7 +382,7 @@ SmallInteger_bitShift (st_machine *machine)
 static void
 SmallInteger_asFloat (st_machine *machine)
 {
-    int x = pop_integer (machine);
+    st_smi x = pop_integer (machine);
     st_oop result = ST_NIL;
 
     if (ST_LIKELY (machine->success)) {
@@ -389,51 +397,142 @@ SmallInteger_asFloat (st_machine *machine)
 static void
 SmallInteger_asLargeInteger (st_machine *machine)
 {
-    int receiver = pop_integer (machine);
-    mp_int value;
+    st_smi receiver = pop_integer (machine);
     st_oop result;
 
-    mp_init_set (&value, abs (receiver));
-
-    if (receiver < 0)
-	mp_neg (&value, &value);
-    
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_from_smi (receiver);
     ST_STACK_PUSH (machine, result);
 }
 
-#define VALUE(oop) (&(ST_LARGE_INTEGER(oop)->value))
+/* LargeInteger results are computed into this value, which keeps its
+   digits from one primitive to the next, and are then copied into the heap */
+static mp_int *
+large_integer_result (void)
+{
+    static mp_int value;
+    static bool initialized = false;
+
+    if (ST_UNLIKELY (!initialized)) {
+	mp_init (&value);
+	initialized = true;
+    }
+
+    return &value;
+}
 
 /* useful macros to avoid duplication of error-handling code */
 
-#define OP_PROLOGUE			 \
-    mp_int value;                        \
-    mp_init (&value);
+#define OP_PROLOGUE				\
+    mp_int *value = large_integer_result ();
 
+/* fails the primitive when libtommath could not compute a result,
+   leaving the previous contents of value in place */
+#define OP_CHECK(status, count)			\
+    if ((status) != MP_OKAY) {			\
+	ST_PRIMITIVE_FAIL (machine);		\
+	ST_STACK_UNPOP (machine, count);	\
+	return;					\
+    }
 
 #define BINARY_OP(op, a, b)                     \
 OP_PROLOGUE					\
-    result = op (VALUE (a), VALUE (b), &value);
+    mp_digit da[ST_LARGE_INTEGER_INT64_DIGITS];	\
+    mp_digit db[ST_LARGE_INTEGER_INT64_DIGITS];	\
+    mp_int x = large_integer_value (a, da);	\
+    mp_int y = large_integer_value (b, db);	\
+    OP_CHECK (op (&x, &y, value), 2);
 
 #define BINARY_DIV_OP(op, a, b)                       \
 OP_PROLOGUE                                           \
-    result = op (VALUE (a), VALUE (b), &value, NULL);
+    mp_digit da[ST_LARGE_INTEGER_INT64_DIGITS];	      \
+    mp_digit db[ST_LARGE_INTEGER_INT64_DIGITS];	      \
+    mp_int x = large_integer_value (a, da);	      \
+    mp_int y = large_integer_value (b, db);	      \
+    OP_CHECK (op (&x, &y, value, NULL), 2);
+
+/* answers the result computed in 64 bits, when it and the operands fit */
+#define INT64_OP(builtin, a, b)						\
+    {									\
+	int64_t x, y, z;						\
+	if (integer_int64 (a, &x) && integer_int64 (b, &y)		\
+	    && !builtin (x, y, &z)) {					\
+	    ST_STACK_PUSH (machine, st_large_integer_new_from_int64 (z)); \
+	    return;							\
+	}								\
+    }
 
 #define UNARY_OP(op, a)              \
 OP_PROLOGUE                          \
-    result = op (VALUE (a), &value);
+    mp_int x = st_large_integer_value (a); \
+    OP_CHECK (op (&x, value), 1);
 
 
+/* SmallInteger arguments are taken as they are, instead of failing and
+   having the fallback code convert them to LargeIntegers */
 static inline st_oop
 pop_large_integer (st_machine *machine)
 {
     st_oop object = ST_STACK_POP (machine);
 
-    set_success (machine, st_object_class (object) == ST_LARGE_INTEGER_CLASS);
+    set_success (machine, st_object_is_smi (object)
+		 || st_object_class (object) == ST_LARGE_INTEGER_CLASS);
     
     return object;
 }
 
+static inline bool
+integer_int64 (st_oop object, int64_t *value)
+{
+    if (st_object_is_smi (object)) {
+	*value = st_smi_value (object);
+	return true;
+    }
+
+    return st_large_integer_get_int64 (object, value);
+}
+
+/* an mp_int reading the digits of a LargeInteger, or holding those of
+   a SmallInteger in digits */
+static inline mp_int
+large_integer_value (st_oop object, mp_digit *digits)
+{
+    if (st_object_is_smi (object))
+	return st_large_integer_int64_value (st_smi_value (object), digits);
+
+    return st_large_integer_value (object);
+}
+
+/* division primitives fail on a zero divisor, leaving the error to
+   the fallback code, before trying either int64_t or libtommath */
+static inline bool
+large_integer_is_zero (st_oop object)
+{
+    mp_int value;
+
+    if (st_object_is_smi (object))
+	return object == st_smi_new (0);
+
+    value = st_large_integer_value (object);
+    return mp_iszero (&value);
+}
+
+static inline int
+large_integer_compare (st_oop a, st_oop b)
+{
+    mp_digit da[ST_LARGE_INTEGER_INT64_DIGITS];
+    mp_digit db[ST_LARGE_INTEGER_INT64_DIGITS];
+    int64_t x, y;
+    mp_int mx, my;
+
+    if (integer_int64 (a, &x) && integer_int64 (b, &y))
+	return x < y ? MP_LT : (x > y ? MP_GT : MP_EQ);
+
+    mx = large_integer_value (a, da);
+    my = large_integer_value (b, db);
+
+    return mp_cmp (&mx, &my);
+}
+
 static void
 LargeInteger_add (st_machine *machine)
 {
@@ -446,9 +545,11 @@ LargeInteger_add (st_machine *machine)
 	return;
     }
 
+    INT64_OP (__builtin_add_overflow, a, b);
+
     BINARY_OP (mp_add, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -463,10 +564,12 @@ LargeInteger_sub (st_machine *machine)
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
-    
+
+    INT64_OP (__builtin_sub_overflow, a, b);
+
     BINARY_OP (mp_sub, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -481,10 +584,12 @@ LargeInteger_mul (st_machine *machine)
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
-    
+
+    INT64_OP (__builtin_mul_overflow, a, b);
+
     BINARY_OP (mp_mul, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -493,28 +598,44 @@ LargeInteger_div (st_machine *machine)
 {
     st_oop b = pop_large_integer (machine);
     st_oop a = pop_large_integer (machine);
-    mp_int quotient, remainder;
+    mp_digit da[ST_LARGE_INTEGER_INT64_DIGITS];
+    mp_digit db[ST_LARGE_INTEGER_INT64_DIGITS];
+    mp_int x, y, quotient, remainder;
+    int64_t n, d;
     st_oop result;
+
+    if (machine->success && large_integer_is_zero (b))
+	set_success (machine, false);
     
     if (!machine->success) {
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
-    mp_init_multi (&quotient, &remainder, NULL);
-    mp_div (VALUE (a), VALUE (b), &quotient, &remainder);
-
-    int size;
-    char *str;
+    if (integer_int64 (a, &n) && integer_int64 (b, &d)
+	&& d != 0 && !(n == INT64_MIN && d == -1)) {
+	if (n % d == 0) {
+	    ST_STACK_PUSH (machine, st_large_integer_new_from_int64 (n / d));
+	} else {
+	    set_success (machine, false);
+	    ST_STACK_UNPOP (machine, 2);
+	}
+	return;
+    }
 
-    mp_radix_size (&remainder, 10, &size);
-    str  = st_malloc (size);
-    mp_toradix (&remainder, str, 10);
+    x = large_integer_value (a, da);
+    y = large_integer_value (b, db);
+    if (mp_init_multi (&quotient, &remainder, NULL) != MP_OKAY) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
 
-    if (mp_cmp_d (&remainder, 0) == MP_EQ) {
-	result = st_large_integer_new (&quotient);
+    if (mp_div (&x, &y, &quotient, &remainder) == MP_OKAY
+	&& mp_cmp_d (&remainder, 0) == MP_EQ) {
+	result = st_large_integer_new_normalized (&quotient);
 	ST_STACK_PUSH (machine, result);
-	mp_clear (&remainder);
+	mp_clear_multi (&quotient, &remainder, NULL);
     } else {
 	set_success (machine, false);
 	ST_STACK_UNPOP (machine, 2);
@@ -528,33 +649,75 @@ LargeInteger_intDiv (st_machine *machine)
     st_oop b = pop_large_integer (machine);
     st_oop a = pop_large_integer (machine);
     st_oop result;
+    int64_t n, d;
+
+    /* a SmallInteger divisor is left to Number>>//, which floors */
+    if (st_object_is_smi (b))
+	set_success (machine, false);
+
+    if (machine->success && large_integer_is_zero (b))
+	set_success (machine, false);
     
     if (!machine->success) {
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
     
+    /* truncates, as mp_div does */
+    if (integer_int64 (a, &n) && integer_int64 (b, &d)
+	&& d != 0 && !(n == INT64_MIN && d == -1)) {
+	ST_STACK_PUSH (machine, st_large_integer_new_from_int64 (n / d));
+	return;
+    }
+
     BINARY_DIV_OP (mp_div, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
+/* mp_mod, except that a zero remainder stays zero for a negative divisor */
+static int
+floored_mod (mp_int *a, mp_int *b, mp_int *c)
+{
+    int status;
+
+    status = mp_div (a, b, NULL, c);
+    if (status == MP_OKAY && !mp_iszero (c) && c->sign != b->sign)
+	status = mp_add (b, c, c);
+
+    return status;
+}
+
 static void
 LargeInteger_mod (st_machine *machine)
 {
     st_oop b = pop_large_integer (machine);
     st_oop a = pop_large_integer (machine);
     st_oop result;
+    int64_t n, d;
+
+    if (machine->success && large_integer_is_zero (b))
+	set_success (machine, false);
     
     if (!machine->success) {
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
     
-    BINARY_OP (mp_mod, a, b);
+    /* the remainder takes the sign of the divisor */
+    if (integer_int64 (a, &n) && integer_int64 (b, &d)
+	&& d != 0 && !(n == INT64_MIN && d == -1)) {
+	n = n % d;
+	if (n != 0 && (n < 0) != (d < 0))
+	    n += d;
+	ST_STACK_PUSH (machine, st_large_integer_new_from_int64 (n));
+	return;
+    }
 
-    result = st_large_integer_new (&value);
+    BINARY_OP (floored_mod, a, b);
+
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -572,7 +735,7 @@ LargeInteger_gcd (st_machine *machine)
     
     BINARY_OP (mp_gcd, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -590,7 +753,7 @@ LargeInteger_lcm (st_machine *machine)
     
     BINARY_OP (mp_lcm, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -607,7 +770,7 @@ LargeInteger_eq (st_machine *machine)
 	return;
     }
     
-    relation = mp_cmp (VALUE (a), VALUE (b));
+    relation = large_integer_compare (a, b);
     result = (relation == MP_EQ) ? ST_TRUE : ST_FALSE;
     ST_STACK_PUSH (machine, result);
 }
@@ -625,7 +788,7 @@ LargeInteger_ne (st_machine *machine)
 	return;
     }
     
-    relation = mp_cmp (VALUE (a), VALUE (b));
+    relation = large_integer_compare (a, b);
     result = (relation == MP_EQ) ? ST_FALSE : ST_TRUE;
     ST_STACK_PUSH (machine, result);
 }
@@ -643,7 +806,7 @@ LargeInteger_lt (st_machine *machine)
 	return;
     }
 
-    relation = mp_cmp (VALUE (a), VALUE (b));    
+    relation = large_integer_compare (a, b);    
     result = (relation == MP_LT) ? ST_TRUE : ST_FALSE;
     ST_STACK_PUSH (machine, result);
 }
@@ -662,7 +825,7 @@ LargeInteger_gt (st_machine *machine)
 	return;
     }
     
-    relation = mp_cmp (VALUE (a), VALUE (b));
+    relation = large_integer_compare (a, b);
     result = (relation == MP_GT) ? ST_TRUE : ST_FALSE;
     ST_STACK_PUSH (machine, result);
 }
@@ -680,7 +843,7 @@ LargeInteger_le (st_machine *machine)
 	return;
     }
     
-    relation = mp_cmp (VALUE (a), VALUE (b));
+    relation = large_integer_compare (a, b);
     result = (relation == MP_LT || relation == MP_EQ) ? ST_TRUE : ST_FALSE;
     ST_STACK_PUSH (machine, result);
 }
@@ -698,7 +861,7 @@ LargeInteger_ge (st_machine *machine)
 	return;
     }
     
-    relation = mp_cmp (VALUE (a), VALUE (b));
+    relation = large_integer_compare (a, b);
     result = (relation == MP_GT || relation == MP_EQ) ? ST_TRUE : ST_FALSE;
     ST_STACK_PUSH (machine, result);
 }
@@ -716,7 +879,7 @@ LargeInteger_squared (st_machine *machine)
     
     UNARY_OP (mp_sqr, receiver);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -734,7 +897,7 @@ LargeInteger_bitOr (st_machine *machine)
     
     BINARY_OP (mp_or, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -752,7 +915,7 @@ LargeInteger_bitAnd (st_machine *machine)
     
     BINARY_OP (mp_and, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -770,7 +933,7 @@ LargeInteger_bitXor (st_machine *machine)
     
     BINARY_OP (mp_xor, a, b);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -780,21 +943,25 @@ LargeInteger_bitShift (st_machine *machine)
     int displacement = pop_integer32 (machine);
     st_oop receiver     = pop_large_integer (machine);
     st_oop result;
-    mp_int value;
+    mp_int *value, x;
+    int status;
     
     if (!machine->success) {
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
-    mp_init (&value);
+    value = large_integer_result ();
+    x = st_large_integer_value (receiver);
 
     if (displacement >= 0)
-	mp_mul_2d (VALUE (receiver), displacement, &value);
+	status = mp_mul_2d (&x, displacement, value);
     else
-	mp_div_2d (VALUE (receiver), abs (displacement), &value, NULL);
+	status = mp_div_2d (&x, abs (displacement), value, NULL);
+
+    OP_CHECK (status, 2);
 
-    result = st_large_integer_new (&value);
+    result = st_large_integer_new_normalized (value);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -807,21 +974,21 @@ LargeInteger_asFloat (st_machine *machine)
     st_oop  receiver = pop_large_integer (machine);
     char   *string;
     double  result;
-    mp_int *m;
+    mp_int m;
     int i;
 
     m = st_large_integer_value (receiver);
-    if (m->used == 0) {
+    if (m.used == 0) {
 	ST_STACK_PUSH (machine, st_float_new (0));
 	return;
     }
 
-    i = m->used;
-    result = DIGIT (m, i);    
+    i = m.used - 1;
+    result = DIGIT (&m, i);
     while (--i >= 0)
-	result = (result * ST_DIGIT_RADIX) + DIGIT (m, i);
+	result = (result * ST_DIGIT_RADIX) + DIGIT (&m, i);
 
-    if (m->sign == MP_NEG)
+    if (m.sign == MP_NEG)
 	result = -result;
 
     ST_STACK_PUSH (machine, st_float_new (result));
@@ -853,15 +1020,15 @@ static void
 LargeInteger_hash (st_machine *machine)
 {
     st_oop receiver = ST_STACK_POP (machine);
-    mp_int *value;
+    mp_int value;
     int result;
     const char *c;
     unsigned int hash;
     int len;
 
     value = st_large_integer_value (receiver);
-    c = (const char *) value->dp;
-    len = value->used * sizeof (mp_digit);
+    c = (const char *) value.dp;
+    len = value.used * sizeof (mp_digit);
     hash = 5381;
 
     for(unsigned int i = 0; i < len; i++)
@@ -1223,11 +1390,17 @@ static void
 Float_truncated (st_machine *machine)
 {
     st_oop receiver = ST_STACK_POP (machine);
-    int result;
+    double result;
 
-    result = (int) trunc (st_float_value (receiver));
+    result = trunc (st_float_value (receiver));
 
-    ST_STACK_PUSH (machine, st_smi_new (result));
+    if (!(result >= ST_SMALL_INTEGER_MIN && result < -(double) ST_SMALL_INTEGER_MIN)) {
+	ST_PRIMITIVE_FAIL (machine);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    ST_STACK_PUSH (machine, st_smi_new ((st_smi) result));
 }
 
 static void
@@ -1253,7 +1426,13 @@ Float_integerPart (st_machine *machine)
 
     modf (st_float_value (receiver), &int_part);
 
-    result = st_smi_new ((int) int_part);
+    if (!(int_part >= ST_SMALL_INTEGER_MIN && int_part < -(double) ST_SMALL_INTEGER_MIN)) {
+	ST_PRIMITIVE_FAIL (machine);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    result = st_smi_new ((st_smi) int_part);
     ST_STACK_PUSH (machine, result);
 }
 
@@ -1293,8 +1472,7 @@ Float_printStringBase (st_machine *machine)
     st_oop string;
 
     if (!machine->success ||
-	!st_object_is_heap (receiver) ||
-	st_object_format (receiver) != ST_FORMAT_FLOAT) {
+	!st_object_is_float (receiver)) {
 	machine->success = false;
 	ST_STACK_UNPOP (machine, 2);
 	return;
@@ -1364,6 +1542,8 @@ Object_identityHash (st_machine *machine)
 	hash = st_smi_hash (object);
     else if (st_object_is_character (object))
 	hash = st_character_hash (object);
+    else if (st_object_is_immediate_float (object))
+	hash = (((uint64_t) object >> 32) ^ (object >> 3)) & ST_SMALL_INTEGER_MAX;
     else {
 	st_object_set_hashed (object, true);
 	hash = st_identity_hashtable_hash (memory->ht, object);
@@ -1436,6 +1616,15 @@ Object_copy (st_machine *machine)
 		sizeof (st_uint) * size);
 	break;
     }
+    case ST_FORMAT_INTEGER_ARRAY:
+    {
+	size = st_smi_value (st_arrayed_object_size (machine->message_receiver));
+	copy = st_object_new_arrayed (ST_OBJECT_CLASS (machine->message_receiver), size);
+	memcpy (st_integer_array_elements (copy),
+		st_integer_array_elements (machine->message_receiver),
+		sizeof (int64_t) * size);
+	break;
+    }
     case ST_FORMAT_FLOAT:
     {
 	copy = st_object_new (ST_FLOAT_CLASS);
@@ -1444,15 +1633,17 @@ Object_copy (st_machine *machine)
     }
     case ST_FORMAT_LARGE_INTEGER:
     {
-	mp_int value;
+	mp_int value, receiver;
 	int    result;
 
-	copy = st_object_new (ST_LARGE_INTEGER_CLASS);
-	
-	result = mp_init_copy (st_large_integer_value (copy),
-			       st_large_integer_value (machine->message_receiver));
+	/* the digits are copied out first, since allocating may move them */
+	receiver = st_large_integer_value (machine->message_receiver);
+	result = mp_init_copy (&value, &receiver);
 	if (result != MP_OKAY)
 	    abort ();
+
+	copy = st_large_integer_new (&value);
+	mp_clear (&value);
 	break;
     }
     case ST_FORMAT_HANDLE:
@@ -1461,7 +1652,6 @@ Object_copy (st_machine *machine)
 	ST_HANDLE_VALUE (copy) = ST_HANDLE_VALUE (machine->message_receiver);
 	break;
     case ST_FORMAT_CONTEXT:
-    case ST_FORMAT_INTEGER_ARRAY:
     default:
 	/* not implemented yet */
 	abort ();
@@ -1479,54 +1669,29 @@ Object_equivalent (st_machine *machine)
     ST_STACK_PUSH (machine, ((x == y) ? ST_TRUE : ST_FALSE));
 }
 
-static st_oop
-lookup_method (st_oop class, st_oop selector)
-{
-    st_oop method;
-    st_oop parent = class;
-    st_uint index;
-
-    while (parent != ST_NIL) {
-	method = st_dictionary_at (ST_BEHAVIOR_METHOD_DICTIONARY (parent), selector);
-	if (method != ST_NIL)
-	    return method;
-	parent = ST_BEHAVIOR_SUPERCLASS (parent);
-    }
-
-    return 0;
-}
-
 static void
 Object_perform (st_machine *machine)
 {
     st_oop receiver;
     st_oop selector;
     st_oop method;
-    st_uint selector_index;
 
-    selector = machine->message_selector;
-    machine->message_selector = machine->stack[machine->sp - machine->message_argcount];
+    selector = machine->stack[machine->sp - machine->message_argcount];
     receiver = machine->message_receiver;
 
-    set_success (machine, st_object_is_symbol (machine->message_selector));
-    method = lookup_method (st_object_class (receiver), machine->message_selector);
-    set_success (machine, st_method_get_arg_count (method) == (machine->message_argcount - 1));
-
-    if (machine->success) {
-	selector_index = machine->sp - machine->message_argcount;
-
-	st_oops_move (machine->stack + selector_index,
-		      machine->stack + selector_index + 1,
-		      machine->message_argcount - 1);
+    set_success (machine, st_object_is_symbol (selector));
+    if (!machine->success)
+	return;
 
-	machine->sp -= 1;
-	machine->message_argcount -= 1;
-	machine->new_method = method;
-	st_machine_execute_method (machine);
+    method = st_machine_lookup_cached (machine, st_object_class (receiver), selector);
+    set_success (machine, method != ST_NIL && st_method_get_arg_count (method) == (machine->message_argcount - 1));
+    if (!machine->success)
+	return;
 
-    } else {
-	machine->message_selector = selector;
-    }
+    machine->message_selector = selector;
+    machine->message_argcount -= 1;
+    machine->new_method = method;
+    st_machine_perform_method (machine);
 }
 
 static void
@@ -1538,50 +1703,43 @@ Object_perform_withArguments (st_machine *machine)
     st_oop array;
     int array_size;
 
-    array = ST_STACK_POP (machine);
+    array    = machine->stack[machine->sp - 1];
+    selector = machine->stack[machine->sp - 2];
+    receiver = machine->message_receiver;
 
     set_success (machine, st_object_format (array) == ST_FORMAT_ARRAY);
-
-    if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
-	method = ST_METHOD_CONTEXT_METHOD (ST_BLOCK_CONTEXT_HOME (machine->context));
-    else
-	method = ST_METHOD_CONTEXT_METHOD (machine->context);
+    set_success (machine, st_object_is_symbol (selector));
+    if (!machine->success)
+	return;
 
     array_size = st_smi_value (st_arrayed_object_size (array));
-    set_success (machine, (machine->sp + array_size - 1) < 32);
+    method = st_machine_lookup_cached (machine, st_object_class (receiver), selector);
+    set_success (machine, method != ST_NIL && st_method_get_arg_count (method) == array_size);
+    if (!machine->success)
+	return;
 
-    if (machine->success) {
-	
-	selector = machine->message_selector;
-	machine->message_selector = ST_STACK_POP (machine);
-	receiver = ST_STACK_PEEK (machine);
-	machine->message_argcount = array_size;
+    machine->message_selector = selector;
+    machine->message_argcount = array_size;
+    machine->new_method = method;
 
-	set_success (machine, st_object_is_symbol (machine->message_selector));
-    
+    /* Contexts are sized for the code that runs in them, so there is usually no
+       room to spread the arguments out on the stack. Primitives need them there,
+       but other methods can take them straight from the array. */
+    if (st_method_get_flags (method) == ST_METHOD_PRIMITIVE
+	&& machine->sp - 2 + array_size <= st_object_stack_size (machine->context)) {
+	machine->sp -= 2;
 	st_oops_copy (machine->stack + machine->sp,
 		      st_array_elements (array),
 		      array_size);
-
 	machine->sp += array_size;
 
-	method = lookup_method (st_object_class (receiver), machine->message_selector);
-	set_success (machine, st_method_get_arg_count (method) == array_size);
-    
-	if (machine->success) {
-	    machine->new_method = method;
-	    st_machine_execute_method (machine);
-	} else {
-	    machine->sp -= machine->message_argcount;
-	    ST_STACK_PUSH (machine, machine->message_selector);
-	    ST_STACK_PUSH (machine, array);
-	    machine->message_argcount = 2;
-	    machine->message_selector = selector;
-	}
-
-    } else {
-	ST_STACK_UNPOP (machine, 1);
+	st_machine_execute_method (machine);
+	return;
     }
+
+    machine->stack[machine->sp - 2] = array;
+    machine->sp -= 1;
+    st_machine_execute_method_with_arguments (machine);
 }
 
 static void
@@ -1643,8 +1801,7 @@ Behavior_newSize (st_machine *machine)
 	instance = st_float_array_allocate (class, size);
 	break;
     case ST_FORMAT_INTEGER_ARRAY:
-	/* not implemented */
-	abort ();
+	instance = st_integer_array_allocate (class, size);
 	break;
     default:
 	/* should not reach */
@@ -1660,6 +1817,7 @@ Behavior_compile (st_machine *machine)
     st_compiler_error error;
     st_oop receiver;
     st_oop string;
+    st_oop method;
     
     string = ST_STACK_POP (machine);
     receiver = ST_STACK_POP (machine);
@@ -1670,17 +1828,29 @@ Behavior_compile (st_machine *machine)
 	return;
     }
    
-    if (!st_compile_string (receiver,
-			   (char *) st_byte_array_bytes (string),
-			   &error)) {
+    method = st_compile_method (receiver,
+				(char *) st_byte_array_bytes (string),
+				&error);
+    if (method == ST_NIL) {
 	machine->success = false;
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
+    st_machine_methods_changed (machine, receiver, ST_METHOD_SELECTOR (method));
+
     ST_STACK_PUSH (machine, receiver);
 }
 
+static void
+Behavior_flushCache (st_machine *machine)
+{
+    st_oop selector;
+
+    selector = ST_STACK_POP (machine);
+    st_machine_methods_changed (machine, ST_STACK_PEEK (machine), selector);
+}
+
 static void
 SequenceableCollection_size (st_machine *machine)
 {
@@ -1869,23 +2039,19 @@ WideString_at (st_machine *machine)
 {
     int index    = pop_integer32 (machine);
     st_oop receiver = ST_STACK_POP (machine);
-    st_uchar *bytes;
-    st_unichar c;
-	
+
     if (!machine->success) {
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
-    if (index < 1 || index > st_smi_value (st_arrayed_object_size (receiver))) {
+    if (index < 1 || index > st_wide_string_size (receiver)) {
 	set_success (machine, false);
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
-    c = st_word_array_at (receiver, index);
-
-    ST_STACK_PUSH (machine, st_character_new (c));
+    ST_STACK_PUSH (machine, st_character_new (st_wide_string_at (receiver, index)));
 }
 
 static void
@@ -1894,27 +2060,75 @@ WideString_at_put (st_machine *machine)
     st_oop character = ST_STACK_POP (machine);
     int index    = pop_integer32 (machine);
     st_oop receiver = ST_STACK_POP (machine);
-    st_uchar *bytes;
-    st_unichar c;	
+    st_unichar c;
 
     if (!machine->success) {
 	ST_STACK_UNPOP (machine, 3);
 	return;
     }
-  
-    set_success (machine, st_object_class (character) == ST_CHARACTER_CLASS);
 
-    if (index < 1 || index > st_smi_value (st_arrayed_object_size (receiver))) {
+    if (st_object_class (character) != ST_CHARACTER_CLASS
+	|| index < 1 || index > st_wide_string_size (receiver)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    /* a wider character fails, so that the string can be widened in Smalltalk */
+    c = st_character_value (character);
+    if (st_wide_string_width_for (c) > st_smi_value (ST_WIDE_STRING_WIDTH (receiver))) {
 	set_success (machine, false);
 	ST_STACK_UNPOP (machine, 3);
 	return;
     }
 
-    st_word_array_at_put (receiver, index, character);
+    st_wide_string_at_put (receiver, index, c);
 
     ST_STACK_PUSH (machine, character);
 }
 
+/* copies the characters into a ByteArray of a greater width, which replaces
+   the contents of the receiver */
+static void
+WideString_widen (st_machine *machine)
+{
+    int width = pop_integer32 (machine);
+    st_oop contents = ST_STACK_POP (machine);
+    st_oop receiver = ST_STACK_POP (machine);
+    st_uchar *bytes, *old_bytes;
+    int size, old_width;
+
+    size = st_wide_string_size (receiver);
+    if (!machine->success
+	|| (width != 2 && width != 4)
+	|| width <= st_smi_value (ST_WIDE_STRING_WIDTH (receiver))
+	|| st_object_class (contents) != ST_BYTE_ARRAY_CLASS
+	|| st_smi_value (st_arrayed_object_size (contents)) != size * width) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    old_width = st_smi_value (ST_WIDE_STRING_WIDTH (receiver));
+    old_bytes = st_byte_array_bytes (ST_WIDE_STRING_CONTENTS (receiver));
+    bytes = st_byte_array_bytes (contents);
+    for (int i = 0; i < size; i++)
+	st_wide_string_set (bytes, width, i, st_wide_string_get (old_bytes, old_width, i));
+
+    ST_WIDE_STRING_CONTENTS (receiver) = contents;
+    ST_WIDE_STRING_WIDTH (receiver) = st_smi_new (width);
+
+    ST_STACK_PUSH (machine, receiver);
+}
+
+static void
+WideString_size (st_machine *machine)
+{
+    st_oop receiver = ST_STACK_POP (machine);
+
+    ST_STACK_PUSH (machine, st_smi_new (st_wide_string_size (receiver)));
+}
+
 static void
 WordArray_at (st_machine *machine)
 {
@@ -1986,8 +2200,7 @@ FloatArray_at_put (st_machine *machine)
     int index    = pop_integer32 (machine);
     st_oop receiver = ST_STACK_POP (machine);
 
-    set_success (machine, st_object_is_heap (flt) &&
-		 st_object_format (flt) == ST_FORMAT_FLOAT);
+    set_success (machine, st_object_is_float (flt));
 
     if (ST_UNLIKELY (index < 1 || index > st_smi_value (st_arrayed_object_size (receiver)))) {
 	set_success (machine, false);
@@ -2004,12 +2217,225 @@ FloatArray_at_put (st_machine *machine)
     ST_STACK_PUSH (machine, flt);
 }
 
+/* answers value as a SmallInteger, or as a LargeInteger if it doesn't fit */
+static inline st_oop
+integer_new (int64_t value)
+{
+    if (value >= ST_SMALL_INTEGER_MIN && value <= ST_SMALL_INTEGER_MAX)
+	return st_smi_new (value);
+
+    return st_large_integer_new_from_int64 (value);
+}
+
+static inline bool
+pop_integer64 (st_machine *machine, int64_t *value)
+{
+    st_oop object = ST_STACK_POP (machine);
+
+    if (st_object_is_smi (object)
+	|| st_object_class (object) == ST_LARGE_INTEGER_CLASS)
+	if (integer_int64 (object, value))
+	    return true;
+
+    set_success (machine, false);
+    return false;
+}
+
+static void
+IntegerArray_at (st_machine *machine)
+{
+    st_oop receiver;
+    int index;
+
+    index = pop_integer32 (machine);
+    receiver = ST_STACK_POP (machine);
+
+    if (ST_UNLIKELY (!machine->success
+		     || index < 1 || index > st_smi_value (st_arrayed_object_size (receiver)))) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    ST_STACK_PUSH (machine, integer_new (st_integer_array_at (receiver, index)));
+}
+
+static void
+IntegerArray_at_put (st_machine *machine)
+{
+    st_oop integer;
+    int64_t value;
+    int index;
+    st_oop receiver;
+
+    integer = ST_STACK_PEEK (machine);
+    pop_integer64 (machine, &value);
+    index = pop_integer32 (machine);
+    receiver = ST_STACK_POP (machine);
+
+    if (ST_UNLIKELY (!machine->success
+		     || index < 1 || index > st_smi_value (st_arrayed_object_size (receiver)))) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    st_integer_array_at_put (receiver, index, value);
+    ST_STACK_PUSH (machine, integer);
+}
+
+/*
+ * The bulk primitives below are written as plain loops over the elements,
+ * without branches or calls in them, so that the compiler can vectorize
+ * them. Those that could overflow check all elements before storing any.
+ */
+
+static void
+IntegerArray_sum (st_machine *machine)
+{
+    st_oop receiver = ST_STACK_POP (machine);
+    const int64_t *elements;
+    int64_t high = 0, sum;
+    uint64_t low = 0;
+    int size;
+
+    elements = st_integer_array_elements (receiver);
+    size = st_smi_value (st_arrayed_object_size (receiver));
+
+    /* the upper and lower halves are summed apart, neither of which can
+       overflow for fewer than 2^31 elements */
+    for (int i = 0; i < size; i++) {
+	high += elements[i] >> 32;
+	low += (uint32_t) elements[i];
+    }
+
+    if (__builtin_mul_overflow (high, (int64_t) 1 << 32, &sum)
+	|| low > INT64_MAX
+	|| __builtin_add_overflow (sum, (int64_t) low, &sum)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    ST_STACK_PUSH (machine, integer_new (sum));
+}
+
+static void
+IntegerArray_min (st_machine *machine)
+{
+    st_oop receiver = ST_STACK_POP (machine);
+    const int64_t *elements;
+    int64_t min;
+    int size;
+
+    elements = st_integer_array_elements (receiver);
+    size = st_smi_value (st_arrayed_object_size (receiver));
+
+    if (size == 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    min = elements[0];
+    for (int i = 1; i < size; i++)
+	min = elements[i] < min ? elements[i] : min;
+
+    ST_STACK_PUSH (machine, integer_new (min));
+}
+
+static void
+IntegerArray_max (st_machine *machine)
+{
+    st_oop receiver = ST_STACK_POP (machine);
+    const int64_t *elements;
+    int64_t max;
+    int size;
+
+    elements = st_integer_array_elements (receiver);
+    size = st_smi_value (st_arrayed_object_size (receiver));
+
+    if (size == 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    max = elements[0];
+    for (int i = 1; i < size; i++)
+	max = elements[i] > max ? elements[i] : max;
+
+    ST_STACK_PUSH (machine, integer_new (max));
+}
+
+static void
+IntegerArray_addScalar (st_machine *machine)
+{
+    int64_t value, overflow = 0;
+    st_oop receiver;
+    int64_t *elements;
+    int size;
+
+    pop_integer64 (machine, &value);
+    receiver = ST_STACK_POP (machine);
+
+    if (!machine->success) {
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    elements = st_integer_array_elements (receiver);
+    size = st_smi_value (st_arrayed_object_size (receiver));
+
+    /* a sum overflowed if its sign differs from those of both operands */
+    for (int i = 0; i < size; i++) {
+	int64_t sum = (int64_t) ((uint64_t) elements[i] + (uint64_t) value);
+	overflow |= (elements[i] ^ sum) & (value ^ sum);
+    }
+
+    if (overflow < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    for (int i = 0; i < size; i++)
+	elements[i] += value;
+
+    ST_STACK_PUSH (machine, receiver);
+}
+
+static void
+IntegerArray_accumulate (st_machine *machine)
+{
+    st_oop receiver = ST_STACK_POP (machine);
+    int64_t *elements;
+    int64_t sum = 0;
+    int size;
+
+    elements = st_integer_array_elements (receiver);
+    size = st_smi_value (st_arrayed_object_size (receiver));
+
+    /* each sum depends on the one before, so this loop stays scalar */
+    for (int i = 0; i < size; i++) {
+	if (__builtin_add_overflow (sum, elements[i], &sum)) {
+	    set_success (machine, false);
+	    ST_STACK_UNPOP (machine, 1);
+	    return;
+	}
+    }
+
+    for (int i = 1; i < size; i++)
+	elements[i] += elements[i - 1];
+
+    ST_STACK_PUSH (machine, receiver);
+}
+
 static void
 BlockContext_value (st_machine *machine)
 {
     st_oop  block;
     st_uint  argcount;
-    st_oop home;
 
     block = machine->message_receiver;
     argcount = st_smi_value (ST_BLOCK_CONTEXT_ARGCOUNT (block));
@@ -2018,16 +2444,7 @@ BlockContext_value (st_machine *machine)
 	return;
     }
 
-    st_oops_copy (ST_BLOCK_CONTEXT_STACK (block),
-		  machine->stack + machine->sp - argcount,
-		  argcount);
-    machine->sp -= machine->message_argcount + 1;
-    
-    ST_CONTEXT_PART_IP (block) = ST_BLOCK_CONTEXT_INITIALIP (block);
-    ST_CONTEXT_PART_SP (block) = st_smi_new (argcount);
-    ST_CONTEXT_PART_SENDER (block) = machine->context;
-
-    st_machine_set_active_context (machine, block);
+    st_machine_activate_block (machine);
 }
 
 static void
@@ -2050,18 +2467,8 @@ BlockContext_valueWithArguments (st_machine *machine)
 	set_success (machine, false);
 	return;
     }
-    
-    st_oops_copy (ST_BLOCK_CONTEXT_STACK (block),
-		  ST_ARRAY (values)->elements,
-		  argcount);
-    
-    machine->sp -= machine->message_argcount + 1;
-
-    ST_CONTEXT_PART_IP (block) = ST_BLOCK_CONTEXT_INITIALIP (block);
-    ST_CONTEXT_PART_SP (block) = st_smi_new (argcount);
-    ST_CONTEXT_PART_SENDER (block) = machine->context;
 
-    st_machine_set_active_context (machine, block);
+    st_machine_activate_block_with_arguments (machine);
 }
 
 static void
@@ -2072,6 +2479,66 @@ System_exitWithResult (st_machine *machine)
     longjmp (machine->main_loop, 0);
 }
 
+static void
+System_bytesAllocated (st_machine *machine)
+{
+    st_ulong total;
+
+    (void) ST_STACK_POP (machine);
+
+    total = memory->total_allocated + memory->counter;
+    if (total <= ST_SMALL_INTEGER_MAX) {
+	ST_STACK_PUSH (machine, st_smi_new (total));
+	return;
+    }
+
+    ST_STACK_PUSH (machine, st_large_integer_new_from_int64 (total));
+}
+
+static void
+ObjectMemory_garbageCollect (st_machine *machine)
+{
+    st_memory_perform_gc ();
+}
+
+/* answers the receiver, which is left on the stack */
+static void
+ObjectMemory_snapshot (st_machine *machine)
+{
+    st_oop filename = ST_STACK_PEEK (machine);
+    char *name;
+    bool saved;
+
+    if (st_object_class (filename) != ST_STRING_CLASS) {
+	set_success (machine, false);
+	return;
+    }
+
+    /* the name is copied out first, since the heap is compacted */
+    name = st_strdup ((const char *) st_byte_array_bytes (filename));
+    saved = st_image_save (name);
+    st_free (name);
+
+    if (!saved) {
+	set_success (machine, false);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+}
+
+static void
+System_millisecondClock (st_machine *machine)
+{
+    struct timespec spec;
+
+    (void) ST_STACK_POP (machine);
+
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &spec);
+
+    ST_STACK_PUSH (machine, st_smi_new ((spec.tv_sec * 1000 + spec.tv_nsec / 1000000) & ST_SMALL_INTEGER_MAX));
+}
+
 static void
 Character_value (st_machine *machine)
 {
@@ -2296,6 +2763,7 @@ const struct st_primitive st_primitives[] = {
     
     { "Behavior_new",                 Behavior_new                },
     { "Behavior_newSize",             Behavior_newSize            },
+    { "Behavior_flushCache",          Behavior_flushCache         },
     { "Behavior_compile",             Behavior_compile            },
 
 
@@ -2315,6 +2783,8 @@ const struct st_primitive st_primitives[] = {
 
     { "WideString_at",                 WideString_at               },
     { "WideString_at_put",             WideString_at_put           },
+    { "WideString_size",               WideString_size             },
+    { "WideString_widen",              WideString_widen            },
 
     { "WordArray_at",                  WordArray_at                },
     { "WordArray_at_put",              WordArray_at_put            },
@@ -2322,7 +2792,20 @@ const struct st_primitive st_primitives[] = {
     { "FloatArray_at",                 FloatArray_at               },
     { "FloatArray_at_put",             FloatArray_at_put           },
 
+    { "IntegerArray_at",               IntegerArray_at             },
+    { "IntegerArray_at_put",           IntegerArray_at_put         },
+    { "IntegerArray_sum",              IntegerArray_sum            },
+    { "IntegerArray_min",              IntegerArray_min            },
+    { "IntegerArray_max",              IntegerArray_max            },
+    { "IntegerArray_addScalar",        IntegerArray_addScalar      },
+    { "IntegerArray_accumulate",       IntegerArray_accumulate     },
+
     { "System_exitWithResult",          System_exitWithResult },
+    { "System_bytesAllocated",          System_bytesAllocated },
+    { "System_millisecondClock",        System_millisecondClock },
+
+    { "ObjectMemory_garbageCollect",    ObjectMemory_garbageCollect },
+    { "ObjectMemory_snapshot",          ObjectMemory_snapshot },
 
     { "Character_value",                 Character_value },
     { "Character_characterFor",          Character_characterFor },
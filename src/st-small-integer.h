@@ -28,15 +28,15 @@
 #include <st-types.h>
 
 static inline st_oop
-st_smi_new (int num)
+st_smi_new (st_smi num)
 {
     return (((st_oop) num) << ST_TAG_SIZE) + ST_SMI_TAG;
 }
 
-static inline int
+static inline st_smi
 st_smi_value (st_oop smi)
 {
-    return ((int) smi) >> ST_TAG_SIZE;
+    return ((st_smi) smi) >> ST_TAG_SIZE;
 }
 
 static inline st_oop
@@ -51,6 +51,52 @@ st_smi_decrement (st_oop smi)
     return st_smi_new (st_smi_value (smi) - 1);
 }
 
+static inline bool
+st_smi_in_range (st_smi value)
+{
+    return value >= ST_SMALL_INTEGER_MIN && value <= ST_SMALL_INTEGER_MAX;
+}
+
+/* the quotient and remainder of // and \\, which round towards negative
+   infinity where C truncates. y must not be 0 */
+static inline st_smi
+st_smi_floor_div (st_smi x, st_smi y)
+{
+    st_smi q = x / y;
+
+    if (x % y != 0 && (x < 0) != (y < 0))
+	q -= 1;
+    return q;
+}
+
+static inline st_smi
+st_smi_floor_mod (st_smi x, st_smi y)
+{
+    st_smi r = x % y;
+
+    if (r != 0 && (r < 0) != (y < 0))
+	r += y;
+    return r;
+}
+
+/* shifts left for a positive shift, answering false if the result is no SmallInteger */
+static inline bool
+st_smi_bit_shift (st_smi value, st_smi shift, st_smi *result)
+{
+    if (shift < 0) {
+	*result = value >> (shift > -ST_BITS_PER_WORD ? -shift : ST_BITS_PER_WORD - 1);
+	return true;
+    }
+
+    if (shift >= ST_BITS_PER_WORD - ST_TAG_SIZE) {
+	*result = 0;
+	return value == 0;
+    }
+
+    *result = (st_smi) ((st_oop) value << shift);
+    return (*result >> shift) == value && st_smi_in_range (*result);
+}
+
 static inline bool
 st_smi_equal (st_oop m, st_oop n)
 {
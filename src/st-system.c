@@ -34,15 +34,30 @@ st_pointer
 st_system_reserve_memory (st_pointer addr, st_uint size)
 {
     /* Reserves a virtual memory region without actually allocating any 
-     * storage in physical memory or swap space.
+     * storage in physical memory or swap space. The region starts at addr
+     * if that is given and free, or wherever the system chooses otherwise.
      */
-    int flags = 0;
+    return st_mmap_anon (addr, size, PROT_NONE, MAP_NORESERVE);
+}
 
-    flags = MAP_NORESERVE;
-    if (addr)
-	flags |= MAP_FIXED;
+st_pointer
+st_system_map_file (st_pointer addr, st_uint size, int fd, off_t offset)
+{
+    /* Maps part of a file over reserved memory at addr. Pages are read
+     * when first touched, and copied when first written, so the file
+     * itself never changes.
+     */
+    st_pointer result;
 
-    return st_mmap_anon (addr, size, PROT_NONE, flags);
+    result = mmap (addr, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_FIXED, fd, offset);
+
+    if (result == (st_pointer) -1) {
+	fprintf (stderr, "panda: error: %s\n", strerror (errno));
+	return NULL;
+    }
+
+    return result;
 }
 
 st_pointer
@@ -95,6 +110,18 @@ st_system_release_memory (st_pointer addr, st_uint size)
     }
 }
 
+bool
+st_system_protect_executable (st_pointer addr, st_uint size)
+{
+    /* Makes committed memory read-only and executable
+     */
+    if (mprotect (addr, size, PROT_READ | PROT_EXEC) < 0) {
+	fprintf (stderr, "panda: error: %s\n", strerror (errno));
+	return false;
+    }
+    return true;
+}
+
 st_uint
 st_system_pagesize (void)
 {
@@ -5,6 +5,7 @@
 
 
 #include <st-types.h>
+#include <sys/types.h>
 
 st_uint    st_system_pagesize        (void);
 
@@ -12,10 +13,14 @@ st_pointer st_system_reserve_memory  (st_pointer addr, st_uint size);
 
 st_pointer st_system_commit_memory   (st_pointer addr, st_uint size);
 
+st_pointer st_system_map_file        (st_pointer addr, st_uint size, int fd, off_t offset);
+
 st_pointer st_system_decommit_memory (st_pointer addr, st_uint size);
 
 void       st_system_release_memory  (st_pointer addr, st_uint size);
 
+bool       st_system_protect_executable (st_pointer addr, st_uint size);
+
 
 #endif /* __ST_SYSTEM_H__ */
 
@@ -43,8 +43,13 @@
 #  define ST_BITS_PER_INTEGER  32
 #endif
 
+/* SmallIntegers take all the bits of a word but the tag */
 #define ST_SMALL_INTEGER_MIN  (-ST_SMALL_INTEGER_MAX - 1)
-#define ST_SMALL_INTEGER_MAX  536870911
+#if ST_HOST64
+#  define ST_SMALL_INTEGER_MAX  2305843009213693951L
+#else
+#  define ST_SMALL_INTEGER_MAX  536870911
+#endif
 
 enum {
     ST_SMI_TAG,
@@ -55,12 +60,34 @@ enum {
 
 #define ST_TAG_SIZE 2
 
+/* On 64-bit hosts, heap objects are 8-byte aligned, so pointers always
+ * have 0 in the third tag bit. Floats with an exponent in range are
+ * immediates that have 1 there instead.
+ */
+#if ST_HOST64
+#  define ST_HAVE_IMMEDIATE_FLOATS 1
+#  define ST_FLOAT_TAG      5
+#  define ST_FLOAT_TAG_SIZE 3
+#endif
+
+/* On 64-bit hosts, the upper half of the header word is free to hold the
+ * index of the class of an object in the class table, in place of a
+ * pointer to it.
+ */
+#if ST_HOST64
+#  define ST_HAVE_COMPACT_HEADERS 1
+#  define ST_CLASS_INDEX_SHIFT    32
+#endif
+
 /* basic oop pointer:
  * integral type wide enough to hold a C pointer.
- * Can either point to a heap object or contain a smi or Character immediate.
+ * Can either point to a heap object or contain a smi, Character or Float immediate.
  */
 typedef uintptr_t st_oop;
 
+/* value of a SmallInteger */
+typedef intptr_t st_smi;
+
 typedef unsigned char    st_uchar;
 typedef unsigned short   st_ushort;
 typedef unsigned long    st_ulong;
@@ -47,6 +47,8 @@
 #include <stdio.h>
 
 static bool verbose_mode = false;
+static bool cache_mode = true;
+static bool lazy_mode = false;
 
 st_memory *memory = NULL;
 
@@ -57,14 +59,15 @@ st_oop st_global_get(const char *name) {
 
 enum {
 	INSTANCE_SIZE_UNDEFINED = 0,
-	INSTANCE_SIZE_CLASS = 6,
-	INSTANCE_SIZE_METACLASS = 6,
+	INSTANCE_SIZE_CLASS = 7,
+	INSTANCE_SIZE_METACLASS = 7,
 	INSTANCE_SIZE_DICTIONARY = 3,
 	INSTANCE_SIZE_SET = 3,
 	INSTANCE_SIZE_ASSOCIATION = 2,
+	INSTANCE_SIZE_WIDE_STRING = 2,
 	INSTANCE_SIZE_SYSTEM = 2,
 	INSTANCE_SIZE_METHOD_CONTEXT = 5,
-	INSTANCE_SIZE_BLOCK_CONTEXT = 6
+	INSTANCE_SIZE_BLOCK_CONTEXT = 8
 };
 
 static st_oop
@@ -74,7 +77,7 @@ class_new(st_format format, st_uint instance_size) {
 	class = st_memory_allocate(ST_SIZE_OOPS (struct st_class));
 
 	ST_OBJECT_MARK (class) = 0 | ST_MARK_TAG;
-	ST_OBJECT_CLASS (class) = ST_NIL;
+	st_object_set_class(class, ST_NIL);
 	st_object_set_format(class, ST_FORMAT_OBJECT);
 	st_object_set_instance_size(class, INSTANCE_SIZE_CLASS);
 
@@ -83,6 +86,7 @@ class_new(st_format format, st_uint instance_size) {
 	ST_BEHAVIOR_SUPERCLASS (class) = ST_NIL;
 	ST_BEHAVIOR_METHOD_DICTIONARY (class) = ST_NIL;
 	ST_BEHAVIOR_INSTANCE_VARIABLES (class) = ST_NIL;
+	ST_BEHAVIOR_CLASS_INDEX (class) = ST_NIL;
 	ST_CLASS (class)->name = ST_NIL;
 	return class;
 }
@@ -118,7 +122,7 @@ static void initialize_class(const char *name, const char *super_name, st_list *
 		metaclass = st_object_class(class);
 		if (metaclass == ST_NIL) {
 			metaclass = st_object_new(ST_METACLASS_CLASS);
-			ST_OBJECT_CLASS (class) = metaclass;
+			st_object_set_class(class, metaclass);
 		}
 
 		ST_BEHAVIOR_SUPERCLASS (class) = ST_NIL;
@@ -135,14 +139,14 @@ static void initialize_class(const char *name, const char *super_name, st_list *
 		if (class == ST_NIL)
 			class = class_new(st_smi_value(ST_BEHAVIOR_FORMAT (superclass)), 0);
 
-		metaclass = ST_HEADER (class)->class;
+		metaclass = ST_OBJECT_CLASS (class);
 		if (metaclass == ST_NIL) {
 			metaclass = st_object_new(ST_METACLASS_CLASS);
-			ST_OBJECT_CLASS (class) = metaclass;
+			st_object_set_class(class, metaclass);
 		}
 
 		ST_BEHAVIOR_SUPERCLASS (class) = superclass;
-		ST_BEHAVIOR_SUPERCLASS (metaclass) = ST_HEADER (superclass)->class;
+		ST_BEHAVIOR_SUPERCLASS (metaclass) = ST_OBJECT_CLASS (superclass);
 		ST_BEHAVIOR_INSTANCE_SIZE (class) = st_smi_new(st_list_length(ivarnames) +
 		                                               st_smi_value(ST_BEHAVIOR_INSTANCE_SIZE (superclass)));
 	}
@@ -311,6 +315,7 @@ static void file_in_classes(void) {
 			"ByteArray.st",
 			"WordArray.st",
 			"FloatArray.st",
+			"IntegerArray.st",
 			"Association.st",
 			"Magnitude.st",
 			"Number.st",
@@ -337,6 +342,7 @@ static void file_in_classes(void) {
 			"OrderedCollection.st",
 			"List.st",
 			"System.st",
+			"ObjectMemory.st",
 			"CompiledMethod.st",
 			"FileStream.st",
 			"pidigits.st"
@@ -355,7 +361,12 @@ static st_oop create_nil_object(void) {
 	st_oop nil;
 	nil = st_memory_allocate(NIL_SIZE_OOPS);
 	ST_OBJECT_MARK (nil) = 0 | ST_MARK_TAG;
+#ifdef ST_HAVE_COMPACT_HEADERS
+	/* the class table is empty as yet, and index 0 stands for nil */
+	st_object_set_class_index(nil, 0);
+#else
 	ST_OBJECT_CLASS (nil) = nil;
+#endif
 	st_object_set_format(nil, ST_FORMAT_OBJECT);
 	st_object_set_instance_size(nil, 0);
 	return nil;
@@ -386,11 +397,16 @@ static void init_specials(void) {
 	ST_SELECTOR_CLASS = st_symbol_new("class");
 	ST_SELECTOR_NEW = st_symbol_new("new");
 	ST_SELECTOR_NEW_ARG = st_symbol_new("new:");
+	ST_SELECTOR_VALUE_ARG2 = st_symbol_new("value:value:");
+	ST_SELECTOR_VALUE_ARG3 = st_symbol_new("value:value:value:");
 	ST_SELECTOR_DOESNOTUNDERSTAND = st_symbol_new("doesNotUnderstand:");
 	ST_SELECTOR_MUSTBEBOOLEAN = st_symbol_new("mustBeBoolean");
 	ST_SELECTOR_STARTUPSYSTEM = st_symbol_new("startupSystem");
 	ST_SELECTOR_CANNOTRETURN = st_symbol_new("cannotReturn");
 	ST_SELECTOR_OUTOFMEMORY = st_symbol_new("outOfMemory");
+	ST_SELECTOR_BASICNEW = st_symbol_new("basicNew");
+	ST_SELECTOR_BASICNEW_ARG = st_symbol_new("basicNew:");
+	ST_SELECTOR_INITIALIZE = st_symbol_new("initialize");
 }
 
 void bootstrap_universe(void) {
@@ -400,6 +416,9 @@ void bootstrap_universe(void) {
 	st_memory_new();
 
 	ST_NIL = create_nil_object();
+#ifdef ST_HAVE_COMPACT_HEADERS
+	st_behavior_initialize_class_table();
+#endif
 
 	st_object_class_ = class_new(ST_FORMAT_OBJECT, 0);
 	ST_UNDEFINED_OBJECT_CLASS = class_new(ST_FORMAT_OBJECT, 0);
@@ -415,12 +434,13 @@ void bootstrap_universe(void) {
 	ST_ARRAY_CLASS = class_new(ST_FORMAT_ARRAY, 0);
 	ST_WORD_ARRAY_CLASS = class_new(ST_FORMAT_WORD_ARRAY, 0);
 	ST_FLOAT_ARRAY_CLASS = class_new(ST_FORMAT_FLOAT_ARRAY, 0);
+	ST_INTEGER_ARRAY_CLASS = class_new(ST_FORMAT_INTEGER_ARRAY, 0);
 	ST_DICTIONARY_CLASS = class_new(ST_FORMAT_OBJECT, INSTANCE_SIZE_DICTIONARY);
 	ST_SET_CLASS = class_new(ST_FORMAT_OBJECT, INSTANCE_SIZE_SET);
 	ST_BYTE_ARRAY_CLASS = class_new(ST_FORMAT_BYTE_ARRAY, 0);
 	ST_SYMBOL_CLASS = class_new(ST_FORMAT_BYTE_ARRAY, 0);
 	ST_STRING_CLASS = class_new(ST_FORMAT_BYTE_ARRAY, 0);
-	ST_WIDE_STRING_CLASS = class_new(ST_FORMAT_WORD_ARRAY, 0);
+	ST_WIDE_STRING_CLASS = class_new(ST_FORMAT_OBJECT, INSTANCE_SIZE_WIDE_STRING);
 	ST_ASSOCIATION_CLASS = class_new(ST_FORMAT_OBJECT, INSTANCE_SIZE_ASSOCIATION);
 	ST_COMPILED_METHOD_CLASS = class_new(ST_FORMAT_OBJECT, 0);
 	ST_METHOD_CONTEXT_CLASS = class_new(ST_FORMAT_CONTEXT, INSTANCE_SIZE_METHOD_CONTEXT);
@@ -429,7 +449,7 @@ void bootstrap_universe(void) {
 	ST_HANDLE_CLASS = class_new(ST_FORMAT_HANDLE, 0);
 	ST_MESSAGE_CLASS = class_new(ST_FORMAT_OBJECT, 2);
 
-	ST_OBJECT_CLASS (ST_NIL) = ST_UNDEFINED_OBJECT_CLASS;
+	st_object_set_class(ST_NIL, ST_UNDEFINED_OBJECT_CLASS);
 
 	/* special objects */
 	ST_TRUE = st_object_new(ST_TRUE_CLASS);
@@ -456,6 +476,7 @@ void bootstrap_universe(void) {
 	add_global("ByteArray", ST_BYTE_ARRAY_CLASS);
 	add_global("WordArray", ST_WORD_ARRAY_CLASS);
 	add_global("FloatArray", ST_FLOAT_ARRAY_CLASS);
+	add_global("IntegerArray", ST_INTEGER_ARRAY_CLASS);
 	add_global("ByteString", ST_STRING_CLASS);
 	add_global("ByteSymbol", ST_SYMBOL_CLASS);
 	add_global("WideString", ST_WIDE_STRING_CLASS);
@@ -491,4 +512,20 @@ bool st_get_verbose_mode(void) {
 	return verbose_mode;
 }
 
+void st_set_cache_mode(bool cache) {
+	cache_mode = cache;
+}
+
+bool st_get_cache_mode(void) {
+	return cache_mode;
+}
+
+void st_set_lazy_mode(bool lazy) {
+	lazy_mode = lazy;
+}
+
+bool st_get_lazy_mode(void) {
+	return lazy_mode;
+}
+
 
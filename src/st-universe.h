@@ -66,6 +66,10 @@
 #define ST_SELECTOR_STARTUPSYSTEM     __machine.globals[33]
 #define ST_SELECTOR_CANNOTRETURN      __machine.globals[34]
 #define ST_SELECTOR_OUTOFMEMORY       __machine.globals[35]
+#define ST_SELECTOR_BASICNEW          __machine.globals[36]
+#define ST_SELECTOR_BASICNEW_ARG      __machine.globals[37]
+#define ST_SELECTOR_INITIALIZE        __machine.globals[38]
+#define ST_INTEGER_ARRAY_CLASS        __machine.globals[39]
 
 #define ST_SELECTOR_PLUS       __machine.selectors[0]
 #define ST_SELECTOR_MINUS      __machine.selectors[1]
@@ -91,6 +95,8 @@
 #define ST_SELECTOR_CLASS      __machine.selectors[21]
 #define ST_SELECTOR_NEW        __machine.selectors[22]
 #define ST_SELECTOR_NEW_ARG    __machine.selectors[23]
+#define ST_SELECTOR_VALUE_ARG2 __machine.selectors[24]
+#define ST_SELECTOR_VALUE_ARG3 __machine.selectors[25]
 
 extern st_memory *memory;
 
@@ -102,5 +108,15 @@ void st_set_verbose_mode(bool verbose);
 
 bool st_get_verbose_mode(void) ST_GNUC_PURE;
 
+/* whether methods filed in from st/ are kept in the bytecode cache */
+void st_set_cache_mode(bool cache);
+
+bool st_get_cache_mode(void) ST_GNUC_PURE;
+
+/* whether methods filed in from st/ are only compiled once they are sent */
+void st_set_lazy_mode(bool lazy);
+
+bool st_get_lazy_mode(void) ST_GNUC_PURE;
+
 void bootstrap_universe(void);
 #endif /* __ST_UNIVERSE_H__ */
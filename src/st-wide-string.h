@@ -0,0 +1,108 @@
+/*
+ * st-wide-string.h
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_WIDE_STRING_H__
+#define __ST_WIDE_STRING_H__
+
+#include <st-types.h>
+#include <st-object.h>
+#include <st-array.h>
+#include <st-small-integer.h>
+
+/*
+ * A WideString keeps its characters in a ByteArray, using 1, 2 or 4 bytes
+ * for each of them, depending on the widest character it has held. Storing
+ * a wider character replaces the ByteArray with a wider one.
+ */
+struct st_wide_string
+{
+    struct st_header __parent__;
+    st_oop contents;
+    st_oop width;
+};
+
+#define ST_WIDE_STRING(oop)          ((struct st_wide_string *) st_detag_pointer (oop))
+#define ST_WIDE_STRING_CONTENTS(oop) (ST_WIDE_STRING (oop)->contents)
+#define ST_WIDE_STRING_WIDTH(oop)    (ST_WIDE_STRING (oop)->width)
+
+/* bytes needed to store a character */
+static inline int
+st_wide_string_width_for (st_unichar c)
+{
+    return c <= 0xFF ? 1 : c <= 0xFFFF ? 2 : 4;
+}
+
+static inline int
+st_wide_string_size (st_oop string)
+{
+    return st_smi_value (st_arrayed_object_size (ST_WIDE_STRING_CONTENTS (string)))
+	/ st_smi_value (ST_WIDE_STRING_WIDTH (string));
+}
+
+/* the character at index i, from 0, in bytes of the given width */
+static inline st_unichar
+st_wide_string_get (const st_uchar *bytes, int width, int i)
+{
+    switch (width) {
+    case 1:
+	return bytes[i];
+    case 2:
+	return ((const uint16_t *) bytes)[i];
+    default:
+	return ((const uint32_t *) bytes)[i];
+    }
+}
+
+static inline void
+st_wide_string_set (st_uchar *bytes, int width, int i, st_unichar c)
+{
+    switch (width) {
+    case 1:
+	bytes[i] = c;
+	break;
+    case 2:
+	((uint16_t *) bytes)[i] = c;
+	break;
+    default:
+	((uint32_t *) bytes)[i] = c;
+	break;
+    }
+}
+
+static inline st_unichar
+st_wide_string_at (st_oop string, int i)
+{
+    return st_wide_string_get (st_byte_array_bytes (ST_WIDE_STRING_CONTENTS (string)),
+			       st_smi_value (ST_WIDE_STRING_WIDTH (string)), i - 1);
+}
+
+/* the character must fit in the width of the string */
+static inline void
+st_wide_string_at_put (st_oop string, int i, st_unichar c)
+{
+    st_wide_string_set (st_byte_array_bytes (ST_WIDE_STRING_CONTENTS (string)),
+			st_smi_value (ST_WIDE_STRING_WIDTH (string)), i - 1, c);
+}
+
+#endif /* __ST_WIDE_STRING_H__ */